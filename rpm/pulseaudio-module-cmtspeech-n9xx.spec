@@ -2,6 +2,9 @@ Name:       pulseaudio-module-cmtspeech-n9xx
 
 %define pulseversion 6.0
 
+# USDT tracepoints, build with --without tracepoints to leave them out
+%bcond_without tracepoints
+
 Summary:    Cmtspeech module for PulseAudio on N9xx
 Version:    6.0.4
 Release:    1
@@ -15,6 +18,9 @@ BuildRequires:  pkgconfig(pulsecore) >= 6.0
 BuildRequires:  pkgconfig(libmeego-common) >= 6.0.15
 BuildRequires:  libcmtspeechdata-devel
 BuildRequires:  libtool-ltdl-devel
+%if %{with tracepoints}
+BuildRequires:  systemtap-sdt-devel
+%endif
 
 %description
 Cmtspeech module for PulseAudio on N9xx device.
@@ -25,9 +31,12 @@ Cmtspeech module for PulseAudio on N9xx device.
 %build
 autoreconf -vfi
 
-%reconfigure --disable-static
+%reconfigure --disable-static %{?with_tracepoints:--enable-tracepoints}%{!?with_tracepoints:--disable-tracepoints}
 make %{?jobs:-j%jobs}
 
+%check
+make check
+
 %install
 rm -rf %{buildroot}
 %make_install
@@ -35,3 +44,4 @@ rm -rf %{buildroot}
 %files
 %defattr(-,root,root,-)
 %{_libdir}/pulse-%{pulseversion}/modules/module-meego-cmtspeech.so
+%{_bindir}/cmtspeech-stats
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include "cmtspeech-call-report.h"
+#include "cmtspeech-mainloop-handler.h"
+
+/* Per-call metrics
+ *
+ * The IO threads count into u->call_metrics with atomic increments. The
+ * cmtspeech thread clears the metrics when a call connects and, when it
+ * disconnects or the modem instance is lost, snapshots them into a
+ * report that the main thread sends on DBus. */
+
+/* cmtspeech thread */
+void cmtspeech_call_report_begin(struct userdata *u, pa_usec_t now) {
+    struct cmtspeech_call_metrics *m;
+    unsigned i;
+
+    pa_assert(u);
+    m = &u->call_metrics;
+
+    pa_atomic_store(&m->dl_frames, 0);
+    pa_atomic_store(&m->dl_bad_frames, 0);
+    pa_atomic_store(&m->dl_silent_frames, 0);
+    pa_atomic_store(&m->dl_drops, 0);
+    pa_atomic_store(&m->dl_queue_overflows, 0);
+    pa_atomic_store(&m->ul_frames, 0);
+    pa_atomic_store(&m->ul_failures, 0);
+    pa_atomic_store(&m->modem_resets, 0);
+    for (i = 0; i < CMTSPEECH_CALL_DEPTH_BUCKETS; i++)
+        pa_atomic_store(&m->dl_depth[i], 0);
+
+    m->start = now;
+}
+
+/* Depth percentile in ms, buckets are whole DL frames */
+static uint32_t depth_percentile(struct userdata *u, const unsigned *hist, unsigned total, unsigned percent) {
+    unsigned i, sum = 0, limit;
+
+    if (!total)
+        return 0;
+
+    limit = (total * percent + 99) / 100;
+    for (i = 0; i < CMTSPEECH_CALL_DEPTH_BUCKETS - 1; i++) {
+        sum += hist[i];
+        if (sum >= limit)
+            break;
+    }
+
+    return (uint32_t) (i * u->frame_usec / PA_USEC_PER_MSEC);
+}
+
+/* cmtspeech thread. Does nothing if no call was started. */
+void cmtspeech_call_report_end(struct userdata *u, pa_usec_t now) {
+    struct cmtspeech_call_metrics *m;
+    struct cmtspeech_call_report *r;
+    unsigned hist[CMTSPEECH_CALL_DEPTH_BUCKETS];
+    unsigned i, total = 0;
+
+    pa_assert(u);
+    m = &u->call_metrics;
+
+    if (!m->start)
+        return;
+
+    for (i = 0; i < CMTSPEECH_CALL_DEPTH_BUCKETS; i++) {
+        hist[i] = (unsigned) pa_atomic_load(&m->dl_depth[i]);
+        total += hist[i];
+    }
+
+    r = pa_xnew0(struct cmtspeech_call_report, 1);
+    r->duration_ms = (uint32_t) ((now - m->start) / PA_USEC_PER_MSEC);
+    r->emergency = u->cmt_connection.call_emergency;
+    r->dl_frames = (uint32_t) pa_atomic_load(&m->dl_frames);
+    r->dl_bad_frames = (uint32_t) pa_atomic_load(&m->dl_bad_frames);
+    r->dl_silent_frames = (uint32_t) pa_atomic_load(&m->dl_silent_frames);
+    r->dl_drops = (uint32_t) pa_atomic_load(&m->dl_drops);
+    r->dl_queue_overflows = (uint32_t) pa_atomic_load(&m->dl_queue_overflows);
+    r->dl_depth_p50_ms = depth_percentile(u, hist, total, 50);
+    r->dl_depth_p99_ms = depth_percentile(u, hist, total, 99);
+    r->ul_frames = (uint32_t) pa_atomic_load(&m->ul_frames);
+    r->ul_failures = (uint32_t) pa_atomic_load(&m->ul_failures);
+    r->modem_resets = (uint32_t) pa_atomic_load(&m->modem_resets);
+
+    m->start = 0;
+
+    pa_log_info("Call ended after %u ms: DL %u frames, %u bad, %u silent, %u dropped, depth p50 %u ms p99 %u ms; "
+                "UL %u frames, %u failed; %u modem resets",
+                r->duration_ms, r->dl_frames, r->dl_bad_frames, r->dl_silent_frames, r->dl_drops,
+                r->dl_depth_p50_ms, r->dl_depth_p99_ms, r->ul_frames, r->ul_failures, r->modem_resets);
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
+                      CMTSPEECH_MAINLOOP_HANDLER_CALL_REPORT, r, 0, NULL, pa_xfree);
+}
+
+/* Sink IO-thread */
+void cmtspeech_call_report_dl_depth(struct userdata *u, size_t bytes) {
+    size_t frames;
+
+    pa_assert(u);
+
+    frames = PA_MIN(bytes / u->dl_frame_size, (size_t) CMTSPEECH_CALL_DEPTH_BUCKETS - 1);
+    pa_atomic_inc(&u->call_metrics.dl_depth[frames]);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_call_report_h
+#define cmtspeech_call_report_h
+
+#include "module-meego-cmtspeech.h"
+
+/* Summary of one call, sent as a DBus signal when the call ends */
+struct cmtspeech_call_report {
+    uint32_t duration_ms;
+    bool emergency;
+    uint32_t dl_frames;                 /* received from modem */
+    uint32_t dl_bad_frames;             /* flagged bad by modem, concealed by sink */
+    uint32_t dl_silent_frames;          /* underruns filled with silence */
+    uint32_t dl_drops;                  /* frames dropped by the DL buffer cap */
+    uint32_t dl_queue_overflows;
+    uint32_t dl_depth_p50_ms;           /* DL buffer depth at pop */
+    uint32_t dl_depth_p99_ms;
+    uint32_t ul_frames;
+    uint32_t ul_failures;
+    uint32_t modem_resets;
+};
+
+void cmtspeech_call_report_begin(struct userdata *u, pa_usec_t now);
+void cmtspeech_call_report_end(struct userdata *u, pa_usec_t now);
+
+void cmtspeech_call_report_dl_depth(struct userdata *u, size_t bytes);
+
+#endif /* cmtspeech_call_report_h */
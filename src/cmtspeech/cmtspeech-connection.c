@@ -24,12 +24,27 @@
 #include <meego/module-voice-api.h>
 #include "cmtspeech-mainloop-handler.h"
 #include "cmtspeech-sink-input.h"
+#include "cmtspeech-source-output.h"
+#include "cmtspeech-ul-drift.h"
+#include "cmtspeech-wakeup-stats.h"
+#include "cmtspeech-sched.h"
+#include "cmtspeech-dl-queue.h"
+#include "cmtspeech-flight-recorder.h"
+#include "cmtspeech-stats.h"
+#include "cmtspeech-call-report.h"
+#include "cmtspeech-trace.h"
+#include "cmtspeech-timers.h"
+#include "cmtspeech-watchdog.h"
+#include "cmtspeech-dl-phase.h"
+#include "cmtspeech-drift.h"
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <poll.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
 
 #include <cmtspeech.h>
 
@@ -42,13 +57,25 @@ enum cmt_speech_thread_state {
     CMT_QUIT
 };
 
-/* This should be only used for memblock free cb - cmtspeech_free_cb - below
-   and it is initialized in cmtspeech_connection_init(). */
+/* Only one module instance may drive libcmtspeechdata. Initialized in
+   cmtspeech_connection_init(), memblock free cb checks it to know if the
+   connection is still there. */
 static struct userdata *userdata = NULL;
 
 static uint ul_frame_count = 0;
 
 #define CMTSPEECH_CLEANUP_TIMER_TIMEOUT ((pa_usec_t)(5 * PA_USEC_PER_SEC))
+#define CMTSPEECH_RECONNECT_TIMEOUT     ((pa_usec_t)(60 * PA_USEC_PER_SEC))
+#define CMTSPEECH_STATS_FLUSH_INTERVAL  ((pa_usec_t)(60 * PA_USEC_PER_SEC))
+#define CMTSPEECH_DRIFT_POST_STEP       (CMTSPEECH_DRIFT_Q)     /* 1 ppm */
+
+/* Ties a libcmtspeechdata owned DL buffer to the memblock wrapping it, so
+   the buffer can be released directly when the memblock is freed. */
+typedef struct cmtspeech_dl_wrapper {
+    struct userdata *u;
+    cmtspeech_buffer_t *buf;
+    int generation;
+} cmtspeech_dl_wrapper;
 
 enum cmtspeech_cleanup_state_name {
     CMTSPEECH_CLEANUP_TIMER_INACTIVE = 0,
@@ -58,6 +85,9 @@ enum cmtspeech_cleanup_state_name {
 
 enum {
     CMTSPEECH_HANDLER_CLOSE_CONNECTION,
+    CMTSPEECH_HANDLER_CALL_CONNECT,
+    CMTSPEECH_HANDLER_SERVER_STATUS,
+    CMTSPEECH_HANDLER_CALL_STATUS,
 };
 
 typedef struct cmtspeech_handler {
@@ -76,6 +106,9 @@ static void cmtspeech_handler_free(pa_object *o) {
 }
 
 static void close_cmtspeech_on_error(struct userdata *u);
+static void handle_call_connect(struct userdata *u, bool dl);
+static void handle_server_status(struct userdata *u, bool active);
+static void handle_call_status(struct userdata *u, bool active);
 
 static int cmtspeech_handler_process_msg(pa_msgobject *o, int code, void *ud, int64_t offset, pa_memchunk *chunk) {
     cmtspeech_handler *h = CMTSPEECH_HANDLER(o);
@@ -87,7 +120,19 @@ static int cmtspeech_handler_process_msg(pa_msgobject *o, int code, void *ud, in
     switch (code) {
         case CMTSPEECH_HANDLER_CLOSE_CONNECTION:
             pa_log_debug("CMTSPEECH_HANDLER_CLOSE_CONNECTION");
-            close_cmtspeech_on_error(u);
+            /* Posted for the instance open at the time, it may be
+             * closed already */
+            if (u->cmt_connection.cmtspeech && offset == pa_atomic_load(&u->cmt_connection.generation))
+                close_cmtspeech_on_error(u);
+            return 0;
+        case CMTSPEECH_HANDLER_CALL_CONNECT:
+            handle_call_connect(u, offset != 0);
+            return 0;
+        case CMTSPEECH_HANDLER_SERVER_STATUS:
+            handle_server_status(u, offset != 0);
+            return 0;
+        case CMTSPEECH_HANDLER_CALL_STATUS:
+            handle_call_status(u, offset != 0);
             return 0;
         default:
             pa_log_error("Unknown message code %d", code);
@@ -111,9 +156,11 @@ static pa_msgobject *cmtspeech_handler_new(struct userdata *u) {
 
 /* This is usually called from sink IO-thread */
 static void cmtspeech_free_cb(void *p) {
-    cmtspeech_t *cmtspeech;
+    cmtspeech_dl_wrapper *w = p;
+    struct cmtspeech_connection *c;
+    int ret;
 
-    if (!p)
+    if (!w)
         return;
 
     if (!userdata) {
@@ -121,22 +168,55 @@ static void cmtspeech_free_cb(void *p) {
         return;
     }
 
-    pa_mutex_lock(userdata->cmt_connection.cmtspeech_mutex);
-    cmtspeech = userdata->cmt_connection.cmtspeech;
-    if (!cmtspeech) {
-        pa_log_error("cmtspeech not open, cmtspeech buffer %p was not freed!", p);
-    } else {
-        int ret;
-        cmtspeech_buffer_t *buf = cmtspeech_dl_buffer_find_with_data(cmtspeech, (uint8_t*)p);
-        if (buf != NULL) {
-            if ((ret = cmtspeech_dl_buffer_release(cmtspeech, buf))) {
-                pa_log_error("cmtspeech_dl_buffer_release(%p) failed return value %d.", (void *)buf, ret);
-            }
-        } else {
-            pa_log_error("cmtspeech_dl_buffer_find_with_data() returned NULL, releasing buffer failed.");
-        }
+    c = &w->u->cmt_connection;
+
+    pa_mutex_lock(c->cmtspeech_mutex);
+    if (!c->cmtspeech)
+        pa_log_error("cmtspeech not open, cmtspeech buffer %p was not freed!", (void *) w->buf);
+    else if (w->generation != pa_atomic_load(&c->generation))
+        pa_log_error("cmtspeech buffer %p belongs to a closed instance, not freed!", (void *) w->buf);
+    else if ((ret = cmtspeech_dl_buffer_release(c->cmtspeech, w->buf)))
+        pa_log_error("cmtspeech_dl_buffer_release(%p) failed return value %d.", (void *) w->buf, ret);
+    pa_mutex_unlock(c->cmtspeech_mutex);
+
+    w->buf = NULL;
+    if (pa_flist_push(c->dl_wrapper_flist, w) < 0)
+        pa_log_error("Failed to return DL memblock wrapper %p to pool", (void *) w);
+}
+
+/* Called from sink IO-thread. Copies the frame out of the modem buffer
+ * and releases the buffer right away. */
+int cmtspeech_buffer_copy_to_memchunk(struct userdata *u, cmtspeech_buffer_t *buf, pa_memchunk *chunk) {
+    struct cmtspeech_connection *c;
+    void *d;
+    int ret;
+
+    pa_assert_fp(u);
+    pa_assert_fp(chunk);
+    pa_assert_fp(buf);
+
+    c = &u->cmt_connection;
+
+    if (!buf->data) {
+        pa_log_warn("No data in cmtspeech_buffer");
+        if (cmtspeech_dl_buffer_release(c->cmtspeech, buf))
+            pa_log_warn("cmtspeech_dl_buffer_release() failed");
+        return -1;
     }
-    pa_mutex_unlock(userdata->cmt_connection.cmtspeech_mutex);
+
+    chunk->length = buf->count - CMTSPEECH_DATA_HEADER_LEN;
+    chunk->memblock = pa_memblock_new(u->core->mempool, chunk->length);
+    chunk->index = 0;
+    d = pa_memblock_acquire(chunk->memblock);
+    memcpy(d, buf->data + CMTSPEECH_DATA_HEADER_LEN, chunk->length);
+    pa_memblock_release(chunk->memblock);
+
+    pa_mutex_lock(c->cmtspeech_mutex);
+    if ((ret = cmtspeech_dl_buffer_release(c->cmtspeech, buf)))
+        pa_log_error("cmtspeech_dl_buffer_release(%p) failed return value %d.", (void *)buf, ret);
+    pa_mutex_unlock(c->cmtspeech_mutex);
+
+    return 0;
 }
 
 /* Called from sink IO-thread */
@@ -144,46 +224,91 @@ static void cmtspeech_free_cb(void *p) {
  * memblocks, then just free the cmtframes here after coping them to regular
  * pa_memblocks. The performance penalty should not be too severe. */
 int cmtspeech_buffer_to_memchunk(struct userdata *u, cmtspeech_buffer_t *buf, pa_memchunk *chunk) {
+    struct cmtspeech_connection *c;
+    cmtspeech_dl_wrapper *w;
+
     pa_assert_fp(u);
     pa_assert_fp(chunk);
     pa_assert_fp(buf);
 
+    c = &u->cmt_connection;
+
     if (!buf->data) {
         pa_log_warn("No data in cmtspeech_buffer");
-        if (cmtspeech_dl_buffer_release(u->cmt_connection.cmtspeech, buf))
+        if (cmtspeech_dl_buffer_release(c->cmtspeech, buf))
             pa_log_warn("cmtspeech_dl_buffer_release() failed");
         return -1;
     }
 
-    chunk->memblock = pa_memblock_new_user(u->core->mempool, buf->data, (size_t) buf->size, cmtspeech_free_cb, buf->data, true);
-    chunk->index = CMTSPEECH_DATA_HEADER_LEN;
     chunk->length = buf->count - CMTSPEECH_DATA_HEADER_LEN;
 
+    if (PA_UNLIKELY(!(w = pa_flist_pop(c->dl_wrapper_flist)))) {
+        /* Wrapper pool exhausted, copy the frame and release the buffer now */
+        c->dl_wrapper_copies++;
+        if (c->dl_wrapper_copies < 10 || c->dl_wrapper_copies % 100 == 0)
+            pa_log_warn("DL memblock wrapper pool empty, copying frame (%u copies)", c->dl_wrapper_copies);
+        cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_DL_WRAPPER_COPIES);
+        return cmtspeech_buffer_copy_to_memchunk(u, buf, chunk);
+    }
+
+    w->buf = buf;
+    w->generation = pa_atomic_load(&c->generation);
+
+    chunk->memblock = pa_memblock_new_user(u->core->mempool, buf->data, (size_t) buf->size, cmtspeech_free_cb, w, true);
+    chunk->index = CMTSPEECH_DATA_HEADER_LEN;
+
     return 0;
 }
 
 /* cmtspeech thread */
 static inline
 int push_cmtspeech_buffer_to_dl_queue(struct userdata *u, cmtspeech_dl_buf_t *buf) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+    cmtspeech_dl_buf_t *dropped;
+    int ret;
+
     pa_assert_fp(u);
     pa_assert_fp(buf);
 
-    if (pa_asyncq_push(u->cmt_connection.dl_frame_queue, (void *)buf, false)) {
-        int ret;
-        struct cmtspeech_connection *c = &u->cmt_connection;
+    if (cmtspeech_dl_queue_push(c->dl_frame_queue, (void *)buf, (void **)&dropped)) {
+        /* Queue full and the policy is to keep the old frames */
+        dropped = buf;
+        buf = NULL;
+    }
 
-        pa_log_error("Failed to push dl frame to asyncq");
+    if (dropped) {
+        unsigned overflows = cmtspeech_dl_queue_overflows(c->dl_frame_queue);
+
+        if (overflows < 10 || overflows % 100 == 0)
+            pa_log_warn("DL queue full, dropped %s frame (%u overflows)", buf ? "oldest" : "newest", overflows);
+        cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_DL_QUEUE_OVERFLOWS);
+        pa_atomic_inc(&u->call_metrics.dl_queue_overflows);
+        cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_DL_OVERFLOW,
+                                      cmtspeech_dl_queue_length(c->dl_frame_queue), 0, overflows);
+        cmtspeech_flight_recorder_request_dump(u, CMTSPEECH_FR_DUMP_OVERFLOW);
         pa_mutex_lock(c->cmtspeech_mutex);
-        if ((ret = cmtspeech_dl_buffer_release(u->cmt_connection.cmtspeech, buf)))
-            pa_log_error("cmtspeech_dl_buffer_release(%p) failed return value %d.", (void *)buf, ret);
+        if ((ret = cmtspeech_dl_buffer_release(c->cmtspeech, dropped)))
+            pa_log_error("cmtspeech_dl_buffer_release(%p) failed return value %d.", (void *)dropped, ret);
         pa_mutex_unlock(c->cmtspeech_mutex);
-        return -1;
     }
 
-    ONDEBUG_TOKENS(fprintf(stderr, "D"));
+    CMTSPEECH_TRACE3(dl_queue_push, c->wakeup_time, cmtspeech_dl_queue_length(c->dl_frame_queue), dropped ? 1 : 0);
+
+    if (!buf)
+        return -1;
+
+    /* The sink played silence ahead, have it rewind and take this frame */
+    if (pa_atomic_cmpxchg(&c->dl_rewrite, 1, 0) &&
+        u->sink_input && PA_SINK_INPUT_IS_LINKED(u->sink_input->state) &&
+        u->sink_input->sink && u->sink_input->sink->asyncmsgq)
+        pa_asyncmsgq_post(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input),
+                          PA_SINK_INPUT_MESSAGE_REWRITE_DL, NULL, 0, NULL, NULL);
+
     return 0;
 }
 
+static void post_uplink_deadline(struct userdata *u, int64_t usec);
+
 /* cmtspeech thread */
 static void update_uplink_frame_timing(struct userdata *u, cmtspeech_event_t *cmtevent) {
     int deadline_us;
@@ -195,25 +320,77 @@ static void update_uplink_frame_timing(struct userdata *u, cmtspeech_event_t *cm
                  (int)cmtevent->msg.timing_config_ntf.tstamp.tv_sec,
                  cmtevent->msg.timing_config_ntf.tstamp.tv_nsec);
 
-    deadline_us = (cmtevent->msg.timing_config_ntf.msec % 20) * 1000 + cmtevent->msg.timing_config_ntf.usec;
+    deadline_us = (int) (((pa_usec_t) cmtevent->msg.timing_config_ntf.msec * 1000 +
+                          cmtevent->msg.timing_config_ntf.usec) % u->frame_usec);
 
     usec = ((int64_t) cmtevent->msg.timing_config_ntf.tstamp.tv_sec * 1000000) +
         (cmtevent->msg.timing_config_ntf.tstamp.tv_nsec/1000) + deadline_us;
 
     pa_log_debug("deadline at %" PRIi64 " (%d usec from msg receival)", usec, deadline_us);
 
-    if (u->source && PA_SOURCE_IS_LINKED(u->source->state))
+    u->cmt_connection.ul_deadline = usec;
+    cmtspeech_drift_timing(&u->cmt_connection.drift, (pa_usec_t) usec, u->frame_usec);
+    post_uplink_deadline(u, usec);
+}
+
+/* cmtspeech thread */
+static void post_uplink_deadline(struct userdata *u, int64_t usec) {
+    if (u->source && PA_SOURCE_IS_LINKED(u->source->state)) {
         pa_asyncmsgq_post(u->source->asyncmsgq, PA_MSGOBJECT(u->source),
                           VOICE_SOURCE_SET_UL_DEADLINE, NULL, usec, NULL, NULL);
-    else
+        if (u->source_output)
+            pa_asyncmsgq_post(u->source->asyncmsgq, PA_MSGOBJECT(u->source_output),
+                              PA_SOURCE_OUTPUT_MESSAGE_UL_DEADLINE, NULL, usec, NULL, NULL);
+    } else
         pa_log_error("No destination where to send timing info");
 }
 
+/* Has the main thread set the drift estimate on the streams when it
+ * first becomes known and then whenever it moves by a ppm.
+ * cmtspeech thread */
+static void post_drift(struct userdata *u) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+    int ppm;
+
+    if (pa_atomic_load(&c->drift.err) == INT_MAX)
+        return;
+
+    ppm = pa_atomic_load(&c->drift.ppm);
+    if (c->drift_posted != INT_MAX && abs(ppm - c->drift_posted) < CMTSPEECH_DRIFT_POST_STEP)
+        return;
+
+    c->drift_posted = ppm;
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
+                      CMTSPEECH_MAINLOOP_HANDLER_DRIFT, NULL, 0, NULL, NULL);
+}
+
+/* cmtspeech thread. The sink and source IO threads only consume DL
+ * and UL while these are set, see fast_cork. */
+static void set_dl_active(struct userdata *u, bool active) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    if (active)
+        pa_atomic_store(&c->dl_start_time, (int) (uint32_t) pa_rtclock_now());
+    pa_atomic_store(&c->dl_active, active);
+}
+
+/* cmtspeech thread */
+static void set_ul_active(struct userdata *u, bool active) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    if (active)
+        pa_atomic_store(&c->ul_start_time, (int) (uint32_t) pa_rtclock_now());
+    pa_atomic_store(&c->ul_active, active);
+}
+
 static void reset_call_stream_states(struct userdata *u) {
     struct cmtspeech_connection *c = &u->cmt_connection;
 
     pa_assert(u);
 
+    set_dl_active(u, false);
+    set_ul_active(u, false);
+
     if (c->streams_created) {
         pa_log_warn("DL/UL streams existed at reset, closing");
         pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
@@ -242,9 +419,6 @@ static int mainloop_cmtspeech(struct userdata *u) {
     if (!c->cmt_poll_item)
         return 0;
 
-    if (pa_atomic_load(&u->cmtspeech_server_status))
-        pa_rtpoll_set_timer_absolute(c->rtpoll, pa_rtclock_now() + CMTSPEECH_CLEANUP_TIMER_TIMEOUT);
-
     pollfd = pa_rtpoll_item_get_pollfd(c->cmt_poll_item, NULL);
     if (pollfd->revents & POLLIN) {
         cmtspeech_t *cmtspeech;
@@ -276,12 +450,25 @@ static int mainloop_cmtspeech(struct userdata *u) {
                 pa_log_debug("read cmtspeech event: state %d -> %d (type %d, ret %d).",
                              cmtevent.prev_state, cmtevent.state, cmtevent.msg_type, i);
 
+                if (i == 0) {
+                    CMTSPEECH_TRACE4(state, c->wakeup_time, cmtevent.prev_state, cmtevent.state, cmtevent.msg_type);
+                    cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_STATE,
+                                                  cmtspeech_dl_queue_length(c->dl_frame_queue), 0,
+                                                  ((uint32_t) cmtevent.msg_type & 0xffff) << 16 |
+                                                  ((uint32_t) cmtevent.prev_state & 0xff) << 8 |
+                                                  ((uint32_t) cmtevent.state & 0xff));
+                }
+
                 if (i != 0) {
                     pa_log_error("ERROR: unable to read event.");
 
                 } else if (cmtevent.prev_state == CMTSPEECH_STATE_DISCONNECTED &&
                            cmtevent.state == CMTSPEECH_STATE_CONNECTED) {
                     pa_log_debug("call starting.");
+                    cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_CALLS);
+                    cmtspeech_call_report_begin(u, c->wakeup_time);
+                    cmtspeech_drift_reset(&c->drift);
+                    c->drift_posted = INT_MAX;
                     reset_call_stream_states(u);
 
                     pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
@@ -298,7 +485,17 @@ static int mainloop_cmtspeech(struct userdata *u) {
 
                      /* Ul is turned on when timing information is received */
 
+                    cmtspeech_wakeup_stats_reset(&c->wakeup_stats);
+                    cmtspeech_timer_set(&c->timers, CMTSPEECH_TIMER_STATS_FLUSH,
+                                        pa_rtclock_now() + CMTSPEECH_STATS_FLUSH_INTERVAL);
+                    if (c->watchdog.timeout) {
+                        cmtspeech_watchdog_start(&c->watchdog, c->wakeup_time);
+                        cmtspeech_timer_set(&c->timers, CMTSPEECH_TIMER_WATCHDOG,
+                                            c->wakeup_time + c->watchdog.timeout);
+                    }
+
                     pa_log_debug("enabling DL");
+                    set_dl_active(u, true);
                     pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
                                       CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_CONNECT, NULL, 0, NULL, NULL);
                     c->playback_running = true;
@@ -318,6 +515,7 @@ static int mainloop_cmtspeech(struct userdata *u) {
                            cmtevent.state == CMTSPEECH_STATE_ACTIVE_DLUL) {
                     pa_log_debug("enabling UL");
 
+                    set_ul_active(u, true);
                     pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
                                     CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_CONNECT, NULL, 0, NULL, NULL);
                     c->record_running = true;
@@ -332,6 +530,15 @@ static int mainloop_cmtspeech(struct userdata *u) {
                            cmtevent.state == CMTSPEECH_STATE_CONNECTED) {
                     pa_log_notice("speech stop: stream=%u",
                                   cmtevent.msg.speech_config_req.speech_data_stream);
+                    cmtspeech_timer_clear(&c->timers, CMTSPEECH_TIMER_STATS_FLUSH);
+                    cmtspeech_timer_clear(&c->timers, CMTSPEECH_TIMER_WATCHDOG);
+                    cmtspeech_watchdog_stop(&c->watchdog);
+                    cmtspeech_wakeup_stats_log(&c->wakeup_stats);
+                    cmtspeech_drift_log(&c->drift);
+                    pa_log_info("DL queue overflows so far: %u",
+                                cmtspeech_dl_queue_overflows(c->dl_frame_queue));
+                    set_dl_active(u, false);
+                    set_ul_active(u, false);
                     pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
                                       CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_DISCONNECT, NULL, 0, NULL, NULL);
                     c->playback_running = false;
@@ -343,6 +550,7 @@ static int mainloop_cmtspeech(struct userdata *u) {
                 } else if (cmtevent.prev_state == CMTSPEECH_STATE_CONNECTED &&
                          cmtevent.state == CMTSPEECH_STATE_DISCONNECTED) {
                     pa_log_debug("call terminated.");
+                    cmtspeech_call_report_end(u, c->wakeup_time);
                     pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
                                       CMTSPEECH_MAINLOOP_HANDLER_DELETE_STREAMS, NULL, 0, NULL, NULL);
                     c->streams_created = false;
@@ -350,6 +558,11 @@ static int mainloop_cmtspeech(struct userdata *u) {
 
                 } else if (cmtevent.msg_type == CMTSPEECH_EVENT_RESET) {
                     pa_log_warn("modem reset detected");
+                    cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_MODEM_RESETS);
+                    pa_atomic_inc(&u->call_metrics.modem_resets);
+                    cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_MODEM_RESET,
+                                                  cmtspeech_dl_queue_length(c->dl_frame_queue), 0, 0);
+                    cmtspeech_flight_recorder_request_dump(u, CMTSPEECH_FR_DUMP_MODEM_RESET);
                     close_cmtspeech_on_error(u);
                     /* cmtspeech handle now null so return immediately */
                     return retsockets;
@@ -372,6 +585,14 @@ static int mainloop_cmtspeech(struct userdata *u) {
                 if (counter < 10)
                     pa_log_debug("SSI: DL frame available, read %d bytes.", i);
 
+                if (c->playback_running) {
+                    cmtspeech_wakeup_stats_dl_event(&c->wakeup_stats, c->wakeup_time);
+                    cmtspeech_watchdog_dl_frame(&c->watchdog, c->wakeup_time);
+                    cmtspeech_dl_phase_arrival(u, c->wakeup_time);
+                    cmtspeech_drift_dl_frame(&c->drift, c->wakeup_time, u->frame_usec);
+                    post_drift(u);
+                }
+
                 /* locking note: another hot path lock */
                 pa_mutex_lock(c->cmtspeech_mutex);
                 cmtspeech_active = cmtspeech_is_active(c->cmtspeech);
@@ -381,6 +602,13 @@ static int mainloop_cmtspeech(struct userdata *u) {
                 if (i < 0) {
                     pa_log_error("Invalid DL frame received, cmtspeech_dl_buffer_acquire returned %d", i);
                 } else {
+                    cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_DL_FRAMES);
+                    pa_atomic_inc(&u->call_metrics.dl_frames);
+                    CMTSPEECH_TRACE4(dl_acquire, c->wakeup_time, cmtspeech_dl_queue_length(c->dl_frame_queue),
+                                     buf->count, buf->spc_flags);
+                    cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_DL_ACQUIRE,
+                                                  cmtspeech_dl_queue_length(c->dl_frame_queue), 0,
+                                                  (uint32_t) buf->count);
                     if (counter < 10 )
                         pa_log_debug("DL (audio len %d) frame's first bytes %02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x",
                                      buf->count - CMTSPEECH_DATA_HEADER_LEN,
@@ -400,42 +628,170 @@ static int mainloop_cmtspeech(struct userdata *u) {
                 }
             }
         }
-    } else {
-        /* pollfd timer expired and no events. */
-        if (pa_atomic_cmpxchg(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_ACTIVE, CMTSPEECH_CLEANUP_IN_PROGRESS)) {
-            pa_mutex_lock(c->cmtspeech_mutex);
-            if (!pa_atomic_load(&u->cmtspeech_server_status) && c->cmtspeech) {
-                if (u->server_inactive_timeout <= pa_rtclock_now()) {
-                    pa_log_debug("cmtspeech cleanup timer checking server status.");
-                    if (cmtspeech_is_active(c->cmtspeech)) {
-                        pa_log_debug("cmtspeech still active, forcing cleanup");
-                        pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
-                                          CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_DISCONNECT, NULL, 0, NULL, NULL);
-                        pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
-                                          CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_DISCONNECT, NULL, 0, NULL, NULL);
-                        cmtspeech_state_change_error(c->cmtspeech);
-                    }
-                    pa_rtpoll_set_timer_disabled(c->rtpoll);
-                    pa_atomic_store(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_INACTIVE);
-                    pa_log_debug("cmtspeech cleanup timer inactive in cmtspeech mainloop.");
-                } else {
-                    pa_rtpoll_set_timer_relative(c->rtpoll, CMTSPEECH_CLEANUP_TIMER_TIMEOUT);
-                    pa_atomic_store(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_ACTIVE);
-                    pa_log_debug("cmtspeech cleanup timer timeout updated in cmtspeech mainloop.");
-                }
-            } else {
-                pa_rtpoll_set_timer_disabled(c->rtpoll);
-                pa_atomic_store(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_INACTIVE);
-                pa_log_debug("cmtspeech cleanup timer inactive in cmtspeech mainloop (call active or cmtspeech closed).");
+    }
+
+    return retsockets;
+}
+
+/* cmtspeech thread */
+static void update_cleanup_timer(struct userdata *u) {
+    struct cmtspeech_timers *t = &u->cmt_connection.timers;
+
+    if (pa_atomic_load(&u->cmtspeech_cleanup_state) != CMTSPEECH_CLEANUP_TIMER_ACTIVE) {
+        cmtspeech_timer_clear(t, CMTSPEECH_TIMER_CLEANUP);
+        return;
+    }
+
+    if (!cmtspeech_timer_armed(t, CMTSPEECH_TIMER_CLEANUP))
+        cmtspeech_timer_set(t, CMTSPEECH_TIMER_CLEANUP, pa_rtclock_now() + CMTSPEECH_CLEANUP_TIMER_TIMEOUT);
+}
+
+/* cmtspeech thread */
+static void cleanup_timer_expired(struct userdata *u) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    if (!pa_atomic_cmpxchg(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_ACTIVE, CMTSPEECH_CLEANUP_IN_PROGRESS))
+        return;
+
+    pa_mutex_lock(c->cmtspeech_mutex);
+    if (!pa_atomic_load(&u->cmtspeech_server_status) && c->cmtspeech) {
+        if (u->server_inactive_timeout <= pa_rtclock_now()) {
+            pa_log_debug("cmtspeech cleanup timer checking server status.");
+            if (cmtspeech_is_active(c->cmtspeech)) {
+                pa_log_debug("cmtspeech still active, forcing cleanup");
+                set_dl_active(u, false);
+                set_ul_active(u, false);
+                pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
+                                  CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_DISCONNECT, NULL, 0, NULL, NULL);
+                pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
+                                  CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_DISCONNECT, NULL, 0, NULL, NULL);
+                cmtspeech_state_change_error(c->cmtspeech);
             }
-            pa_mutex_unlock(c->cmtspeech_mutex);
-        } else if (!pa_atomic_load(&u->cmtspeech_server_status) && c->cmtspeech == NULL) {
-            pa_log_debug("cmtspeech cleanup timer inactive in cmtspeech mainloop (2).");
-            pa_rtpoll_set_timer_disabled(c->rtpoll);
+            pa_atomic_store(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_INACTIVE);
+            pa_log_debug("cmtspeech cleanup timer inactive in cmtspeech mainloop.");
+        } else {
+            cmtspeech_timer_set(&c->timers, CMTSPEECH_TIMER_CLEANUP, u->server_inactive_timeout);
+            pa_atomic_store(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_ACTIVE);
+            pa_log_debug("cmtspeech cleanup timer timeout updated in cmtspeech mainloop.");
         }
+    } else {
+        pa_atomic_store(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_INACTIVE);
+        pa_log_debug("cmtspeech cleanup timer inactive in cmtspeech mainloop (call active or cmtspeech closed).");
     }
+    pa_mutex_unlock(c->cmtspeech_mutex);
+}
 
-    return retsockets;
+/* cmtspeech thread */
+static void handle_call_connect(struct userdata *u, bool dl) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    if (!c->cmtspeech)
+        return;
+
+    /* locking note: very rarely taken code path */
+    pa_mutex_lock(c->cmtspeech_mutex);
+    cmtspeech_state_change_call_connect(c->cmtspeech, dl);
+    pa_mutex_unlock(c->cmtspeech_mutex);
+}
+
+/* cmtspeech thread */
+static void handle_server_status(struct userdata *u, bool active) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    if (!c->cmtspeech)
+        return;
+
+    /* locking note: very rarely taken code path */
+    pa_mutex_lock(c->cmtspeech_mutex);
+    cmtspeech_state_change_call_status(c->cmtspeech, active);
+    pa_mutex_unlock(c->cmtspeech_mutex);
+
+    if (active) {
+        /* Call in progress, pause cleanup timer. */
+        pa_atomic_store(&u->cmtspeech_server_status, 1);
+        if (pa_atomic_cmpxchg(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_ACTIVE,
+                                                           CMTSPEECH_CLEANUP_TIMER_INACTIVE))
+            pa_log_warn("cmtspeech cleanup timer changed to inactive.");
+    } else {
+        /* Call ended, set cleanup timer timeout. */
+        u->server_inactive_timeout = pa_rtclock_now() + CMTSPEECH_CLEANUP_TIMER_TIMEOUT;
+        if (pa_atomic_cmpxchg(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_INACTIVE,
+                                                           CMTSPEECH_CLEANUP_TIMER_ACTIVE))
+            pa_log_debug("cmtspeech cleanup timer timeout set.");
+        else
+            pa_log_debug("cmtspeech cleanup timer is already active or cleanup in progress.");
+        pa_atomic_store(&u->cmtspeech_server_status, 0);
+    }
+
+    update_cleanup_timer(u);
+}
+
+/* cmtspeech thread */
+static void handle_call_status(struct userdata *u, bool active) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    if (!c->cmtspeech)
+        return;
+
+    /* locking note: very rarely taken code path */
+    pa_mutex_lock(c->cmtspeech_mutex);
+    cmtspeech_state_change_call_status(c->cmtspeech, active);
+    pa_mutex_unlock(c->cmtspeech_mutex);
+}
+
+/* cmtspeech thread */
+static void stats_flush_timer_expired(struct userdata *u) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    if (!c->playback_running)
+        return;
+
+    cmtspeech_wakeup_stats_log(&c->wakeup_stats);
+    cmtspeech_drift_log(&c->drift);
+    pa_log_info("DL queue overflows so far: %u", cmtspeech_dl_queue_overflows(c->dl_frame_queue));
+
+    cmtspeech_timer_set(&c->timers, CMTSPEECH_TIMER_STATS_FLUSH, c->wakeup_time + CMTSPEECH_STATS_FLUSH_INTERVAL);
+}
+
+/* cmtspeech thread */
+static void flush_dl(struct userdata *u) {
+    if (u->sink_input && PA_SINK_INPUT_IS_LINKED(u->sink_input->state) &&
+        u->sink_input->sink && u->sink_input->sink->asyncmsgq)
+        pa_asyncmsgq_post(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input),
+                          PA_SINK_INPUT_MESSAGE_FLUSH_DL, NULL, 0, NULL, NULL);
+}
+
+/* cmtspeech thread */
+static void watchdog_timer_expired(struct userdata *u) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+    pa_usec_t next;
+
+    if (!c->playback_running || !c->watchdog.timeout)
+        return;
+
+    switch (cmtspeech_watchdog_check(&c->watchdog, c->wakeup_time, (unsigned) pa_atomic_load(&c->ul_frames_sent),
+                                     c->record_running, &next)) {
+        case CMTSPEECH_WATCHDOG_NONE:
+            break;
+        case CMTSPEECH_WATCHDOG_FLUSH_DL:
+            pa_log_warn("Watchdog: flushing DL");
+            flush_dl(u);
+            break;
+        case CMTSPEECH_WATCHDOG_RESYNC:
+            pa_log_warn("Watchdog: re-syncing DL and UL");
+            flush_dl(u);
+            c->first_dl_frame_received = false;
+            cmtspeech_wakeup_stats_resync(&c->wakeup_stats);
+            if (c->record_running && c->ul_deadline)
+                post_uplink_deadline(u, c->ul_deadline);
+            break;
+        case CMTSPEECH_WATCHDOG_REOPEN:
+            pa_log_error("Watchdog: stall not recovered, reopening the modem instance");
+            close_cmtspeech_on_error(u);
+            return;
+    }
+
+    cmtspeech_timer_set(&c->timers, CMTSPEECH_TIMER_WATCHDOG, next);
 }
 
 /* cmtspeech thread */
@@ -512,6 +868,10 @@ static void close_cmtspeech_on_error(struct userdata *u)
 
     pa_log_debug("closing the modem instance");
 
+    /* A lost modem instance ends the call */
+    if (pa_atomic_load(&c->thread_state) != CMT_ASK_QUIT)
+        cmtspeech_call_report_end(u, pa_rtclock_now());
+
     reset_call_stream_states(u);
 
     if (u->sink_input && PA_SINK_INPUT_IS_LINKED(u->sink_input->state) &&
@@ -521,7 +881,7 @@ static void close_cmtspeech_on_error(struct userdata *u)
     } else {
         cmtspeech_buffer_t *buf;
         pa_log_debug("DL stream not connected. Flushing the queue locally");
-        while((buf = pa_asyncq_pop(c->dl_frame_queue, 0))) {
+        while((buf = cmtspeech_dl_queue_pop(c->dl_frame_queue))) {
             if (cmtspeech_dl_buffer_release(c->cmtspeech, buf)) {
                 pa_log_error("Freeing cmtspeech buffer failed!");
             }
@@ -534,6 +894,7 @@ static void close_cmtspeech_on_error(struct userdata *u)
     if (cmtspeech_close(c->cmtspeech))
         pa_log_error("cmtspeech_close() failed");
     c->cmtspeech = NULL;
+    pa_atomic_inc(&c->generation);
     pa_mutex_unlock(c->cmtspeech_mutex);
 }
 
@@ -546,8 +907,7 @@ static void thread_func(void *udata) {
 
     pa_log_debug("cmtspeech thread starting up");
 
-    if (u->core->realtime_scheduling)
-        pa_make_realtime(u->core->realtime_priority - 1);
+    cmtspeech_sched_apply(u->sched, u->core);
 
     pa_thread_mq_install(&c->thread_mq);
 
@@ -556,16 +916,27 @@ static void thread_func(void *udata) {
     pa_assert_se(pa_atomic_cmpxchg(&c->thread_state, CMT_STARTING, CMT_RUNNING));
 
     while(1) {
+        unsigned expired;
         int ret;
 
         if (check_cmtspeech_connection(c)) {
-            pa_log("Failed to open the cmtspeech device, waiting 60 seconds before trying again.");
-            pa_rtpoll_set_timer_relative(c->rtpoll, 60 * 1000 * 1000);
-        }
+            if (!cmtspeech_timer_armed(&c->timers, CMTSPEECH_TIMER_RECONNECT)) {
+                pa_log("Failed to open the cmtspeech device, waiting 60 seconds before trying again.");
+                cmtspeech_timer_set(&c->timers, CMTSPEECH_TIMER_RECONNECT,
+                                    pa_rtclock_now() + CMTSPEECH_RECONNECT_TIMEOUT);
+            }
+        } else
+            cmtspeech_timer_clear(&c->timers, CMTSPEECH_TIMER_RECONNECT);
+
+        cmtspeech_stats_publish_connection(u);
 
         pollfd_update(c);
+        cmtspeech_timers_program(&c->timers, c->rtpoll);
 
-        if (0 > (ret = pa_rtpoll_run(c->rtpoll))) {
+        ret = pa_rtpoll_run(c->rtpoll);
+        c->wakeup_time = pa_rtclock_now();
+
+        if (0 > ret) {
             pa_log_error("running rtpoll failed (%d) (fd %d)", ret, cmtspeech_descriptor(c->cmtspeech));
             close_cmtspeech_on_error(u);
         }
@@ -575,6 +946,16 @@ static void thread_func(void *udata) {
             goto finish;
         }
 
+        /* An expired reconnect deadline needs no action, the open is
+         * retried on every round while the device is closed. */
+        expired = cmtspeech_timers_expire(&c->timers, c->rtpoll, c->wakeup_time);
+        if (expired & CMTSPEECH_TIMER_BIT(CMTSPEECH_TIMER_CLEANUP))
+            cleanup_timer_expired(u);
+        if (expired & CMTSPEECH_TIMER_BIT(CMTSPEECH_TIMER_STATS_FLUSH))
+            stats_flush_timer_expired(u);
+        if (expired & CMTSPEECH_TIMER_BIT(CMTSPEECH_TIMER_WATCHDOG))
+            watchdog_timer_expired(u);
+
         /* note: cmtspeech can be closed in DBus thread */
         if (c->cmtspeech == NULL) {
             continue;
@@ -629,6 +1010,7 @@ static void priv_cmtspeech_trace_handler_f(int priority, const char *message, va
 int cmtspeech_connection_init(struct userdata *u)
 {
     struct cmtspeech_connection *c = &u->cmt_connection;
+    unsigned i;
 
     pa_assert(u);
     pa_assert(!userdata); /* To make sure we are the only instance running. */
@@ -642,10 +1024,27 @@ int cmtspeech_connection_init(struct userdata *u)
     c->rtpoll = pa_rtpoll_new();
     c->cmt_poll_item = NULL;
     pa_thread_mq_init(&c->thread_mq, u->core->mainloop, c->rtpoll);
-    c->dl_frame_queue = pa_asyncq_new(4);
+    c->dl_frame_queue = cmtspeech_dl_queue_new(c->dl_queue_depth, c->dl_queue_drop_oldest);
+
+    /* libcmtspeechdata does not tell how many DL buffers it has. The
+     * sink side holds at most the DL frame queue, the frames that fit
+     * in dl_memblockq and one being wrapped. The rewind history holds
+     * copies, not modem buffers. */
+    c->dl_wrapper_count = c->dl_queue_depth +
+        (unsigned) (pa_memblockq_get_maxlength(u->dl_memblockq) / u->dl_frame_size) + 1;
+    c->dl_wrapper_copies = 0;
+    c->dl_wrappers = pa_xnew0(cmtspeech_dl_wrapper, c->dl_wrapper_count);
+    c->dl_wrapper_flist = pa_flist_new(c->dl_wrapper_count);
+    for (i = 0; i < c->dl_wrapper_count; i++) {
+        c->dl_wrappers[i].u = u;
+        pa_assert_se(pa_flist_push(c->dl_wrapper_flist, &c->dl_wrappers[i]) == 0);
+    }
+    pa_atomic_store(&c->generation, 0);
 
     c->cmtspeech = NULL;
-    c->cmtspeech_mutex = pa_mutex_new(false, false);
+    /* Taken on the DL and UL hot paths, priority inheritance keeps a
+     * preempted holder from stalling the realtime threads */
+    c->cmtspeech_mutex = pa_mutex_new(false, true);
 
     cmtspeech_init();
     cmtspeech_trace_toggle(CMTSPEECH_TRACE_ERROR, true);
@@ -725,7 +1124,9 @@ void cmtspeech_connection_unload(struct userdata *u)
     if (c->cmtspeech) {
         pa_log_error("CMT speech connection up when shutting down");
     }
-    pa_asyncq_free(c->dl_frame_queue, NULL);
+    cmtspeech_dl_queue_free(c->dl_frame_queue);
+    pa_flist_free(c->dl_wrapper_flist, NULL);
+    pa_xfree(c->dl_wrappers);
     pa_mutex_free(c->cmtspeech_mutex);
     userdata = NULL;
     pa_log_debug("CMT connection unloaded");
@@ -734,7 +1135,8 @@ void cmtspeech_connection_unload(struct userdata *u)
 /**
  * Sends an UL frame using SSI audio interface 'sal'.
  *
- * Return zero on success, -1 on error.
+ * Return zero on success, -EAGAIN when the modem does not take UL yet
+ * and a negative value on error.
  */
 /* Source IO-thread */
 int cmtspeech_send_ul_frame(struct userdata *u, uint8_t *buf, size_t bytes)
@@ -753,31 +1155,56 @@ int cmtspeech_send_ul_frame(struct userdata *u, uint8_t *buf, size_t bytes)
         return -EIO;
     }
 
-    if (cmtspeech_is_active(c->cmtspeech) == true)
-        res = cmtspeech_ul_buffer_acquire(c->cmtspeech, &salbuf);
+    /* Not an error, UL starts before the modem is active */
+    if (cmtspeech_is_active(c->cmtspeech) != true) {
+        pa_mutex_unlock(c->cmtspeech_mutex);
+        return -EAGAIN;
+    }
+
+    res = cmtspeech_ul_buffer_acquire(c->cmtspeech, &salbuf);
 
     if (res == 0) {
         if (ul_frame_count++ < 10)
             pa_log_debug("Sending ul frame # %d", ul_frame_count);
 
         /* note: 'bytes' must match the fixed size of frames */
-        pa_assert(bytes == (size_t)salbuf->pcount);
-        memcpy(salbuf->payload, buf, bytes);
+        if (bytes != (size_t)salbuf->pcount) {
+            static uint mismatch = 0;
+            if (mismatch++ < 10)
+                pa_log_error("UL frame of %zu bytes does not match modem frame of %d bytes, check frame_usec",
+                             bytes, salbuf->pcount);
+            memset(salbuf->payload, 0, salbuf->pcount);
+            bytes = PA_MIN(bytes, (size_t)salbuf->pcount);
+        }
+        cmtspeech_ul_drift_copy(u, salbuf->payload, buf, bytes);
         res = cmtspeech_ul_buffer_release(c->cmtspeech, salbuf);
+        if (res >= 0) {
+            pa_atomic_inc(&c->ul_frames_sent);
+            cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_UL_FRAMES);
+            pa_atomic_inc(&u->call_metrics.ul_frames);
+        } else {
+            cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_UL_RELEASE_FAILURES);
+            pa_atomic_inc(&u->call_metrics.ul_failures);
+        }
+        cmtspeech_flight_recorder_log(u->flight_recorder, res < 0 ? CMTSPEECH_FR_UL_FAIL : CMTSPEECH_FR_UL_SEND,
+                                      0, 0, res < 0 ? (uint32_t) -res : ul_frame_count);
         if (res < 0) {
           pa_log_error("cmtspeech_ul_buffer_release(%p) failed return value %d.", (void *)salbuf, res);
           if (res == -EIO) {
               /* note: a severe error has occured, close the modem
-               *       instance */
-              pa_mutex_unlock(c->cmtspeech_mutex);
+               *       instance in the cmtspeech thread, which owns the
+               *       call state */
               pa_log_error("A severe error has occured, close the modem instance.");
-              close_cmtspeech_on_error(u);
-              pa_mutex_lock(c->cmtspeech_mutex);
+              pa_asyncmsgq_post(c->thread_mq.inq, c->cmt_handler, CMTSPEECH_HANDLER_CLOSE_CONNECTION,
+                                NULL, pa_atomic_load(&c->generation), NULL, NULL);
           }
         }
-        ONDEBUG_TOKENS(fprintf(stderr, "U"));
+        CMTSPEECH_TRACE4(ul_send, pa_rtclock_now(), res, bytes, ul_frame_count);
     } else {
         static uint count = 0;
+        cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_UL_ACQUIRE_FAILURES);
+        pa_atomic_inc(&u->call_metrics.ul_failures);
+        cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_UL_FAIL, 0, 0, (uint32_t) -res);
         if (count++ < 10)
             pa_log_error("cmtspeech_ul_buffer_acquire failed %d", res);
     }
@@ -787,6 +1214,21 @@ int cmtspeech_send_ul_frame(struct userdata *u, uint8_t *buf, size_t bytes)
     return res;
 }
 
+/* Main thread. libcmtspeechdata state changes are made in the cmtspeech
+ * thread, so the main thread never waits for the hot path lock. */
+static void post_to_cmtspeech_thread(struct userdata *u, int code, bool value) {
+    struct cmtspeech_connection *c = &u->cmt_connection;
+
+    int state = pa_atomic_load(&c->thread_state);
+
+    if (state != CMT_STARTING && state != CMT_RUNNING) {
+        pa_log_debug("cmtspeech thread not running, dropping message %d", code);
+        return;
+    }
+
+    pa_asyncmsgq_post(c->thread_mq.inq, c->cmt_handler, code, NULL, value, NULL, NULL);
+}
+
 /* This is called form pulseaudio main thread. */
 DBusHandlerResult cmtspeech_dbus_filter(DBusConnection *conn, DBusMessage *msg, void *arg)
 {
@@ -816,11 +1258,7 @@ DBusHandlerResult cmtspeech_dbus_filter(DBusConnection *conn, DBusMessage *msg,
             c->call_dl = (dlflag == true ? true : false);
             c->call_emergency = (emergencyflag == true ? true : false);
 
-            /* note: very rarely taken code path */
-            pa_mutex_lock(c->cmtspeech_mutex);
-            if (c->cmtspeech)
-                cmtspeech_state_change_call_connect(c->cmtspeech, dlflag == true);
-            pa_mutex_unlock(c->cmtspeech_mutex);
+            post_to_cmtspeech_thread(u, CMTSPEECH_HANDLER_CALL_CONNECT, dlflag == true);
 
         } else
             pa_log_error("received %s with invalid parameters", CMTSPEECH_DBUS_CSCALL_CONNECT_SIG);
@@ -837,31 +1275,7 @@ DBusHandlerResult cmtspeech_dbus_filter(DBusConnection *conn, DBusMessage *msg,
                 dbus_message_iter_get_basic(&args, &val);
 
                 pa_log_debug("Set ServerStatus to %d.", val == true);
-
-                /* note: very rarely taken code path */
-                pa_mutex_lock(c->cmtspeech_mutex);
-                if (c->cmtspeech) {
-                    cmtspeech_state_change_call_status(c->cmtspeech, val == true);
-                    if (val) {
-                        /* Call in progress, pause cleanup timer. */
-                        pa_atomic_store(&u->cmtspeech_server_status, 1);
-                        if (pa_atomic_cmpxchg(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_ACTIVE,
-                                                                           CMTSPEECH_CLEANUP_TIMER_INACTIVE)) {
-                            pa_log_warn("cmtspeech cleanup timer changed to inactive in DBus thread.");
-                        }
-                    } else {
-                        /* Call ended, set cleanup timer timeout. */
-                        u->server_inactive_timeout = pa_rtclock_now() + CMTSPEECH_CLEANUP_TIMER_TIMEOUT;
-                        if (pa_atomic_cmpxchg(&u->cmtspeech_cleanup_state, CMTSPEECH_CLEANUP_TIMER_INACTIVE,
-                                                                           CMTSPEECH_CLEANUP_TIMER_ACTIVE)) {
-                            pa_log_debug("cmtspeech cleanup timer timeout set in DBus thread.");
-                        } else {
-                            pa_log_debug("cmtspeech cleanup timer is already active or cleanup in progress.");
-                        }
-                        pa_atomic_store(&u->cmtspeech_server_status, 0);
-                    }
-                }
-                pa_mutex_unlock(c->cmtspeech_mutex);
+                post_to_cmtspeech_thread(u, CMTSPEECH_HANDLER_SERVER_STATUS, val == true);
             } else
                 pa_log_warn("received %s with invalid arguments.", CMTSPEECH_DBUS_CSCALL_STATUS_SIG);
         } else
@@ -879,6 +1293,15 @@ DBusHandlerResult cmtspeech_dbus_filter(DBusConnection *conn, DBusMessage *msg,
         if (dbus_error_is_set(&dbus_error) != true) {
             pa_log_debug("modem state change: %s", modemstate);
         }
+    } else if (dbus_message_is_signal(msg, CMTSPEECH_DBUS_FLIGHT_RECORDER_IF, CMTSPEECH_DBUS_FLIGHT_RECORDER_DUMP_SIG)) {
+        pa_log_debug("Received flight recorder dump request");
+        if (u->flight_recorder)
+            cmtspeech_flight_recorder_dump(u->flight_recorder, CMTSPEECH_FR_DUMP_ON_DEMAND);
+        else
+            pa_log_info("Flight recorder disabled, ignoring dump request");
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+
     } else if (dbus_message_is_signal(msg, OFONO_DBUS_VOICECALL_IF, OFONO_DBUS_VOICECALL_CHANGE_SIG)) {
         pa_log_debug("Received voicecall change");
         if (dbus_message_iter_init(msg, &args) == true) {
@@ -916,11 +1339,7 @@ DBusHandlerResult cmtspeech_dbus_filter(DBusConnection *conn, DBusMessage *msg,
                         }
 
                         pa_log_debug("Set ServerStatus to %d.", val == true);
-                        /* note: very rarely taken code path */
-                        pa_mutex_lock(c->cmtspeech_mutex);
-                        if (c->cmtspeech)
-                            cmtspeech_state_change_call_status(c->cmtspeech, val == true);
-                        pa_mutex_unlock(c->cmtspeech_mutex);
+                        post_to_cmtspeech_thread(u, CMTSPEECH_HANDLER_CALL_STATUS, val == true);
 
                         return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
                     }
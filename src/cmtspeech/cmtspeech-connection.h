@@ -35,6 +35,13 @@
 #define CMTSPEECH_DBUS_PHONE_SSC_STATE_IF   "com.nokia.phone.SSC"
 #define CMTSPEECH_DBUS_PHONE_SSC_STATE_SIG  "modem_state_changed_ind"
 
+#define CMTSPEECH_DBUS_FLIGHT_RECORDER_IF       "org.maemo.cmtspeech.FlightRecorder"
+#define CMTSPEECH_DBUS_FLIGHT_RECORDER_DUMP_SIG "Dump"
+
+#define CMTSPEECH_DBUS_CALL_REPORT_PATH     "/org/maemo/cmtspeech"
+#define CMTSPEECH_DBUS_CALL_REPORT_IF       "org.maemo.cmtspeech.CallReport"
+#define CMTSPEECH_DBUS_CALL_REPORT_SIG      "CallEnded"
+
 #define OFONO_DBUS_VOICECALL_IF         "org.ofono.VoiceCall"
 #define OFONO_DBUS_VOICECALL_CHANGE_SIG "PropertyChanged"
 #define ALSA_OLD_ALTERNATIVE_PROP       "x-maemo.alsa_sink.buffers=alternative"
@@ -57,6 +64,7 @@ void cmtspeech_connection_unload(struct userdata *u);
 int cmtspeech_send_ul_frame(struct userdata *u, uint8_t *buf, size_t bytes);
 
 int cmtspeech_buffer_to_memchunk(struct userdata *u, cmtspeech_dl_buf_t *buf, pa_memchunk *chunk);
+int cmtspeech_buffer_copy_to_memchunk(struct userdata *u, cmtspeech_dl_buf_t *buf, pa_memchunk *chunk);
 
 DBusHandlerResult cmtspeech_dbus_filter(DBusConnection *conn, DBusMessage *msg, void *arg);
 
@@ -23,6 +23,7 @@
 #include "cmtspeech-dbus.h"
 
 #include "cmtspeech-connection.h"
+#include "cmtspeech-call-report.h"
 #include <pulsecore/rtpoll.h>
 #include <poll.h>
 #include <string.h>
@@ -116,6 +117,11 @@ int cmtspeech_dbus_init(struct userdata *u, const char *dbus_type)
     if (add_dbus_match(e, dbusconn, rule))
         goto fail;
 
+    snprintf(rule, sizeof(rule), "type='signal',interface='%s',member='%s'",
+             CMTSPEECH_DBUS_FLIGHT_RECORDER_IF, CMTSPEECH_DBUS_FLIGHT_RECORDER_DUMP_SIG);
+    if (add_dbus_match(e, dbusconn, rule))
+        goto fail;
+
     return 0;
 
  fail:
@@ -125,6 +131,50 @@ int cmtspeech_dbus_init(struct userdata *u, const char *dbus_type)
 }
 
 
+/* Main thread */
+void cmtspeech_dbus_send_call_report(struct userdata *u, const struct cmtspeech_call_report *r)
+{
+    struct cmtspeech_dbus_conn *e = &u->dbus_conn;
+    DBusMessage *msg;
+    dbus_bool_t emergency;
+
+    pa_assert(r);
+
+    if (!e->dbus_conn)
+        return;
+
+    if (!(msg = dbus_message_new_signal(CMTSPEECH_DBUS_CALL_REPORT_PATH, CMTSPEECH_DBUS_CALL_REPORT_IF,
+                                        CMTSPEECH_DBUS_CALL_REPORT_SIG))) {
+        pa_log_error("Failed to allocate call report signal");
+        return;
+    }
+
+    emergency = r->emergency;
+    if (!dbus_message_append_args(msg,
+                                  DBUS_TYPE_UINT32, &r->duration_ms,
+                                  DBUS_TYPE_BOOLEAN, &emergency,
+                                  DBUS_TYPE_UINT32, &r->dl_frames,
+                                  DBUS_TYPE_UINT32, &r->dl_bad_frames,
+                                  DBUS_TYPE_UINT32, &r->dl_silent_frames,
+                                  DBUS_TYPE_UINT32, &r->dl_drops,
+                                  DBUS_TYPE_UINT32, &r->dl_queue_overflows,
+                                  DBUS_TYPE_UINT32, &r->dl_depth_p50_ms,
+                                  DBUS_TYPE_UINT32, &r->dl_depth_p99_ms,
+                                  DBUS_TYPE_UINT32, &r->ul_frames,
+                                  DBUS_TYPE_UINT32, &r->ul_failures,
+                                  DBUS_TYPE_UINT32, &r->modem_resets,
+                                  DBUS_TYPE_INVALID)) {
+        pa_log_error("Failed to build call report signal");
+        dbus_message_unref(msg);
+        return;
+    }
+
+    if (!dbus_connection_send(pa_dbus_connection_get(e->dbus_conn), msg, NULL))
+        pa_log_error("Failed to send call report signal");
+
+    dbus_message_unref(msg);
+}
+
 void cmtspeech_dbus_unload(struct userdata *u)
 {
     DBusConnection *dbusconn;
@@ -28,4 +28,7 @@
 int cmtspeech_dbus_init(struct userdata *u, const char *dbus_type);
 void cmtspeech_dbus_unload(struct userdata *u);
 
+struct cmtspeech_call_report;
+void cmtspeech_dbus_send_call_report(struct userdata *u, const struct cmtspeech_call_report *r);
+
 #endif // cmtspeech_dbus_h
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/sink.h>
+#include <meego/module-voice-api.h>
+
+#include "cmtspeech-dl-phase.h"
+#include "cmtspeech-drift.h"
+
+/* DL phase alignment
+ *
+ * The time a DL frame waits between its arrival from the modem and the
+ * sink pop that consumes it is random per call, anything from zero to a
+ * full frame. The arrival time is stored by the cmtspeech thread and the
+ * wait is averaged in the sink IO thread. When the voice sink API has
+ * VOICE_SINK_SET_DL_DEADLINE and dl_phase_hint is set, the sink is given
+ * a DL deadline, a short margin after the frame arrivals, to move its
+ * period to. Without it the phase is only measured and logged, the
+ * module cannot move the sink pops. All functions are called from the
+ * sink IO thread. */
+
+#define CMTSPEECH_DL_PHASE_SAMPLES      (50)    /* one second of frames */
+#define CMTSPEECH_DL_PHASE_MARGIN       ((pa_usec_t) 2000)
+#define CMTSPEECH_DL_PHASE_TOLERANCE    ((pa_usec_t) 1000)
+
+void cmtspeech_dl_phase_reset(struct userdata *u) {
+    struct cmtspeech_dl_phase *p = &u->dl_phase;
+
+    p->avg = 0;
+    p->count = 0;
+}
+
+/* Called when exactly one frame moved from the DL frame queue in this pop */
+void cmtspeech_dl_phase_update(struct userdata *u, pa_sink *s, pa_usec_t now) {
+    struct cmtspeech_dl_phase *p = &u->dl_phase;
+    uint32_t wait;
+    pa_usec_t avg;
+
+    wait = (uint32_t) now - (uint32_t) pa_atomic_load(&u->cmt_connection.dl_arrival);
+
+    /* Frame from an earlier period, the sink was late */
+    if (wait >= u->frame_usec)
+        return;
+
+    if (p->count++ == 0)
+        p->avg = (int64_t) wait << 4;
+    else
+        p->avg += (((int64_t) wait << 4) - p->avg) >> 4;
+
+    if (!p->hint || p->count < CMTSPEECH_DL_PHASE_SAMPLES)
+        return;
+
+    avg = (pa_usec_t) (p->avg >> 4);
+    if (avg > CMTSPEECH_DL_PHASE_MARGIN + CMTSPEECH_DL_PHASE_TOLERANCE ||
+        avg + CMTSPEECH_DL_PHASE_TOLERANCE < CMTSPEECH_DL_PHASE_MARGIN) {
+#ifdef HAVE_VOICE_SINK_SET_DL_DEADLINE
+        pa_usec_t deadline = now - avg + CMTSPEECH_DL_PHASE_MARGIN;
+
+        pa_log_debug("DL frames wait %0.1f ms for the sink, DL deadline hint at %" PRIu64,
+                     (double) avg / PA_USEC_PER_MSEC, deadline);
+        pa_asyncmsgq_post(s->asyncmsgq, PA_MSGOBJECT(s), VOICE_SINK_SET_DL_DEADLINE,
+                          NULL, (int64_t) deadline, NULL, NULL);
+        p->hints++;
+#endif
+    }
+
+    /* Measure again, the sink period may have moved */
+    p->count = 0;
+}
+
+void cmtspeech_dl_phase_log(struct userdata *u) {
+    struct cmtspeech_dl_phase *p = &u->dl_phase;
+    double ppm, err;
+
+    if (!p->count && !p->hints)
+        return;
+
+    pa_log_info("DL phase: frames wait %0.1f ms for the sink on average, %u deadline hints sent",
+                (double) (p->avg >> 4) / PA_USEC_PER_MSEC, p->hints);
+
+    /* The phase walks by the modem clock drift when the sink follows the host clock */
+    if (cmtspeech_drift_get(&u->cmt_connection.drift, &ppm, &err))
+        pa_log_info("DL phase: modem clock %+0.1f ppm (+-%0.1f), %0.2f ms per minute",
+                    ppm, err, ppm * 60.0 / 1000.0);
+}
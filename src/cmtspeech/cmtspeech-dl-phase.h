@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_dl_phase_h
+#define cmtspeech_dl_phase_h
+
+#include "module-meego-cmtspeech.h"
+
+void cmtspeech_dl_phase_reset(struct userdata *u);
+void cmtspeech_dl_phase_update(struct userdata *u, pa_sink *s, pa_usec_t now);
+void cmtspeech_dl_phase_log(struct userdata *u);
+
+/* cmtspeech thread, for every DL frame */
+static inline void cmtspeech_dl_phase_arrival(struct userdata *u, pa_usec_t now) {
+    pa_atomic_store(&u->cmt_connection.dl_arrival, (int) (uint32_t) now);
+}
+
+#endif /* cmtspeech_dl_phase_h */
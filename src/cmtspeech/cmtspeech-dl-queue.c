@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cmtspeech-dl-queue.h"
+
+/* DL frame queue between the cmtspeech thread and the sink IO-thread
+ *
+ * Single producer (cmtspeech thread), any number of consumers. Unlike
+ * pa_asyncq the producer may reclaim the oldest entry when the queue is
+ * full: the read index is only ever advanced with compare-and-swap, so
+ * whoever wins the swap owns the entry and the other side just retries. */
+
+struct cmtspeech_dl_queue {
+    unsigned depth;
+    bool drop_oldest;
+    pa_atomic_t read_idx;
+    pa_atomic_t write_idx;
+    pa_atomic_t overflows;
+    pa_atomic_ptr_t *cells;
+};
+
+cmtspeech_dl_queue *cmtspeech_dl_queue_new(unsigned depth, bool drop_oldest) {
+    cmtspeech_dl_queue *q;
+
+    pa_assert(depth > 0 && depth <= CMTSPEECH_DL_QUEUE_MAX_DEPTH);
+
+    q = pa_xnew0(cmtspeech_dl_queue, 1);
+    q->depth = depth;
+    q->drop_oldest = drop_oldest;
+    q->cells = pa_xnew0(pa_atomic_ptr_t, depth);
+
+    return q;
+}
+
+void cmtspeech_dl_queue_free(cmtspeech_dl_queue *q) {
+    pa_assert(q);
+
+    if (cmtspeech_dl_queue_length(q))
+        pa_log_warn("DL queue freed with %u entries", cmtspeech_dl_queue_length(q));
+
+    pa_xfree(q->cells);
+    pa_xfree(q);
+}
+
+/* Returns 0 if p was queued. When the queue is full either the oldest
+ * entry is returned in *dropped and p is queued, or -1 is returned and
+ * p is not queued, depending on the overflow policy.
+ * cmtspeech thread */
+int cmtspeech_dl_queue_push(cmtspeech_dl_queue *q, void *p, void **dropped) {
+    unsigned w, r;
+
+    pa_assert(q);
+    pa_assert(p);
+    pa_assert(dropped);
+
+    *dropped = NULL;
+    w = (unsigned) pa_atomic_load(&q->write_idx);
+
+    for (;;) {
+        void *oldest;
+
+        r = (unsigned) pa_atomic_load(&q->read_idx);
+        if (w - r < q->depth)
+            break;
+
+        if (!q->drop_oldest) {
+            pa_atomic_inc(&q->overflows);
+            return -1;
+        }
+
+        oldest = pa_atomic_ptr_load(&q->cells[r % q->depth]);
+        if (pa_atomic_cmpxchg(&q->read_idx, (int) r, (int) (r + 1))) {
+            pa_atomic_inc(&q->overflows);
+            *dropped = oldest;
+            break;
+        }
+    }
+
+    pa_atomic_ptr_store(&q->cells[w % q->depth], p);
+    pa_atomic_store(&q->write_idx, (int) (w + 1));
+
+    return 0;
+}
+
+/* Any thread */
+void *cmtspeech_dl_queue_pop(cmtspeech_dl_queue *q) {
+    pa_assert(q);
+
+    for (;;) {
+        unsigned r = (unsigned) pa_atomic_load(&q->read_idx);
+        void *p;
+
+        if (r == (unsigned) pa_atomic_load(&q->write_idx))
+            return NULL;
+
+        p = pa_atomic_ptr_load(&q->cells[r % q->depth]);
+        if (pa_atomic_cmpxchg(&q->read_idx, (int) r, (int) (r + 1)))
+            return p;
+    }
+}
+
+/* Any thread */
+unsigned cmtspeech_dl_queue_length(cmtspeech_dl_queue *q) {
+    unsigned r;
+
+    pa_assert(q);
+
+    r = (unsigned) pa_atomic_load(&q->read_idx);
+    return (unsigned) pa_atomic_load(&q->write_idx) - r;
+}
+
+/* Any thread */
+unsigned cmtspeech_dl_queue_overflows(cmtspeech_dl_queue *q) {
+    pa_assert(q);
+
+    return (unsigned) pa_atomic_load(&q->overflows);
+}
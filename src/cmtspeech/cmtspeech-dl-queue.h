@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_dl_queue_h
+#define cmtspeech_dl_queue_h
+
+#include <pulsecore/atomic.h>
+
+#define CMTSPEECH_DL_QUEUE_DEFAULT_DEPTH (4)
+#define CMTSPEECH_DL_QUEUE_MAX_DEPTH     (64)
+
+typedef struct cmtspeech_dl_queue cmtspeech_dl_queue;
+
+cmtspeech_dl_queue *cmtspeech_dl_queue_new(unsigned depth, bool drop_oldest);
+void cmtspeech_dl_queue_free(cmtspeech_dl_queue *q);
+
+int cmtspeech_dl_queue_push(cmtspeech_dl_queue *q, void *p, void **dropped);
+void *cmtspeech_dl_queue_pop(cmtspeech_dl_queue *q);
+unsigned cmtspeech_dl_queue_length(cmtspeech_dl_queue *q);
+
+unsigned cmtspeech_dl_queue_overflows(cmtspeech_dl_queue *q);
+
+#endif /* cmtspeech_dl_queue_h */
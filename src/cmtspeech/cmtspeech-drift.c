@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <limits.h>
+
+#include <pulsecore/log.h>
+
+#include "cmtspeech-drift.h"
+
+/* Modem clock drift against CLOCK_MONOTONIC
+ *
+ * The modem sends one DL frame per frame period of its own clock. We
+ * fit arrival time against frame number with exponentially weighted
+ * least squares: the slope is the modem frame period in host time. A
+ * DL frame is numbered by the slot of the fit it arrives in, so that a
+ * late wakeup cannot shift the numbering. Late wakeups only delay
+ * arrivals, so arrivals off the slots are left out and do not number
+ * the frames after them. The standard error of the slope tells how far
+ * the estimate can be trusted. The UL deadlines of
+ * CMTSPEECH_TIMING_CONFIG_NTF give a second, modem reported, view of
+ * the same drift when the modem resends them.
+ *
+ * Both go to the statistics page. The fitted estimate is also set on
+ * the sink input and source output as CMTSPEECH_PROP_DRIFT_PPM.
+ *
+ * Positive ppm means modem frames take longer than nominal in host
+ * time, i.e. the modem clock is slow. */
+
+#define CMTSPEECH_DRIFT_WINDOW      (1024)      /* frames, weight 1/e after this */
+#define CMTSPEECH_DRIFT_MIN_SAMPLES (250)       /* before publishing */
+#define CMTSPEECH_DRIFT_GAP         (10 * PA_USEC_PER_SEC)
+#define CMTSPEECH_DRIFT_NTF_SPAN    (PA_USEC_PER_SEC)
+#define CMTSPEECH_DRIFT_OFF_GRID    (16)        /* arrivals left out before a new fit */
+
+static void drift_publish(struct cmtspeech_drift *d, double ppm, double err) {
+    pa_atomic_store(&d->ppm, (int) lrint(ppm * CMTSPEECH_DRIFT_Q));
+    pa_atomic_store(&d->err, err * CMTSPEECH_DRIFT_Q < INT_MAX ? (int) lrint(err * CMTSPEECH_DRIFT_Q) : INT_MAX);
+}
+
+/* Starts a new fit from the DL frame arriving at now */
+static void drift_restart(struct cmtspeech_drift *d, pa_usec_t now) {
+    d->ref = now;
+    d->last = now;
+    d->frame = 0;
+    d->count = 0;
+    d->rejected = 0;
+    d->off_grid = 0;
+    d->mean_n = d->mean_t = 0.0;
+    d->cnn = d->cnt = d->ctt = 0.0;
+    pa_atomic_store(&d->ppm, 0);
+    pa_atomic_store(&d->err, INT_MAX);
+}
+
+/* cmtspeech thread */
+void cmtspeech_drift_reset(struct cmtspeech_drift *d) {
+    pa_assert(d);
+
+    drift_restart(d, 0);
+    d->ntf_count = 0;
+    d->ntf_ppm = 0.0;
+    d->ntf_known = false;
+}
+
+/* cmtspeech thread, for every DL frame */
+void cmtspeech_drift_dl_frame(struct cmtspeech_drift *d, pa_usec_t now, pa_usec_t period) {
+    double n, t, dn, dt, a, slope, var, err, slots;
+    int64_t step;
+
+    pa_assert(d);
+    pa_assert(period > 0);
+
+    /* A long pause could hide a whole number of periods of drift */
+    if (d->ref == 0 || now < d->last || now - d->last > CMTSPEECH_DRIFT_GAP ||
+        d->off_grid >= CMTSPEECH_DRIFT_OFF_GRID) {
+        if (d->count > 0)
+            cmtspeech_drift_log(d);
+        drift_restart(d, now);
+    }
+
+    t = (double) (now - d->ref);
+
+    /* Slots of the fit from the one after the last numbered frame,
+     * frames missed in between still took their period */
+    if (d->count > 0) {
+        slope = d->count >= CMTSPEECH_DRIFT_MIN_SAMPLES ? d->cnt / d->cnn : (double) period;
+        slots = (t - (d->mean_t + slope * ((double) (d->frame + 1) - d->mean_n))) / slope;
+        step = (int64_t) floor(slots + 0.5);
+        if (step < 0 || fabs(slots - (double) step) > 0.25) {
+            d->rejected++;
+            d->off_grid++;
+            return;
+        }
+        d->frame += step + 1;
+    }
+
+    d->off_grid = 0;
+    d->last = now;
+    n = (double) d->frame;
+
+    d->count++;
+    a = 1.0 / (double) PA_MIN(d->count, (unsigned) CMTSPEECH_DRIFT_WINDOW);
+    dn = n - d->mean_n;
+    dt = t - d->mean_t;
+    d->mean_n += a * dn;
+    d->mean_t += a * dt;
+    d->cnn = (1.0 - a) * (d->cnn + a * dn * dn);
+    d->cnt = (1.0 - a) * (d->cnt + a * dn * dt);
+    d->ctt = (1.0 - a) * (d->ctt + a * dt * dt);
+
+    if (d->count < CMTSPEECH_DRIFT_MIN_SAMPLES || d->cnn <= 0.0)
+        return;
+
+    slope = d->cnt / d->cnn;
+    var = PA_MAX(d->ctt - slope * d->cnt, 0.0);
+    err = sqrt(var / ((double) PA_MIN(d->count, (unsigned) CMTSPEECH_DRIFT_WINDOW) * d->cnn));
+
+    drift_publish(d, (slope - (double) period) * 1e6 / (double) period, err * 1e6 / (double) period);
+}
+
+/* cmtspeech thread, for every UL deadline from CMTSPEECH_TIMING_CONFIG_NTF */
+void cmtspeech_drift_timing(struct cmtspeech_drift *d, pa_usec_t deadline, pa_usec_t period) {
+    pa_usec_t oldest;
+    int64_t elapsed, frames;
+
+    pa_assert(d);
+
+    d->ntf[d->ntf_count % CMTSPEECH_DRIFT_NTF_MAX] = deadline;
+    d->ntf_count++;
+
+    if (d->ntf_count < 2)
+        return;
+
+    oldest = d->ntf[d->ntf_count > CMTSPEECH_DRIFT_NTF_MAX ? d->ntf_count % CMTSPEECH_DRIFT_NTF_MAX : 0];
+    elapsed = (int64_t) (deadline - oldest);
+    if (elapsed < (int64_t) CMTSPEECH_DRIFT_NTF_SPAN)
+        return;
+
+    /* The deadline grid moves against host time by the drift */
+    frames = (elapsed + (int64_t) period / 2) / (int64_t) period;
+    d->ntf_ppm = (double) (elapsed - frames * (int64_t) period) * 1e6 / (double) (frames * (int64_t) period);
+    d->ntf_known = true;
+}
+
+void cmtspeech_drift_log(struct cmtspeech_drift *d) {
+    double ppm, err;
+
+    pa_assert(d);
+
+    if (cmtspeech_drift_get(d, &ppm, &err))
+        pa_log_info("Modem clock drift %+0.1f ppm (+-%0.1f), %u DL frames, %u late frames left out",
+                    ppm, err, d->count, d->rejected);
+    else
+        pa_log_info("Modem clock drift unknown, %u DL frames", d->count);
+
+    if (d->ntf_known)
+        pa_log_info("Modem clock drift from %u timing notifications %+0.1f ppm", d->ntf_count, d->ntf_ppm);
+}
+
+/* Returns false until the estimate is available.
+ * Any thread */
+bool cmtspeech_drift_get(struct cmtspeech_drift *d, double *ppm, double *err_ppm) {
+    int e;
+
+    pa_assert(d);
+
+    if ((e = pa_atomic_load(&d->err)) == INT_MAX)
+        return false;
+
+    if (ppm)
+        *ppm = (double) pa_atomic_load(&d->ppm) / CMTSPEECH_DRIFT_Q;
+    if (err_ppm)
+        *err_ppm = (double) e / CMTSPEECH_DRIFT_Q;
+
+    return true;
+}
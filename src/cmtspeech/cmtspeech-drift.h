@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_drift_h
+#define cmtspeech_drift_h
+
+#include "module-meego-cmtspeech.h"
+
+#define CMTSPEECH_DRIFT_Q               (256)       /* published ppm << 8 */
+
+/* The estimate as set on the sink input and source output */
+#define CMTSPEECH_PROP_DRIFT_PPM        "x-maemo.cmtspeech.modem_drift_ppm"
+#define CMTSPEECH_PROP_DRIFT_ERR_PPM    "x-maemo.cmtspeech.modem_drift_err_ppm"
+
+void cmtspeech_drift_reset(struct cmtspeech_drift *d);
+void cmtspeech_drift_dl_frame(struct cmtspeech_drift *d, pa_usec_t now, pa_usec_t period);
+void cmtspeech_drift_timing(struct cmtspeech_drift *d, pa_usec_t deadline, pa_usec_t period);
+void cmtspeech_drift_log(struct cmtspeech_drift *d);
+
+bool cmtspeech_drift_get(struct cmtspeech_drift *d, double *ppm, double *err_ppm);
+
+#endif /* cmtspeech_drift_h */
@@ -0,0 +1,461 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/volume.h>
+#include <pulse/xmalloc.h>
+
+/* CMTSPEECH_DSP_GENERIC builds the plain C kernels only, for tests */
+#if defined(CMTSPEECH_DSP_GENERIC)
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CMTSPEECH_DSP_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CMTSPEECH_DSP_SSE2 1
+#endif
+
+#include "cmtspeech-dsp.h"
+
+/* In place speech processing on call audio frames
+ *
+ * Everything here works on S16NE mono frames of a few hundred samples,
+ * processes a frame in one pass and has a NEON and an SSE2 kernel with
+ * a plain C fallback. Gains are Q12 fixed point. */
+
+#define Q12_ONE                 (1 << 12)
+
+/* Hard limiter knee at about -3 dBFS, 4:1 above it, saturating at full scale */
+#define LIMITER_THRESHOLD       (23197)
+
+/* Frames quieter than this (about -55 dBFS) do not move the gain */
+#define AGC_NOISE_FLOOR         (58)
+
+/* Gain moves 1/2 of the way down and 1/32 of the way up per frame */
+#define AGC_ATTACK_SHIFT        (1)
+#define AGC_RELEASE_SHIFT       (5)
+
+/* Gain ramps in steps of this many samples */
+#define AGC_RAMP_STEP           (8)
+
+struct cmtspeech_agc {
+    int32_t gain;               /* Q12 */
+    int32_t max_gain;           /* Q12 */
+    int32_t target;             /* RMS in sample units */
+    int32_t min_gain_seen;
+    int32_t max_gain_seen;
+    unsigned frames;
+};
+
+static int32_t db_to_q12(int32_t db) {
+    return (int32_t) (pa_sw_volume_to_linear(pa_sw_volume_from_dB((double) db)) * Q12_ONE + 0.5);
+}
+
+static uint32_t isqrt64(uint64_t x) {
+    uint64_t r = 0, bit = (uint64_t) 1 << 62;
+
+    while (bit > x)
+        bit >>= 2;
+
+    while (bit) {
+        if (x >= r + bit) {
+            x -= r + bit;
+            r = (r >> 1) + bit;
+        } else
+            r >>= 1;
+        bit >>= 2;
+    }
+
+    return (uint32_t) r;
+}
+
+/* Main thread. Returns 0 and sets *agc to NULL when the AGC is disabled. */
+int cmtspeech_agc_new(pa_modargs *ma, cmtspeech_agc **agc) {
+    cmtspeech_agc *a;
+    bool enabled = false;
+    int32_t target = CMTSPEECH_AGC_TARGET_DB, max_gain = CMTSPEECH_AGC_MAX_GAIN_DB;
+
+    pa_assert(ma);
+    pa_assert(agc);
+
+    *agc = NULL;
+
+    if (pa_modargs_get_value_boolean(ma, "dl_agc", &enabled) < 0) {
+        pa_log_error("Failed to parse dl_agc argument");
+        return -1;
+    }
+
+    if (pa_modargs_get_value_s32(ma, "dl_agc_target", &target) < 0 || target > -3 || target < -40) {
+        pa_log_error("Failed to parse dl_agc_target argument, must be -40 - -3 dBFS");
+        return -1;
+    }
+
+    if (pa_modargs_get_value_s32(ma, "dl_agc_max_gain", &max_gain) < 0 ||
+        max_gain < 0 || max_gain > CMTSPEECH_AGC_MAX_GAIN_LIMIT_DB) {
+        pa_log_error("Failed to parse dl_agc_max_gain argument, must be 0 - %d dB", CMTSPEECH_AGC_MAX_GAIN_LIMIT_DB);
+        return -1;
+    }
+
+    if (!enabled)
+        return 0;
+
+    a = pa_xnew0(cmtspeech_agc, 1);
+    a->max_gain = PA_MIN(db_to_q12(max_gain), INT16_MAX);
+    a->target = (int32_t) (db_to_q12(target) * (int64_t) INT16_MAX / Q12_ONE);
+    cmtspeech_agc_reset(a);
+
+    pa_log_info("DL AGC enabled: target %d dBFS, max gain %d dB", target, max_gain);
+
+    *agc = a;
+    return 0;
+}
+
+/* Main thread */
+void cmtspeech_agc_free(cmtspeech_agc *agc) {
+    pa_assert(agc);
+
+    pa_xfree(agc);
+}
+
+/* Sink IO-thread */
+void cmtspeech_agc_reset(cmtspeech_agc *agc) {
+    pa_assert(agc);
+
+    agc->gain = Q12_ONE;
+    agc->min_gain_seen = Q12_ONE;
+    agc->max_gain_seen = Q12_ONE;
+    agc->frames = 0;
+}
+
+/* Sink IO-thread */
+void cmtspeech_agc_log(cmtspeech_agc *agc) {
+    pa_assert(agc);
+
+    if (!agc->frames)
+        return;
+
+    pa_log_info("DL AGC: %u frames, gain %0.2f (range %0.2f - %0.2f)", agc->frames,
+                (double) agc->gain / Q12_ONE, (double) agc->min_gain_seen / Q12_ONE,
+                (double) agc->max_gain_seen / Q12_ONE);
+}
+
+static inline int16_t gain_limit_sample(int16_t x, int32_t gain) {
+    int32_t y = ((int32_t) x * gain) >> 12;
+    int32_t s = y >> 31;
+    int32_t a = (y ^ s) - s;
+
+    if (a > LIMITER_THRESHOLD)
+        a -= (a - LIMITER_THRESHOLD) - ((a - LIMITER_THRESHOLD) >> 2);
+
+    /* Saturates like the NEON and SSE2 narrowing */
+    y = (a ^ s) - s;
+    return (int16_t) PA_CLAMP_UNLIKELY(y, INT16_MIN, INT16_MAX);
+}
+
+static uint64_t sum_squares(const int16_t *x, unsigned n) {
+    uint64_t sum = 0;
+    unsigned i = 0;
+
+#if defined(CMTSPEECH_DSP_NEON)
+    uint64x2_t acc = vdupq_n_u64(0);
+
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(x + i);
+        int32x4_t lo = vmull_s16(vget_low_s16(v), vget_low_s16(v));
+        int32x4_t hi = vmull_s16(vget_high_s16(v), vget_high_s16(v));
+
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(lo));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(hi));
+    }
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#elif defined(CMTSPEECH_DSP_SSE2)
+    __m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128();
+    uint64_t lanes[2];
+
+    /* A pair of squares is at most 2^31, exact when the int32 lanes
+     * are widened as unsigned */
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (x + i));
+        __m128i m = _mm_madd_epi16(v, v);
+
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(m, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(m, zero));
+    }
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    sum = lanes[0] + lanes[1];
+#endif
+
+    for (; i < n; i++)
+        sum += (uint64_t) ((int32_t) x[i] * x[i]);
+
+    return sum;
+}
+
+/* Applies a gain ramping from g0 by step every AGC_RAMP_STEP samples,
+ * followed by the limiter. Gains are Q12 and fit in int16. */
+static void gain_limit(int16_t *x, unsigned n, int32_t g0, int32_t step) {
+    int32_t g = g0;
+    unsigned i = 0;
+
+#if defined(CMTSPEECH_DSP_NEON)
+    const int32x4_t thr = vdupq_n_s32(LIMITER_THRESHOLD);
+    const int32x4_t zero = vdupq_n_s32(0);
+
+    for (; i + AGC_RAMP_STEP <= n; i += AGC_RAMP_STEP, g += step) {
+        int16x8_t v = vld1q_s16(x + i);
+        int16x4_t gv = vdup_n_s16((int16_t) g);
+        int32x4_t y[2];
+        unsigned k;
+
+        y[0] = vshrq_n_s32(vmull_s16(vget_low_s16(v), gv), 12);
+        y[1] = vshrq_n_s32(vmull_s16(vget_high_s16(v), gv), 12);
+
+        for (k = 0; k < 2; k++) {
+            int32x4_t a = vabsq_s32(y[k]);
+            int32x4_t over = vmaxq_s32(vsubq_s32(a, thr), zero);
+
+            a = vaddq_s32(vsubq_s32(a, over), vshrq_n_s32(over, 2));
+            y[k] = vbslq_s32(vcltq_s32(y[k], zero), vnegq_s32(a), a);
+        }
+
+        vst1q_s16(x + i, vcombine_s16(vqmovn_s32(y[0]), vqmovn_s32(y[1])));
+    }
+#elif defined(CMTSPEECH_DSP_SSE2)
+    const __m128i thr = _mm_set1_epi32(LIMITER_THRESHOLD);
+
+    for (; i + AGC_RAMP_STEP <= n; i += AGC_RAMP_STEP, g += step) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (x + i));
+        __m128i gv = _mm_set1_epi16((int16_t) g);
+        __m128i lo = _mm_mullo_epi16(v, gv);
+        __m128i hi = _mm_mulhi_epi16(v, gv);
+        __m128i y[2];
+        unsigned k;
+
+        y[0] = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 12);
+        y[1] = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 12);
+
+        for (k = 0; k < 2; k++) {
+            __m128i s = _mm_srai_epi32(y[k], 31);
+            __m128i a = _mm_sub_epi32(_mm_xor_si128(y[k], s), s);
+            __m128i over = _mm_and_si128(_mm_cmpgt_epi32(a, thr), _mm_sub_epi32(a, thr));
+
+            a = _mm_add_epi32(_mm_sub_epi32(a, over), _mm_srai_epi32(over, 2));
+            y[k] = _mm_sub_epi32(_mm_xor_si128(a, s), s);
+        }
+
+        /* Saturating pack clips at full scale */
+        _mm_storeu_si128((__m128i *) (x + i), _mm_packs_epi32(y[0], y[1]));
+    }
+#endif
+
+    for (; i < n; i++) {
+        x[i] = gain_limit_sample(x[i], g);
+        if ((i + 1) % AGC_RAMP_STEP == 0)
+            g += step;
+    }
+}
+
+/* Sink IO-thread. The gain is measured and applied in the same frame,
+ * ramping from the previous frame's gain so no look-ahead is needed. */
+void cmtspeech_agc_process(cmtspeech_agc *agc, int16_t *samples, unsigned n, bool bad_frame) {
+    int32_t desired, gain, step;
+    uint32_t rms;
+
+    pa_assert(agc);
+    pa_assert(samples);
+
+    if (n == 0)
+        return;
+
+    gain = agc->gain;
+
+    rms = isqrt64(sum_squares(samples, n) / n);
+    if (!bad_frame && rms >= AGC_NOISE_FLOOR) {
+        desired = (int32_t) PA_MIN(((int64_t) agc->target << 12) / rms, (int64_t) agc->max_gain);
+        desired = PA_MAX(desired, Q12_ONE / 8);
+
+        if (desired < gain)
+            gain += (desired - gain) >> AGC_ATTACK_SHIFT;
+        else
+            gain += (desired - gain) >> AGC_RELEASE_SHIFT;
+    }
+
+    step = (gain - agc->gain) / (int32_t) PA_MAX(n / AGC_RAMP_STEP, 1U);
+    gain_limit(samples, n, agc->gain, step);
+
+    agc->gain = gain;
+    agc->min_gain_seen = PA_MIN(agc->min_gain_seen, gain);
+    agc->max_gain_seen = PA_MAX(agc->max_gain_seen, gain);
+    agc->frames++;
+}
+
+/* UL conditioning
+ *
+ * DC removal, a fixed gain and clipping, done while copying a frame to
+ * the modem buffer. The DC estimate is the smoothed mean of the input,
+ * held constant over a frame, which makes a high-pass with a corner well
+ * below 1 Hz. The input sum for the estimate is taken in the same pass. */
+
+/* DC estimate in Q8 follows the frame mean with a 32 frame time constant */
+#define UL_DC_SHIFT             (5)
+
+struct cmtspeech_ul_cond {
+    int16_t gain;               /* Q12 */
+    bool dc_removal;
+    int32_t dc;                 /* Q8 */
+    int64_t sum;
+    unsigned count;
+};
+
+/* Main thread. Returns 0 and sets *cond to NULL when conditioning is disabled. */
+int cmtspeech_ul_cond_new(pa_modargs *ma, cmtspeech_ul_cond **cond) {
+    cmtspeech_ul_cond *c;
+    bool enabled = false, dc_removal = true;
+    int32_t gain = 0;
+
+    pa_assert(ma);
+    pa_assert(cond);
+
+    *cond = NULL;
+
+    if (pa_modargs_get_value_boolean(ma, "ul_conditioning", &enabled) < 0) {
+        pa_log_error("Failed to parse ul_conditioning argument");
+        return -1;
+    }
+
+    if (pa_modargs_get_value_s32(ma, "ul_gain", &gain) < 0 ||
+        gain < CMTSPEECH_UL_GAIN_MIN_DB || gain > CMTSPEECH_UL_GAIN_MAX_DB) {
+        pa_log_error("Failed to parse ul_gain argument, must be %d - %d dB",
+                     CMTSPEECH_UL_GAIN_MIN_DB, CMTSPEECH_UL_GAIN_MAX_DB);
+        return -1;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "ul_dc_removal", &dc_removal) < 0) {
+        pa_log_error("Failed to parse ul_dc_removal argument");
+        return -1;
+    }
+
+    if (!enabled)
+        return 0;
+
+    c = pa_xnew0(cmtspeech_ul_cond, 1);
+    c->gain = (int16_t) PA_MIN(db_to_q12(gain), INT16_MAX);
+    c->dc_removal = dc_removal;
+    cmtspeech_ul_cond_reset(c);
+
+    pa_log_info("UL conditioning enabled: gain %d dB, DC removal %s", gain, dc_removal ? "on" : "off");
+
+    *cond = c;
+    return 0;
+}
+
+/* Main thread */
+void cmtspeech_ul_cond_free(cmtspeech_ul_cond *cond) {
+    pa_assert(cond);
+
+    pa_xfree(cond);
+}
+
+/* Source IO-thread */
+void cmtspeech_ul_cond_reset(cmtspeech_ul_cond *cond) {
+    pa_assert(cond);
+
+    cond->dc = 0;
+    cond->sum = 0;
+    cond->count = 0;
+}
+
+/* Source IO-thread. dst = clip((src - dc) * gain), may be called several
+ * times per frame. */
+void cmtspeech_ul_cond_copy(cmtspeech_ul_cond *cond, int16_t *dst, const int16_t *src, unsigned n) {
+    const int16_t dc = cond->dc_removal ? (int16_t) (cond->dc >> 8) : 0;
+    const int16_t g = cond->gain;
+    int64_t sum = 0;
+    unsigned i = 0;
+
+#if defined(CMTSPEECH_DSP_NEON)
+    const int16x8_t dcv = vdupq_n_s16(dc);
+    const int16x4_t gv = vdup_n_s16(g);
+    int32x4_t acc = vdupq_n_s32(0);
+
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t x = vld1q_s16(src + i);
+        int16x8_t d = vqsubq_s16(x, dcv);
+
+        acc = vpadalq_s16(acc, x);
+        vst1q_s16(dst + i, vcombine_s16(vqshrn_n_s32(vmull_s16(vget_low_s16(d), gv), 12),
+                                        vqshrn_n_s32(vmull_s16(vget_high_s16(d), gv), 12)));
+    }
+    sum = (int64_t) vgetq_lane_s32(acc, 0) + vgetq_lane_s32(acc, 1) +
+          vgetq_lane_s32(acc, 2) + vgetq_lane_s32(acc, 3);
+#elif defined(CMTSPEECH_DSP_SSE2)
+    const __m128i dcv = _mm_set1_epi16(dc);
+    const __m128i gv = _mm_set1_epi16(g);
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    int32_t lanes[4];
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i d = _mm_subs_epi16(x, dcv);
+        __m128i lo = _mm_mullo_epi16(d, gv);
+        __m128i hi = _mm_mulhi_epi16(d, gv);
+
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(x, ones));
+        _mm_storeu_si128((__m128i *) (dst + i),
+                         _mm_packs_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 12),
+                                         _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 12)));
+    }
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    sum = (int64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+    for (; i < n; i++) {
+        int32_t y = ((int32_t) PA_CLAMP_UNLIKELY((int32_t) src[i] - dc, INT16_MIN, INT16_MAX) * g) >> 12;
+
+        sum += src[i];
+        dst[i] = (int16_t) PA_CLAMP_UNLIKELY(y, INT16_MIN, INT16_MAX);
+    }
+
+    cond->sum += sum;
+    cond->count += n;
+}
+
+/* Source IO-thread. Updates the DC estimate from the samples copied since
+ * the previous call. */
+void cmtspeech_ul_cond_frame_done(cmtspeech_ul_cond *cond) {
+    int32_t mean;
+
+    pa_assert(cond);
+
+    if (!cond->count)
+        return;
+
+    mean = (int32_t) ((cond->sum << 8) / (int64_t) cond->count);
+    cond->dc += (mean - cond->dc) >> UL_DC_SHIFT;
+
+    cond->sum = 0;
+    cond->count = 0;
+}
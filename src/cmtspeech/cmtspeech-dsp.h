@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_dsp_h
+#define cmtspeech_dsp_h
+
+#include <pulsecore/modargs.h>
+
+#include "module-meego-cmtspeech.h"
+
+#define CMTSPEECH_AGC_TARGET_DB     (-20)
+#define CMTSPEECH_AGC_MAX_GAIN_DB   (12)
+#define CMTSPEECH_AGC_MAX_GAIN_LIMIT_DB (18)   /* Q12 gain must fit in int16 */
+
+typedef struct cmtspeech_agc cmtspeech_agc;
+
+int cmtspeech_agc_new(pa_modargs *ma, cmtspeech_agc **agc);
+void cmtspeech_agc_free(cmtspeech_agc *agc);
+
+void cmtspeech_agc_reset(cmtspeech_agc *agc);
+void cmtspeech_agc_process(cmtspeech_agc *agc, int16_t *samples, unsigned n, bool bad_frame);
+void cmtspeech_agc_log(cmtspeech_agc *agc);
+
+#define CMTSPEECH_UL_GAIN_MIN_DB    (-20)
+#define CMTSPEECH_UL_GAIN_MAX_DB    (18)
+
+typedef struct cmtspeech_ul_cond cmtspeech_ul_cond;
+
+int cmtspeech_ul_cond_new(pa_modargs *ma, cmtspeech_ul_cond **cond);
+void cmtspeech_ul_cond_free(cmtspeech_ul_cond *cond);
+
+void cmtspeech_ul_cond_reset(cmtspeech_ul_cond *cond);
+void cmtspeech_ul_cond_copy(cmtspeech_ul_cond *cond, int16_t *dst, const int16_t *src, unsigned n);
+void cmtspeech_ul_cond_frame_done(cmtspeech_ul_cond *cond);
+
+#endif /* cmtspeech_dsp_h */
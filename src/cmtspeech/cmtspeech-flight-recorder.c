@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/thread-mq.h>
+
+#include "cmtspeech-flight-recorder.h"
+#include "cmtspeech-mainloop-handler.h"
+
+/* Flight recorder
+ *
+ * Fixed size ring of compact per-frame records, written lock-free from the
+ * cmtspeech, sink IO and source IO threads. At roughly 150 records per
+ * second during a call the ring covers the last ~50 seconds. The ring is
+ * written to a file from the main thread when a glitch is detected or
+ * when asked to over DBus, at most once per dump interval. The dumps go
+ * to a fixed set of files that are reused in turn.
+ *
+ * A writer clears the seq of its record, fills the record and publishes
+ * it by storing the seq last. The dump copies a record between two seq
+ * loads and clears the seq of records that changed meanwhile, the
+ * reader discards those. */
+
+#define CMTSPEECH_FR_RECORDS        (8192)  /* power of two */
+#define CMTSPEECH_FR_DUMP_INTERVAL  ((pa_usec_t)(10 * PA_USEC_PER_SEC))
+#define CMTSPEECH_FR_DUMP_FILES     (4)
+#define CMTSPEECH_FR_MAGIC          "CMTSPFR"
+#define CMTSPEECH_FR_VERSION        (1)
+
+typedef struct cmtspeech_fr_record {
+    pa_atomic_t seq;            /* write index + 1, 0 for never written or torn */
+    uint32_t timestamp;         /* usec, lower 32 bits of rtclock */
+    uint8_t event;
+    uint8_t dl_queue;           /* frames in DL frame queue */
+    uint16_t memblockq;         /* bytes in DL memblockq */
+    uint32_t arg;
+} cmtspeech_fr_record;
+
+typedef struct cmtspeech_fr_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t records;
+    uint32_t write_index;
+    uint32_t reason;
+    uint32_t reserved;
+    uint64_t dump_time;         /* usec, rtclock */
+} cmtspeech_fr_header;
+
+struct cmtspeech_flight_recorder {
+    char *prefix;
+    pa_atomic_t write_index;
+    pa_atomic_t dump_pending;
+    pa_usec_t last_dump;        /* main thread only */
+    unsigned dumps;             /* main thread only */
+    cmtspeech_fr_record records[CMTSPEECH_FR_RECORDS];
+};
+
+/* Main thread */
+cmtspeech_flight_recorder *cmtspeech_flight_recorder_new(const char *prefix) {
+    cmtspeech_flight_recorder *fr;
+
+    pa_assert(prefix);
+
+    fr = pa_xnew0(cmtspeech_flight_recorder, 1);
+    fr->prefix = pa_xstrdup(prefix);
+
+    return fr;
+}
+
+/* Main thread */
+void cmtspeech_flight_recorder_free(cmtspeech_flight_recorder *fr) {
+    pa_assert(fr);
+
+    pa_xfree(fr->prefix);
+    pa_xfree(fr);
+}
+
+/* Any thread */
+void cmtspeech_flight_recorder_log(cmtspeech_flight_recorder *fr, uint8_t event,
+                                   unsigned dl_queue, size_t memblockq, uint32_t arg) {
+    cmtspeech_fr_record *r;
+    unsigned idx;
+
+    if (!fr)
+        return;
+
+    idx = (unsigned) pa_atomic_inc(&fr->write_index);
+    r = &fr->records[idx & (CMTSPEECH_FR_RECORDS - 1)];
+
+    pa_atomic_store(&r->seq, 0);
+    r->timestamp = (uint32_t) pa_rtclock_now();
+    r->event = event;
+    r->dl_queue = (uint8_t) PA_MIN(dl_queue, 0xffU);
+    r->memblockq = (uint16_t) PA_MIN(memblockq, 0xffffU);
+    r->arg = arg;
+    pa_atomic_store(&r->seq, (int) (idx + 1));
+}
+
+/* Asks the main thread to dump the recorder. Only one request is in
+ * flight at a time. Any thread with a thread_mq installed. */
+void cmtspeech_flight_recorder_request_dump(struct userdata *u, int reason) {
+    cmtspeech_flight_recorder *fr;
+
+    pa_assert(u);
+
+    if (!(fr = u->flight_recorder))
+        return;
+
+    if (!pa_atomic_cmpxchg(&fr->dump_pending, 0, 1))
+        return;
+
+    pa_asyncmsgq_post(pa_thread_mq_get()->outq, u->mainloop_handler,
+                      CMTSPEECH_MAINLOOP_HANDLER_DUMP_FLIGHT_RECORDER, NULL, reason, NULL, NULL);
+}
+
+/* Main thread */
+int cmtspeech_flight_recorder_dump(cmtspeech_flight_recorder *fr, int reason) {
+    cmtspeech_fr_header header;
+    pa_usec_t now;
+    unsigned first, i, end;
+    char *fn;
+    FILE *f;
+    int ret = -1;
+
+    pa_assert(fr);
+
+    now = pa_rtclock_now();
+    pa_atomic_store(&fr->dump_pending, 0);
+
+    if (fr->dumps && now < fr->last_dump + CMTSPEECH_FR_DUMP_INTERVAL) {
+        pa_log_debug("Flight recorder dumped recently, skipping (reason %d)", reason);
+        return 0;
+    }
+
+    fn = pa_sprintf_malloc("%s-%u.bin", fr->prefix, fr->dumps % CMTSPEECH_FR_DUMP_FILES);
+
+    if (!(f = pa_fopen_cloexec(fn, "w"))) {
+        pa_log_error("Failed to open flight recorder dump %s: %s", fn, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    end = (unsigned) pa_atomic_load(&fr->write_index);
+    first = end > CMTSPEECH_FR_RECORDS ? end - CMTSPEECH_FR_RECORDS : 0;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CMTSPEECH_FR_MAGIC, sizeof(CMTSPEECH_FR_MAGIC));
+    header.version = CMTSPEECH_FR_VERSION;
+    header.record_size = sizeof(cmtspeech_fr_record);
+    header.records = end - first;
+    header.write_index = end;
+    header.reason = (uint32_t) reason;
+    header.dump_time = now;
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1)
+        goto write_fail;
+
+    /* Records may be overwritten while we write, those are written with
+     * the seq cleared */
+    for (i = first; i != end; i++) {
+        cmtspeech_fr_record *r = &fr->records[i & (CMTSPEECH_FR_RECORDS - 1)];
+        cmtspeech_fr_record copy;
+        int seq = pa_atomic_load(&r->seq);
+
+        memcpy(&copy, r, sizeof(copy));
+        if (seq != (int) (i + 1) || pa_atomic_load(&r->seq) != seq)
+            pa_atomic_store(&copy.seq, 0);
+
+        if (fwrite(&copy, sizeof(copy), 1, f) != 1)
+            goto write_fail;
+    }
+
+    if (fclose(f) != 0) {
+        f = NULL;
+        goto write_fail;
+    }
+
+    pa_log_info("Flight recorder dumped %u records to %s (reason %d)", end - first, fn, reason);
+    fr->last_dump = now;
+    fr->dumps++;
+    ret = 0;
+    goto finish;
+
+write_fail:
+    pa_log_error("Failed to write flight recorder dump %s: %s", fn, pa_cstrerror(errno));
+    if (f)
+        fclose(f);
+
+finish:
+    pa_xfree(fn);
+    return ret;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_flight_recorder_h
+#define cmtspeech_flight_recorder_h
+
+#include "module-meego-cmtspeech.h"
+
+/* Record event types */
+enum {
+    CMTSPEECH_FR_DL_ACQUIRE = 1,        /* arg = frame bytes */
+    CMTSPEECH_FR_DL_OVERFLOW,           /* arg = overflow count */
+    CMTSPEECH_FR_DL_POP,                /* arg = frames moved from DL frame queue */
+    CMTSPEECH_FR_DL_UNDERRUN,           /* arg = consecutive underruns */
+    CMTSPEECH_FR_DL_DROP,               /* arg = bytes dropped */
+    CMTSPEECH_FR_UL_SEND,               /* arg = UL frame count */
+    CMTSPEECH_FR_UL_FAIL,               /* arg = negated error code */
+    CMTSPEECH_FR_STATE,                 /* arg = msg_type << 16 | prev << 8 | state */
+    CMTSPEECH_FR_MODEM_RESET,
+};
+
+/* Dump reasons */
+enum {
+    CMTSPEECH_FR_DUMP_ON_DEMAND = 0,
+    CMTSPEECH_FR_DUMP_OVERFLOW,
+    CMTSPEECH_FR_DUMP_UNDERRUN,
+    CMTSPEECH_FR_DUMP_MODEM_RESET,
+};
+
+/* Consecutive DL underruns that trigger a dump */
+#define CMTSPEECH_FR_UNDERRUN_BURST (5)
+
+typedef struct cmtspeech_flight_recorder cmtspeech_flight_recorder;
+
+cmtspeech_flight_recorder *cmtspeech_flight_recorder_new(const char *prefix);
+void cmtspeech_flight_recorder_free(cmtspeech_flight_recorder *fr);
+
+void cmtspeech_flight_recorder_log(cmtspeech_flight_recorder *fr, uint8_t event,
+                                   unsigned dl_queue, size_t memblockq, uint32_t arg);
+
+void cmtspeech_flight_recorder_request_dump(struct userdata *u, int reason);
+int cmtspeech_flight_recorder_dump(cmtspeech_flight_recorder *fr, int reason);
+
+#endif /* cmtspeech_flight_recorder_h */
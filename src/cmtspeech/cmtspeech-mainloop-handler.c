@@ -21,11 +21,16 @@
  */
 
 #include "cmtspeech-mainloop-handler.h"
+#include <pulse/rtclock.h>
 #include <pulsecore/namereg.h>
 #include <meego/proplist-meego.h>
 
 #include "cmtspeech-source-output.h"
 #include "cmtspeech-sink-input.h"
+#include "cmtspeech-flight-recorder.h"
+#include "cmtspeech-call-report.h"
+#include "cmtspeech-dbus.h"
+#include "cmtspeech-drift.h"
 
 PA_DEFINE_PUBLIC_CLASS(cmtspeech_mainloop_handler, pa_msgobject);
 
@@ -39,6 +44,33 @@ static void mainloop_handler_free(pa_object *o) {
 #define PA_ALSA_PROP_BUFFERS_PRIMARY "primary"
 #define PA_ALSA_PROP_BUFFERS_ALTERNATIVE "alternative"
 
+/* How long the speech start took to reach the main thread */
+static void log_start_latency(const char *dir, pa_atomic_t *start_time) {
+    uint32_t start = (uint32_t) pa_atomic_load(start_time);
+
+    pa_log_info("%s_CONNECT reached main thread %0.1f ms after speech start",
+                dir, (double) ((uint32_t) pa_rtclock_now() - start) / PA_USEC_PER_MSEC);
+}
+
+/* Sets the modem clock drift estimate on the streams for the voice sink
+ * and source, and any client, to pick up */
+static void set_drift_properties(struct userdata *u) {
+    pa_proplist *p;
+    double ppm, err;
+
+    if (!cmtspeech_drift_get(&u->cmt_connection.drift, &ppm, &err))
+        return;
+
+    p = pa_proplist_new();
+    pa_proplist_setf(p, CMTSPEECH_PROP_DRIFT_PPM, "%+0.1f", ppm);
+    pa_proplist_setf(p, CMTSPEECH_PROP_DRIFT_ERR_PPM, "%0.1f", err);
+    if (u->sink_input)
+        pa_sink_input_update_proplist(u->sink_input, PA_UPDATE_REPLACE, p);
+    if (u->source_output)
+        pa_source_output_update_proplist(u->source_output, PA_UPDATE_REPLACE, p);
+    pa_proplist_free(p);
+}
+
 static int mainloop_handler_process_msg(pa_msgobject *o, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
     cmtspeech_mainloop_handler *h = CMTSPEECH_MAINLOOP_HANDLER(o);
     struct userdata *u;
@@ -62,7 +94,12 @@ static int mainloop_handler_process_msg(pa_msgobject *o, int code, void *userdat
 
     case CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_CONNECT:
         pa_log_debug("Handling CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_CONNECT");
-        if (u->source_output->state == PA_SOURCE_OUTPUT_RUNNING)
+        log_start_latency("UL", &u->cmt_connection.ul_start_time);
+        if (u->fast_cork) {
+            /* The source IO thread is already sending, only reconcile */
+            if (u->source_output->state == PA_SOURCE_OUTPUT_CORKED)
+                pa_source_output_cork(u->source_output, false);
+        } else if (u->source_output->state == PA_SOURCE_OUTPUT_RUNNING)
             pa_log_warn("UL_CONNECT: source output is already running");
         else
             pa_source_output_cork(u->source_output, false);
@@ -70,6 +107,8 @@ static int mainloop_handler_process_msg(pa_msgobject *o, int code, void *userdat
 
     case CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_DISCONNECT:
         pa_log_debug("Handling CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_DISCONNECT");
+        if (u->fast_cork)
+            return 0; /* Stays uncorked until the stream is deleted */
         if (u->source_output->state == PA_SOURCE_OUTPUT_CORKED)
             pa_log_warn("UL_DISCONNECT: source output is already corked");
         else
@@ -78,7 +117,12 @@ static int mainloop_handler_process_msg(pa_msgobject *o, int code, void *userdat
 
     case CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_CONNECT:
         pa_log_debug("Handling CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_CONNECT");
-        if (u->sink_input->state == PA_SINK_INPUT_RUNNING)
+        log_start_latency("DL", &u->cmt_connection.dl_start_time);
+        if (u->fast_cork) {
+            /* The sink IO thread is already consuming, only reconcile */
+            if (u->sink_input->state == PA_SINK_INPUT_CORKED)
+                pa_sink_input_cork(u->sink_input, false);
+        } else if (u->sink_input->state == PA_SINK_INPUT_RUNNING)
             pa_log_warn("DL_CONNECT: sink input is already running");
         else
             pa_sink_input_cork(u->sink_input, false);
@@ -86,12 +130,30 @@ static int mainloop_handler_process_msg(pa_msgobject *o, int code, void *userdat
 
     case CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_DISCONNECT:
         pa_log_debug("Handling CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_DISCONNECT");
+        if (u->fast_cork)
+            return 0; /* Stays uncorked until the stream is deleted */
         if (u->sink_input->state == PA_SINK_INPUT_CORKED)
             pa_log_warn("DL_DISCONNECT: sink input is already corked");
         else
             pa_sink_input_cork(u->sink_input, true);
         return 0;
 
+    case CMTSPEECH_MAINLOOP_HANDLER_DUMP_FLIGHT_RECORDER:
+        pa_log_debug("Handling CMTSPEECH_MAINLOOP_HANDLER_DUMP_FLIGHT_RECORDER");
+        if (u->flight_recorder)
+            cmtspeech_flight_recorder_dump(u->flight_recorder, (int) offset);
+        return 0;
+
+    case CMTSPEECH_MAINLOOP_HANDLER_CALL_REPORT:
+        pa_log_debug("Handling CMTSPEECH_MAINLOOP_HANDLER_CALL_REPORT");
+        cmtspeech_dbus_send_call_report(u, userdata);
+        return 0;
+
+    case CMTSPEECH_MAINLOOP_HANDLER_DRIFT:
+        pa_log_debug("Handling CMTSPEECH_MAINLOOP_HANDLER_DRIFT");
+        set_drift_properties(u);
+        return 0;
+
    default:
         pa_log_error("Unknown message code %d", code);
         return -1;
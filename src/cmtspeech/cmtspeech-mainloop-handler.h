@@ -45,6 +45,9 @@ enum {
     CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_DISCONNECT,
     CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_CONNECT,
     CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_DISCONNECT,
+    CMTSPEECH_MAINLOOP_HANDLER_DUMP_FLIGHT_RECORDER,
+    CMTSPEECH_MAINLOOP_HANDLER_CALL_REPORT,
+    CMTSPEECH_MAINLOOP_HANDLER_DRIFT,
     CMTSPEECH_MAINLOOP_HANDLER_MESSAGE_MAX
 };
 
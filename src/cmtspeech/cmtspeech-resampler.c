@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/macro.h>
+
+/* Plain C dot product with CMTSPEECH_DSP_GENERIC, as in cmtspeech-dsp.c */
+#if defined(CMTSPEECH_DSP_GENERIC)
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CMTSPEECH_RESAMPLER_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CMTSPEECH_RESAMPLER_SSE2 1
+#endif
+
+#include "module-meego-cmtspeech.h"
+#include "cmtspeech-resampler.h"
+
+/* Fixed ratio resampling between the modem rate and the voice sink and
+ * source rate
+ *
+ * Integer ratios 2, 3 and 6 are handled with a polyphase FIR, the
+ * filter is a Blackman windowed sinc with its cutoff above the speech
+ * band. Every output sample is one int16 dot product of TAPS_PER_PHASE
+ * (upsampling) or TAPS_PER_PHASE * factor (downsampling) taps, so the
+ * kernels only need a vectorised dot product. Coefficients are Q14.
+ *
+ * The filter history before each of the last few runs can be kept, so
+ * that a rewound stream picks up the history it had at the rewind
+ * point instead of starting from silence. */
+
+#define TAPS_PER_PHASE  (24)            /* multiple of 8 */
+#define CUTOFF_HZ       (3700.0)
+#define COEF_SHIFT      (14)
+
+struct cmtspeech_resampler {
+    unsigned factor;
+    bool up;
+    unsigned taps;                      /* dot product length */
+    unsigned history;                   /* samples kept from previous run */
+    unsigned max_input;
+    int16_t *coef;                      /* reversed, one set per phase when up */
+    int16_t *buf;                       /* history followed by input */
+    unsigned snapshots;                 /* runs cmtspeech_resampler_rewind() can undo */
+    int16_t *snap;                      /* history before each run, ring */
+    unsigned snap_pos;                  /* next snapshot */
+    unsigned snap_len;
+};
+
+/* Returns the integer ratio for a device rate, 1 when the rate is the
+ * modem rate and 0 when there is no specialised converter for it. */
+unsigned cmtspeech_resampler_factor(uint32_t rate) {
+    switch (rate) {
+        case CMTSPEECH_SAMPLERATE:      return 1;
+        case 2 * CMTSPEECH_SAMPLERATE:  return 2;
+        case 3 * CMTSPEECH_SAMPLERATE:  return 3;
+        case 6 * CMTSPEECH_SAMPLERATE:  return 6;
+    }
+    return 0;
+}
+
+static void design_filter(double *h, unsigned n, unsigned factor) {
+    const double fc = CUTOFF_HZ / (double) (CMTSPEECH_SAMPLERATE * factor);
+    const double mid = (double) (n - 1) / 2.0;
+    double sum = 0.0;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        double t = (double) i - mid;
+        double sinc = t == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+        double w = 0.42 - 0.5 * cos(2.0 * M_PI * i / (n - 1)) + 0.08 * cos(4.0 * M_PI * i / (n - 1));
+
+        h[i] = sinc * w;
+        sum += h[i];
+    }
+
+    for (i = 0; i < n; i++)
+        h[i] /= sum;
+}
+
+static int16_t to_q14(double x) {
+    long v = lrint(x * (1 << COEF_SHIFT));
+
+    return (int16_t) PA_CLAMP(v, INT16_MIN, INT16_MAX);
+}
+
+/* Main thread. max_input is the largest number of input samples passed
+ * to one cmtspeech_resampler_run() call, snapshots the number of runs
+ * that can be rewound. */
+cmtspeech_resampler *cmtspeech_resampler_new(unsigned factor, bool up, unsigned max_input, unsigned snapshots) {
+    cmtspeech_resampler *r;
+    unsigned n = TAPS_PER_PHASE * factor;
+    double *h;
+    unsigned p, j;
+
+    pa_assert(factor == 2 || factor == 3 || factor == 6);
+    pa_assert(max_input > 0);
+
+    r = pa_xnew0(cmtspeech_resampler, 1);
+    r->factor = factor;
+    r->up = up;
+    r->max_input = max_input;
+
+    h = pa_xnew(double, n);
+    design_filter(h, n, factor);
+
+    r->coef = pa_xnew(int16_t, n);
+    if (up) {
+        /* Phase p uses every factor'th tap starting from p, scaled by the
+         * factor to keep unity gain after zero stuffing */
+        r->taps = TAPS_PER_PHASE;
+        for (p = 0; p < factor; p++)
+            for (j = 0; j < TAPS_PER_PHASE; j++)
+                r->coef[p * TAPS_PER_PHASE + j] = to_q14(h[p + (TAPS_PER_PHASE - 1 - j) * factor] * factor);
+    } else {
+        pa_assert(max_input % factor == 0);
+        r->taps = n;
+        for (j = 0; j < n; j++)
+            r->coef[j] = to_q14(h[n - 1 - j]);
+    }
+    r->history = r->taps - 1;
+
+    pa_xfree(h);
+
+    r->buf = pa_xnew0(int16_t, r->history + max_input);
+    r->snapshots = snapshots;
+    if (snapshots)
+        r->snap = pa_xnew(int16_t, snapshots * r->history);
+
+    pa_log_debug("Created x%u %s resampler with %u taps", factor, up ? "up" : "down", n);
+
+    return r;
+}
+
+/* Main thread */
+void cmtspeech_resampler_free(cmtspeech_resampler *r) {
+    pa_assert(r);
+
+    pa_xfree(r->coef);
+    pa_xfree(r->buf);
+    pa_xfree(r->snap);
+    pa_xfree(r);
+}
+
+/* IO-thread */
+void cmtspeech_resampler_reset(cmtspeech_resampler *r) {
+    pa_assert(r);
+
+    memset(r->buf, 0, r->history * sizeof(int16_t));
+    r->snap_len = 0;
+}
+
+static void snapshot(cmtspeech_resampler *r) {
+    if (!r->snapshots)
+        return;
+
+    memcpy(r->snap + r->snap_pos * r->history, r->buf, r->history * sizeof(int16_t));
+    r->snap_pos = (r->snap_pos + 1) % r->snapshots;
+    if (r->snap_len < r->snapshots)
+        r->snap_len++;
+}
+
+/* Counts as runs of silence input: the history is cleared but the
+ * silence can be rewound like any other run.
+ * IO-thread */
+void cmtspeech_resampler_silence(cmtspeech_resampler *r, unsigned runs) {
+    pa_assert(r);
+
+    while (runs--) {
+        snapshot(r);
+        memset(r->buf, 0, r->history * sizeof(int16_t));
+    }
+}
+
+/* Puts the history back to what it was before the last runs runs.
+ * Returns false, with the history cleared, when that is further back
+ * than the snapshots go.
+ * IO-thread */
+bool cmtspeech_resampler_rewind(cmtspeech_resampler *r, unsigned runs) {
+    pa_assert(r);
+
+    if (runs == 0)
+        return true;
+
+    if (runs > r->snap_len) {
+        cmtspeech_resampler_reset(r);
+        return false;
+    }
+
+    r->snap_pos = (r->snap_pos + r->snapshots - runs) % r->snapshots;
+    r->snap_len -= runs;
+    memcpy(r->buf, r->snap + r->snap_pos * r->history, r->history * sizeof(int16_t));
+
+    return true;
+}
+
+/* n is a multiple of 8 */
+static inline int16_t dot(const int16_t *c, const int16_t *x, unsigned n) {
+    int32_t sum = 0;
+    unsigned i = 0;
+
+#if defined(CMTSPEECH_RESAMPLER_NEON)
+    int32x4_t acc = vdupq_n_s32(0);
+    int32x2_t s;
+
+    for (; i < n; i += 8) {
+        int16x8_t cv = vld1q_s16(c + i);
+        int16x8_t xv = vld1q_s16(x + i);
+
+        acc = vmlal_s16(acc, vget_low_s16(cv), vget_low_s16(xv));
+        acc = vmlal_s16(acc, vget_high_s16(cv), vget_high_s16(xv));
+    }
+    s = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    sum = vget_lane_s32(vpadd_s32(s, s), 0);
+#elif defined(CMTSPEECH_RESAMPLER_SSE2)
+    __m128i acc = _mm_setzero_si128();
+
+    for (; i < n; i += 8)
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (c + i)),
+                                                _mm_loadu_si128((const __m128i *) (x + i))));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtsi128_si32(acc);
+#else
+    for (; i < n; i++)
+        sum += (int32_t) c[i] * x[i];
+#endif
+
+    sum = (sum + (1 << (COEF_SHIFT - 1))) >> COEF_SHIFT;
+    return (int16_t) PA_CLAMP_UNLIKELY(sum, INT16_MIN, INT16_MAX);
+}
+
+/* IO-thread. Converts n input samples, returns the number of samples
+ * written to dst, which is n * factor when upsampling and n / factor
+ * when downsampling. */
+unsigned cmtspeech_resampler_run(cmtspeech_resampler *r, int16_t *dst, const int16_t *src, unsigned n) {
+    const int16_t *x;
+    unsigned i, p, out = 0;
+
+    pa_assert(r);
+    pa_assert(n <= r->max_input);
+
+    snapshot(r);
+    memcpy(r->buf + r->history, src, n * sizeof(int16_t));
+
+    if (r->up) {
+        /* x[0] is the oldest sample in the window of input i */
+        for (i = 0, x = r->buf; i < n; i++, x++)
+            for (p = 0; p < r->factor; p++)
+                dst[out++] = dot(r->coef + p * r->taps, x, r->taps);
+    } else {
+        pa_assert(n % r->factor == 0);
+        for (i = 0, x = r->buf; i < n; i += r->factor, x += r->factor)
+            dst[out++] = dot(r->coef, x + r->factor - 1, r->taps);
+    }
+
+    memmove(r->buf, r->buf + n, r->history * sizeof(int16_t));
+
+    return out;
+}
+
+/* Sink IO-thread. Replaces the chunk with its upsampled copy, the chunk
+ * may be longer than max_input. */
+void cmtspeech_resampler_chunk(cmtspeech_resampler *r, pa_mempool *pool, pa_memchunk *chunk) {
+    pa_memchunk out;
+    const int16_t *src;
+    int16_t *dst;
+    unsigned n, done, len;
+
+    pa_assert(r);
+    pa_assert(r->up);
+    pa_assert(chunk);
+
+    n = (unsigned) (chunk->length / sizeof(int16_t));
+
+    out.memblock = pa_memblock_new(pool, n * r->factor * sizeof(int16_t));
+    out.index = 0;
+
+    src = (const int16_t *) ((const uint8_t *) pa_memblock_acquire(chunk->memblock) + chunk->index);
+    dst = pa_memblock_acquire(out.memblock);
+    for (done = 0, out.length = 0; done < n; done += len) {
+        len = PA_MIN(n - done, r->max_input);
+        out.length += cmtspeech_resampler_run(r, dst + out.length / sizeof(int16_t), src + done, len) * sizeof(int16_t);
+    }
+    pa_memblock_release(out.memblock);
+    pa_memblock_release(chunk->memblock);
+
+    pa_memblock_unref(chunk->memblock);
+    *chunk = out;
+}
+
+/* Group delay of the linear phase filter */
+pa_usec_t cmtspeech_resampler_delay(const cmtspeech_resampler *r) {
+    pa_assert(r);
+
+    return (pa_usec_t) (TAPS_PER_PHASE * r->factor - 1) * PA_USEC_PER_SEC /
+        (2 * CMTSPEECH_SAMPLERATE * r->factor);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_resampler_h
+#define cmtspeech_resampler_h
+
+#include <pulse/sample.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+typedef struct cmtspeech_resampler cmtspeech_resampler;
+
+unsigned cmtspeech_resampler_factor(uint32_t rate);
+
+cmtspeech_resampler *cmtspeech_resampler_new(unsigned factor, bool up, unsigned max_input, unsigned snapshots);
+void cmtspeech_resampler_free(cmtspeech_resampler *r);
+
+void cmtspeech_resampler_reset(cmtspeech_resampler *r);
+void cmtspeech_resampler_silence(cmtspeech_resampler *r, unsigned runs);
+bool cmtspeech_resampler_rewind(cmtspeech_resampler *r, unsigned runs);
+unsigned cmtspeech_resampler_run(cmtspeech_resampler *r, int16_t *dst, const int16_t *src, unsigned n);
+void cmtspeech_resampler_chunk(cmtspeech_resampler *r, pa_mempool *pool, pa_memchunk *chunk);
+pa_usec_t cmtspeech_resampler_delay(const cmtspeech_resampler *r);
+
+#endif /* cmtspeech_resampler_h */
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sched.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include <pulsecore/core-util.h>
+#include <meego/module-voice-api.h>
+
+#include "cmtspeech-sched.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/* Not in glibc headers, see sched_setattr(2) */
+struct cmtspeech_sched_attr {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+#define CMTSPEECH_SCHED_DEADLINE_RUNTIME ((pa_usec_t)(2 * PA_USEC_PER_MSEC))
+
+enum cmtspeech_sched_policy {
+    CMTSPEECH_SCHED_DEFAULT = 0,
+    CMTSPEECH_SCHED_FIFO,
+    CMTSPEECH_SCHED_RR,
+    CMTSPEECH_SCHED_DEADLINE,
+};
+
+struct cmtspeech_sched {
+    enum cmtspeech_sched_policy policy;
+    uint32_t priority;                  /* 0 means derive from core */
+    pa_usec_t runtime;
+    pa_usec_t period;                   /* speech frame duration */
+    bool has_affinity;
+    cpu_set_t affinity;
+};
+
+static int parse_cpu_list(const char *list, cpu_set_t *set) {
+    const char *p = list;
+
+    CPU_ZERO(set);
+
+    while (*p) {
+        char *end;
+        unsigned long first, last;
+
+        first = strtoul(p, &end, 10);
+        if (end == p)
+            return -1;
+        last = first;
+        p = end;
+
+        if (*p == '-') {
+            p++;
+            last = strtoul(p, &end, 10);
+            if (end == p || last < first)
+                return -1;
+            p = end;
+        }
+
+        if (last >= CPU_SETSIZE)
+            return -1;
+
+        for (; first <= last; first++)
+            CPU_SET(first, set);
+
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return -1;
+    }
+
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+static const char *policy_to_string(int policy) {
+    switch (policy) {
+        case SCHED_OTHER:    return "other";
+        case SCHED_FIFO:     return "fifo";
+        case SCHED_RR:       return "rr";
+        case SCHED_DEADLINE: return "deadline";
+        default:             return "unknown";
+    }
+}
+
+/* Main thread */
+cmtspeech_sched *cmtspeech_sched_new(pa_modargs *ma, pa_usec_t period) {
+    cmtspeech_sched *s;
+    const char *policy, *affinity;
+    uint32_t runtime;
+
+    pa_assert(ma);
+
+    s = pa_xnew0(cmtspeech_sched, 1);
+
+    policy = pa_modargs_get_value(ma, "sched_policy", "default");
+    if (pa_streq(policy, "default"))
+        s->policy = CMTSPEECH_SCHED_DEFAULT;
+    else if (pa_streq(policy, "fifo"))
+        s->policy = CMTSPEECH_SCHED_FIFO;
+    else if (pa_streq(policy, "rr"))
+        s->policy = CMTSPEECH_SCHED_RR;
+    else if (pa_streq(policy, "deadline"))
+        s->policy = CMTSPEECH_SCHED_DEADLINE;
+    else {
+        pa_log_error("Invalid sched_policy \"%s\"", policy);
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "sched_priority", &s->priority) < 0 || s->priority > 99) {
+        pa_log_error("Failed to parse sched_priority argument");
+        goto fail;
+    }
+
+    runtime = CMTSPEECH_SCHED_DEADLINE_RUNTIME;
+    if (pa_modargs_get_value_u32(ma, "sched_runtime", &runtime) < 0 ||
+        runtime == 0 || runtime > period) {
+        pa_log_error("Failed to parse sched_runtime argument");
+        goto fail;
+    }
+    s->runtime = runtime;
+    s->period = period;
+
+    if ((affinity = pa_modargs_get_value(ma, "cpu_affinity", NULL))) {
+        if (parse_cpu_list(affinity, &s->affinity) < 0) {
+            pa_log_error("Invalid cpu_affinity \"%s\"", affinity);
+            goto fail;
+        }
+        s->has_affinity = true;
+    }
+
+    return s;
+
+fail:
+    pa_xfree(s);
+    return NULL;
+}
+
+/* Main thread */
+void cmtspeech_sched_free(cmtspeech_sched *s) {
+    pa_assert(s);
+
+    pa_xfree(s);
+}
+
+/* cmtspeech thread */
+static int sched_set_deadline(cmtspeech_sched *s) {
+#ifdef SYS_sched_setattr
+    struct cmtspeech_sched_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.sched_policy = SCHED_DEADLINE;
+    attr.sched_runtime = s->runtime * PA_NSEC_PER_USEC;
+    attr.sched_deadline = attr.sched_period = s->period * PA_NSEC_PER_USEC;
+
+    if (syscall(SYS_sched_setattr, 0, &attr, 0) < 0)
+        return -errno;
+
+    return 0;
+#else
+    return -ENOSYS;
+#endif
+}
+
+/* cmtspeech thread */
+static int sched_set_fixed_priority(int policy, int priority) {
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    return -pthread_setschedparam(pthread_self(), policy, &param);
+}
+
+/* cmtspeech thread */
+static void sched_log_effective(void) {
+    struct sched_param param;
+    cpu_set_t set;
+    char cpus[256] = "";
+    size_t len = 0;
+    int policy, cpu;
+
+    if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) {
+        policy = sched_getscheduler(0);
+        param.sched_priority = 0;
+    }
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (cpu = 0; cpu < CPU_SETSIZE && len < sizeof(cpus) - 8; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                len += snprintf(cpus + len, sizeof(cpus) - len, "%s%d", len ? "," : "", cpu);
+    }
+
+    pa_log_info("cmtspeech thread scheduling: policy %s, priority %d, cpus %s",
+                policy_to_string(policy), param.sched_priority, len ? cpus : "unknown");
+}
+
+/* Applies configured scheduling to the calling thread, falling back to
+ * the PulseAudio default realtime priority if the kernel refuses.
+ * cmtspeech thread */
+void cmtspeech_sched_apply(cmtspeech_sched *s, pa_core *core) {
+    int priority, policy, ret;
+
+    pa_assert(s);
+    pa_assert(core);
+
+    if (s->has_affinity) {
+        if (s->policy == CMTSPEECH_SCHED_DEADLINE)
+            pa_log_warn("cpu_affinity is not supported with SCHED_DEADLINE, ignored");
+        else if (sched_setaffinity(0, sizeof(s->affinity), &s->affinity) < 0)
+            pa_log_warn("Failed to set cmtspeech thread CPU affinity: %s", pa_cstrerror(errno));
+    }
+
+    priority = s->priority ? (int) s->priority : core->realtime_priority - 1;
+
+    switch (s->policy) {
+        case CMTSPEECH_SCHED_DEADLINE:
+            if ((ret = sched_set_deadline(s)) == 0)
+                break;
+            pa_log_warn("Failed to set SCHED_DEADLINE (runtime %" PRIu64 " usec): %s, falling back to SCHED_FIFO",
+                        s->runtime, pa_cstrerror(-ret));
+            /* fall through */
+        case CMTSPEECH_SCHED_FIFO:
+        case CMTSPEECH_SCHED_RR:
+            policy = s->policy == CMTSPEECH_SCHED_RR ? SCHED_RR : SCHED_FIFO;
+            if ((ret = sched_set_fixed_priority(policy, priority)) == 0)
+                break;
+            pa_log_warn("Failed to set %s priority %d: %s, falling back to default",
+                        policy_to_string(policy), priority, pa_cstrerror(-ret));
+            /* fall through */
+        case CMTSPEECH_SCHED_DEFAULT:
+            if (core->realtime_scheduling)
+                pa_make_realtime(core->realtime_priority - 1);
+            break;
+    }
+
+    sched_log_effective();
+}
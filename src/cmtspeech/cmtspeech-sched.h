@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_sched_h
+#define cmtspeech_sched_h
+
+#include <pulsecore/modargs.h>
+
+#include "module-meego-cmtspeech.h"
+
+typedef struct cmtspeech_sched cmtspeech_sched;
+
+cmtspeech_sched *cmtspeech_sched_new(pa_modargs *ma, pa_usec_t period);
+void cmtspeech_sched_free(cmtspeech_sched *s);
+void cmtspeech_sched_apply(cmtspeech_sched *s, pa_core *core);
+
+#endif /* cmtspeech_sched_h */
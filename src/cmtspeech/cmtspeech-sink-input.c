@@ -23,6 +23,8 @@
 #include <config.h>
 #endif
 
+#include <pulse/rtclock.h>
+
 #include <pulsecore/namereg.h>
 #include <pulsecore/sink-input.h>
 #include <pulsecore/source-output.h>
@@ -34,9 +36,20 @@
 #include "module-meego-cmtspeech.h"
 #include "cmtspeech-sink-input.h"
 #include "cmtspeech-connection.h"
+#include "cmtspeech-dl-queue.h"
+#include "cmtspeech-flight-recorder.h"
+#include "cmtspeech-dl-phase.h"
+#include "cmtspeech-dsp.h"
+#include "cmtspeech-resampler.h"
+#include "cmtspeech-stats.h"
+#include "cmtspeech-call-report.h"
+#include "cmtspeech-trace.h"
 #include <meego/memory.h>
 #include <meego/module-voice-api.h>
 
+/* History entry of a silent frame served on underrun */
+#define CMTSPEECH_DL_HISTORY_SILENCE (~0U)
+
 /**
  * Converts speech frame sideinfo flags from libcmtspeechdata format
  * to that of pulseaudio-meego voice module.
@@ -53,12 +66,17 @@ static unsigned int cmtspeech_to_voice_spc_flags(unsigned int spc_flags)
     return 0;
 }
 
+/* True when the voice sink takes DL sideinfo */
+static bool cmtspeech_dl_sideinfo_wanted(struct userdata *u) {
+    return u->voice_sideinfoq != NULL;
+}
+
 static void cmtspeech_dl_sideinfo_push(unsigned int cmt_spc_flags, int length, struct userdata *u) {
     unsigned int spc_flags;
-    pa_assert(length % u->dl_frame_size == 0);
     pa_assert(u);
+    pa_assert(length % u->dl_frame_size == 0);
 
-    if (NULL == u->voice_sideinfoq)
+    if (!cmtspeech_dl_sideinfo_wanted(u))
         return;
 
     spc_flags = cmtspeech_to_voice_spc_flags(cmt_spc_flags);
@@ -75,7 +93,17 @@ static void cmtspeech_dl_sideinfo_drop(struct userdata *u, int length) {
     pa_assert(u);
     pa_assert(length % u->dl_frame_size == 0);
 
-    if (NULL == u->voice_sideinfoq)
+    /* Rewound frames are the oldest in the buffer and go first. The
+     * dropped data now sits in the memblockq history, so the served
+     * frames before it cannot be rewound any more. */
+    while (length && u->dl_history.replay) {
+        u->dl_history.replay--;
+        u->dl_history.trim = 0;
+        length -= u->dl_frame_size;
+    }
+    u->dl_history.len = 0;
+
+    if (!cmtspeech_dl_sideinfo_wanted(u))
         return;
 
     while (length) {
@@ -86,26 +114,77 @@ static void cmtspeech_dl_sideinfo_drop(struct userdata *u, int length) {
     u->continuous_dl_stream = false;
 }
 
-static void cmtspeech_dl_sideinfo_forward(struct userdata *u) {
-    unsigned int spc_flags = 0;
+/* The voice sink takes one side info entry per voice sink frame, so the
+ * entries of shorter DL frames are merged. */
+static void cmtspeech_dl_sideinfo_emit(struct userdata *u, unsigned int spc_flags) {
+    if (u->dl_sideinfo_frames > 1) {
+        u->dl_sideinfo_flags |= spc_flags;
+        if (++u->dl_sideinfo_pos < u->dl_sideinfo_frames)
+            return;
+        spc_flags = u->dl_sideinfo_flags;
+        u->dl_sideinfo_flags = 0;
+        u->dl_sideinfo_pos = 0;
+    }
 
-    pa_assert(u);
+    CMTSPEECH_TRACE3(dl_sideinfo, pa_rtclock_now(), spc_flags, u->dl_sideinfo_frames);
+    pa_queue_push(u->voice_sideinfoq, PA_UINT_TO_PTR(spc_flags));
+}
 
-    if (NULL == u->voice_sideinfoq)
+/* Remember a served frame, newest last */
+static void cmtspeech_dl_history_add(struct userdata *u, unsigned int entry) {
+    struct cmtspeech_dl_history *h = &u->dl_history;
+
+    if (h->max == 0)
         return;
 
-    spc_flags = PA_PTR_TO_UINT(pa_queue_pop(u->local_sideinfoq));
+    h->entry[h->pos] = entry;
+    h->pos = (h->pos + 1) % CMTSPEECH_DL_HISTORY_MAX;
+    if (h->len < h->max)
+        h->len++;
+}
 
-    if (spc_flags == 0) {
+static void cmtspeech_dl_history_log(struct userdata *u) {
+    if (u->dl_history.rewinds)
+        pa_log_info("DL rewinds: %u, %u silent frames rewritten",
+                    u->dl_history.rewinds, u->dl_history.rewritten);
+    u->dl_history.rewinds = 0;
+    u->dl_history.rewritten = 0;
+}
+
+static void cmtspeech_dl_history_reset(struct userdata *u) {
+    u->dl_history.len = 0;
+    u->dl_history.replay = 0;
+    u->dl_history.trim = 0;
+    u->dl_history.pad = 0;
+    pa_atomic_store(&u->cmt_connection.dl_rewrite, 0);
+}
+
+static void cmtspeech_dl_sideinfo_forward(struct userdata *u) {
+    unsigned int spc_flags = 0;
+
+    pa_assert(u);
+
+    /* Rewound frames take their original sideinfo with them */
+    if (u->dl_history.replay)
+        spc_flags = u->dl_history.replayed[--u->dl_history.replay];
+    else if (cmtspeech_dl_sideinfo_wanted(u) &&
+             !(spc_flags = PA_PTR_TO_UINT(pa_queue_pop(u->local_sideinfoq)))) {
         pa_log_warn("Local sideinfo queue empty.");
+        cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_DL_SIDEINFO_MISMATCHES);
         spc_flags = VOICE_SIDEINFO_FLAG_BAD|VOICE_SIDEINFO_FLAG_BOGUS;
     }
-    else if (!u->continuous_dl_stream)
+
+    cmtspeech_dl_history_add(u, spc_flags);
+
+    if (!cmtspeech_dl_sideinfo_wanted(u))
+        return;
+
+    if (!u->continuous_dl_stream)
         spc_flags |= VOICE_SIDEINFO_FLAG_BAD;
 
     u->continuous_dl_stream = true;
 
-    pa_queue_push(u->voice_sideinfoq, PA_UINT_TO_PTR(spc_flags));
+    cmtspeech_dl_sideinfo_emit(u, spc_flags);
 }
 
 static void cmtspeech_dl_sideinfo_bogus(struct userdata *u) {
@@ -113,10 +192,10 @@ static void cmtspeech_dl_sideinfo_bogus(struct userdata *u) {
 
     pa_assert(u);
 
-    if (NULL == u->voice_sideinfoq)
+    if (!cmtspeech_dl_sideinfo_wanted(u))
         return;
 
-    pa_queue_push(u->voice_sideinfoq, PA_UINT_TO_PTR(spc_flags));
+    cmtspeech_dl_sideinfo_emit(u, spc_flags);
 
     u->continuous_dl_stream = false;
 }
@@ -128,28 +207,126 @@ static void cmtspeech_dl_sideinfo_flush(struct userdata *u) {
     while (pa_queue_pop(u->local_sideinfoq))
         ;
 
+    u->dl_sideinfo_pos = 0;
+    u->dl_sideinfo_flags = 0;
+
     if (u->voice_sideinfoq) {
         while (pa_queue_pop(u->voice_sideinfoq))
             ;
     }
 }
 
+static void cmtspeech_sink_input_reset_dl_stream(struct userdata *u);
+
+/* Silent frames served since the last DL frame, newest first */
+static unsigned cmtspeech_dl_history_silent(struct userdata *u) {
+    struct cmtspeech_dl_history *h = &u->dl_history;
+    unsigned n;
+
+    for (n = 0; n < h->len; n++)
+        if (h->entry[(h->pos + CMTSPEECH_DL_HISTORY_MAX - 1 - n) % CMTSPEECH_DL_HISTORY_MAX] !=
+            CMTSPEECH_DL_HISTORY_SILENCE)
+            break;
+
+    return n;
+}
+
 /*** sink_input callbacks ***/
 static int cmtspeech_sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memchunk *chunk) {
     struct userdata *u;
     int queue_counter = 0;
+    size_t stream_frame_size, want, slack;
+    unsigned frames, n;
 
     pa_assert_fp(i);
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
     pa_assert_fp(chunk);
 
+    if (!pa_atomic_load(&u->cmt_connection.dl_active)) {
+        if (u->dl_started && u->fast_cork) {
+            /* Stopped without corking, drop what is left of the call */
+            cmtspeech_dl_phase_log(u);
+            cmtspeech_dl_phase_reset(u);
+            cmtspeech_dl_history_log(u);
+            if (u->dl_agc) {
+                cmtspeech_agc_log(u->dl_agc);
+                cmtspeech_agc_reset(u->dl_agc);
+            }
+            cmtspeech_sink_input_reset_dl_stream(u);
+        }
+        u->dl_started = false;
+        if (u->fast_cork)
+            return -1;
+    } else if (!u->dl_started) {
+        uint32_t start = (uint32_t) pa_atomic_load(&u->cmt_connection.dl_start_time);
+
+        u->dl_started = true;
+        pa_log_info("DL started in sink IO thread %0.1f ms after speech start (%s)",
+                    (double) ((uint32_t) pa_rtclock_now() - start) / PA_USEC_PER_MSEC,
+                    u->fast_cork ? "fast cork" : "corked");
+    }
+
+    /* Silence of a partial frame rewind goes out before anything else */
+    if (u->dl_history.pad) {
+        pa_silence_memchunk_get(&u->core->silence_cache, u->core->mempool, chunk,
+                                &i->sample_spec, u->dl_history.pad);
+        u->dl_history.pad = 0;
+        return 0;
+    }
+
+    /* Serve as many whole DL frames as the sink asks for and we have,
+     * in one chunk. The buffer keeps room for the whole request, so the
+     * frames it asks for are not dropped as excess before they are
+     * served. Frames put back by a rewind are not dropped either, the
+     * memblockq grows for them and shrinks back once they are served. */
+    stream_frame_size = u->dl_frame_size * (i->sample_spec.rate / u->ss.rate);
+    frames = (unsigned) PA_MAX(length / stream_frame_size, (size_t) 1);
+    want = frames * u->dl_frame_size;
+    slack = PA_MAX(u->sink_frame_size, want) + (2 + u->dl_history.replay) * u->dl_frame_size;
+    if (slack + u->dl_frame_size > pa_memblockq_get_maxlength(u->dl_memblockq)) {
+        pa_log_debug("%u DL frames asked for, %u rewound, growing DL buffer", frames, u->dl_history.replay);
+        pa_memblockq_set_maxlength(u->dl_memblockq, slack + u->dl_frame_size);
+    } else if (slack + u->dl_frame_size <= u->dl_maxlength &&
+               pa_memblockq_get_maxlength(u->dl_memblockq) > u->dl_maxlength &&
+               pa_memblockq_get_length(u->dl_memblockq) <= u->dl_maxlength)
+        pa_memblockq_set_maxlength(u->dl_memblockq, u->dl_maxlength);
+
     if (u->cmt_connection.dl_frame_queue) {
         cmtspeech_dl_buf_t *buf;
-        while ((buf = pa_asyncq_pop(u->cmt_connection.dl_frame_queue, false))) {
+        while ((buf = cmtspeech_dl_queue_pop(u->cmt_connection.dl_frame_queue))) {
             pa_memchunk cmtchunk;
-            if (cmtspeech_buffer_to_memchunk(u, buf, &cmtchunk) < 0)
+            unsigned spc_flags = buf->spc_flags;
+            int r;
+            CMTSPEECH_TRACE3(dl_queue_pop, pa_rtclock_now(),
+                             cmtspeech_dl_queue_length(u->cmt_connection.dl_frame_queue), spc_flags);
+            if (spc_flags & CMTSPEECH_SPC_FLAGS_BFI)
+                pa_atomic_inc(&u->call_metrics.dl_bad_frames);
+            /* Served frames stay in the memblockq history while the sink
+             * may rewind, copy them so that the modem buffer is not held.
+             * The AGC needs a private copy too, the modem buffer belongs
+             * to libcmtspeechdata and is not ours to write. */
+            if (u->dl_agc || u->dl_history.max)
+                r = cmtspeech_buffer_copy_to_memchunk(u, buf, &cmtchunk);
+            else
+                r = cmtspeech_buffer_to_memchunk(u, buf, &cmtchunk);
+            if (r < 0)
+                continue;
+            if (cmtchunk.length % u->dl_frame_size) {
+                static unsigned count = 0;
+                if (count++ < 10)
+                    pa_log_error("DL frame of %zu bytes does not match frame size %zu, check frame_usec",
+                                 cmtchunk.length, u->dl_frame_size);
+                pa_memblock_unref(cmtchunk.memblock);
                 continue;
+            }
+            if (u->dl_agc) {
+                int16_t *d = pa_memblock_acquire(cmtchunk.memblock);
+                cmtspeech_agc_process(u->dl_agc, (int16_t *) ((uint8_t *) d + cmtchunk.index),
+                                      (unsigned) (cmtchunk.length / sizeof(int16_t)),
+                                      spc_flags & CMTSPEECH_SPC_FLAGS_BFI);
+                pa_memblock_release(cmtchunk.memblock);
+            }
             queue_counter++;
             if (pa_memblockq_push(u->dl_memblockq, &cmtchunk) < 0) {
                 pa_log_debug("Failed to push DL frame to dl_memblockq (len %zu max %zu)",
@@ -157,73 +334,188 @@ static int cmtspeech_sink_input_pop_cb(pa_sink_input *i, size_t length, pa_memch
                              pa_memblockq_get_maxlength(u->dl_memblockq));
             }
             else {
-                cmtspeech_dl_sideinfo_push(buf->spc_flags, cmtchunk.length, u);
+                CMTSPEECH_TRACE3(dl_memblockq_push, pa_rtclock_now(),
+                                 pa_memblockq_get_length(u->dl_memblockq), cmtchunk.length);
+                cmtspeech_dl_sideinfo_push(spc_flags, cmtchunk.length, u);
             }
             pa_memblock_unref(cmtchunk.memblock);
         }
     }
 
+    if (queue_counter == 1)
+        cmtspeech_dl_phase_update(u, i->sink, pa_rtclock_now());
+
     /* More than one DL frame in queue means that sink has not asked for more
-     * data for over 20ms and something may be wrong. */
+     * data for over a frame period and something may be wrong. */
     if (queue_counter > 1) {
         pa_log_info("%d frames found from queue (dl buf size %zu)", queue_counter,
                     pa_memblockq_get_length(u->dl_memblockq));
     }
 
-    if (pa_memblockq_get_length(u->dl_memblockq) > 3*u->dl_frame_size) {
-        size_t drop_bytes =
-            pa_memblockq_get_length(u->dl_memblockq) - 3*u->dl_frame_size;
+    /* Keep the requested frames, at least one voice sink frame, and two
+     * DL frames of slack */
+    if (pa_memblockq_get_length(u->dl_memblockq) > slack) {
+        size_t drop_bytes = pa_memblockq_get_length(u->dl_memblockq) - slack;
         pa_memblockq_drop(u->dl_memblockq, drop_bytes);
         cmtspeech_dl_sideinfo_drop(u, drop_bytes);
+        CMTSPEECH_TRACE3(dl_memblockq_drop, pa_rtclock_now(), pa_memblockq_get_length(u->dl_memblockq), drop_bytes);
+        cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_DL_DROPS);
+        pa_atomic_add(&u->call_metrics.dl_drops, (int) ((drop_bytes + u->dl_frame_size - 1) / u->dl_frame_size));
+        cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_DL_DROP,
+                                      cmtspeech_dl_queue_length(u->cmt_connection.dl_frame_queue),
+                                      pa_memblockq_get_length(u->dl_memblockq), (uint32_t) drop_bytes);
         pa_log_debug("Too much data in DL buffer dropped %zu bytes",
                      drop_bytes);
     }
 
     pa_assert_fp((pa_memblockq_get_length(u->dl_memblockq) % u->dl_frame_size) == 0);
 
-    if (util_memblockq_to_chunk(u->core->mempool, u->dl_memblockq, chunk, u->dl_frame_size)) {
-        ONDEBUG_TOKENS(fprintf(stderr, "d"));
-        cmtspeech_dl_sideinfo_forward(u);
+    cmtspeech_call_report_dl_depth(u, pa_memblockq_get_length(u->dl_memblockq));
+
+    n = (unsigned) (PA_MIN(want, pa_memblockq_get_length(u->dl_memblockq)) / u->dl_frame_size);
+
+    if (n > 0 && util_memblockq_to_chunk(u->core->mempool, u->dl_memblockq, chunk, n * u->dl_frame_size)) {
+        CMTSPEECH_TRACE3(dl_pop, pa_rtclock_now(), pa_memblockq_get_length(u->dl_memblockq), n);
+        if (u->dl_resampler)
+            cmtspeech_resampler_chunk(u->dl_resampler, u->core->mempool, chunk);
+        /* The head of a partly rewound frame was played already */
+        if (u->dl_history.trim && u->dl_history.trim < chunk->length) {
+            chunk->index += u->dl_history.trim;
+            chunk->length -= u->dl_history.trim;
+        }
+        u->dl_history.trim = 0;
+        while (n--)
+            cmtspeech_dl_sideinfo_forward(u);
+        u->dl_underruns = 0;
+        cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_DL_POP,
+                                      cmtspeech_dl_queue_length(u->cmt_connection.dl_frame_queue),
+                                      pa_memblockq_get_length(u->dl_memblockq), (uint32_t) queue_counter);
     }
     else {
-        if (u->cmt_connection.first_dl_frame_received)
+        /* Silence for all of the frames asked for */
+        if (u->cmt_connection.first_dl_frame_received) {
             pa_log_debug("No DL audio: %zu bytes in queue %zu needed",
                          pa_memblockq_get_length(u->dl_memblockq), u->dl_frame_size);
-        cmtspeech_dl_sideinfo_bogus(u);
+            u->dl_underruns++;
+            cmtspeech_stats_inc(u->stats, CMTSPEECH_STATS_DL_UNDERRUNS);
+            pa_atomic_add(&u->call_metrics.dl_silent_frames, (int) frames);
+            CMTSPEECH_TRACE3(dl_underrun, pa_rtclock_now(), pa_memblockq_get_length(u->dl_memblockq), u->dl_underruns);
+            cmtspeech_flight_recorder_log(u->flight_recorder, CMTSPEECH_FR_DL_UNDERRUN,
+                                          cmtspeech_dl_queue_length(u->cmt_connection.dl_frame_queue),
+                                          pa_memblockq_get_length(u->dl_memblockq), u->dl_underruns);
+            if (u->dl_underruns == CMTSPEECH_FR_UNDERRUN_BURST)
+                cmtspeech_flight_recorder_request_dump(u, CMTSPEECH_FR_DUMP_UNDERRUN);
+            /* Let the next DL frame replace the silence the sink has
+             * not played yet */
+            if (u->dl_history.max)
+                pa_atomic_store(&u->cmt_connection.dl_rewrite, 1);
+        }
+        for (n = 0; n < frames; n++) {
+            cmtspeech_dl_history_add(u, CMTSPEECH_DL_HISTORY_SILENCE);
+            cmtspeech_dl_sideinfo_bogus(u);
+        }
+        if (u->dl_resampler)
+            cmtspeech_resampler_silence(u->dl_resampler, frames);
         pa_silence_memchunk_get(&u->core->silence_cache,
                                 u->core->mempool,
                                 chunk,
-                                &u->ss,
-                                u->dl_frame_size);
+                                &i->sample_spec,
+                                frames * stream_frame_size);
     }
 
+    cmtspeech_stats_publish_dl(u, cmtspeech_dl_queue_length(u->cmt_connection.dl_frame_queue));
+
     return 0;
 }
 
 /* Called from I/O thread context */
 static void cmtspeech_sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     struct userdata *u;
+    struct cmtspeech_dl_history *h;
+    size_t stream_frame_size, partial;
+    unsigned frames, requeued = 0, silent = 0;
 
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
+    h = &u->dl_history;
 
     if (!PA_SINK_INPUT_IS_LINKED(i->thread_info.state))
         return;
 
-    pa_log_debug("%s rewound %zu bytes", i->sink->name, nbytes);
+    if (nbytes == 0)
+        return;
+
+    /* The render queue moves back by all of nbytes. A partly rewound
+     * frame is served again and the part of it still played trimmed,
+     * or for silence only the rewound part of it is played. */
+    stream_frame_size = u->dl_frame_size * (i->sample_spec.rate / u->ss.rate);
+    frames = (unsigned) ((nbytes + stream_frame_size - 1) / stream_frame_size);
+    partial = nbytes % stream_frame_size;
+    if (frames > h->len) {
+        frames = h->len;
+        partial = 0;
+    }
+    h->trim = 0;
+    h->pad = 0;
+
+    /* Silence is not in the memblockq, only the DL frames are put back */
+    while (frames--) {
+        unsigned int entry;
+
+        h->pos = (h->pos + CMTSPEECH_DL_HISTORY_MAX - 1) % CMTSPEECH_DL_HISTORY_MAX;
+        h->len--;
+        entry = h->entry[h->pos];
+        if (entry == CMTSPEECH_DL_HISTORY_SILENCE) {
+            if (frames == 0 && partial)
+                h->pad = partial;
+            silent++;
+            continue;
+        }
+        if (frames == 0 && partial)
+            h->trim = stream_frame_size - partial;
+        h->replayed[h->replay++] = entry;
+        requeued++;
+    }
+
+    if (requeued > 0)
+        pa_memblockq_rewind(u->dl_memblockq, requeued * u->dl_frame_size);
+
+    /* Start the voice sink frame merge over, the filter history goes
+     * back to what it was at the rewind point */
+    u->dl_sideinfo_pos = 0;
+    if (u->dl_resampler && !cmtspeech_resampler_rewind(u->dl_resampler, requeued + silent))
+        pa_log_debug("DL resampler history not kept for %u frames, restarted", requeued + silent);
+
+    h->rewinds++;
+    h->rewritten += silent;
+
+    pa_log_debug("%s rewound %zu bytes, %u DL frames requeued, %u silent frames dropped",
+                 i->sink->name, nbytes, requeued, silent);
 }
 
 /* Called from I/O thread context */
 static void cmtspeech_sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
     struct userdata *u;
+    struct cmtspeech_dl_history *h;
+    size_t stream_frame_size;
 
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
+    h = &u->dl_history;
 
     if (!PA_SINK_INPUT_IS_LINKED(i->thread_info.state))
         return;
 
-    pa_log_debug("Max rewind of %s updated to %zu bytes", i->sink->name, nbytes);
+    /* Keep the served frames in the memblockq history for rewinds. The
+     * frames are pushed as copies while rewinds are possible. */
+    stream_frame_size = u->dl_frame_size * (i->sample_spec.rate / u->ss.rate);
+    h->max = (unsigned) PA_MIN(nbytes / stream_frame_size, (size_t) CMTSPEECH_DL_HISTORY_MAX);
+    if (h->len > h->max)
+        h->len = h->max;
+    pa_memblockq_set_maxrewind(u->dl_memblockq, h->max * u->dl_frame_size);
+
+    pa_log_debug("Max rewind of %s updated to %zu bytes, %u DL frames kept",
+                 i->sink->name, nbytes, h->max);
 }
 
 /* Called from I/O thread context */
@@ -258,7 +550,11 @@ static void cmtspeech_sink_input_reset_dl_stream(struct userdata *u) {
     /* Flush all DL buffers */
     pa_memblockq_flush_read(u->dl_memblockq);
     cmtspeech_dl_sideinfo_flush(u);
-    while ((buf = pa_asyncq_pop(u->cmt_connection.dl_frame_queue, false))) {
+    cmtspeech_dl_history_reset(u);
+    u->dl_underruns = 0;
+    if (u->dl_resampler)
+        cmtspeech_resampler_reset(u->dl_resampler);
+    while ((buf = cmtspeech_dl_queue_pop(u->cmt_connection.dl_frame_queue))) {
         pa_memchunk cmtchunk;
         if (0 == cmtspeech_buffer_to_memchunk(u, buf, &cmtchunk))
             pa_memblock_unref(cmtchunk.memblock);
@@ -273,6 +569,7 @@ static void cmtspeech_sink_input_detach_cb(pa_sink_input *i) {
     pa_assert_se(u = i->userdata);
 
     u->sink = NULL;
+
     u->voice_sideinfoq = NULL;
 
     cmtspeech_sink_input_reset_dl_stream(u);
@@ -306,6 +603,33 @@ static void cmtspeech_sink_input_state_change_cb(pa_sink_input *i, pa_sink_input
     pa_assert_se(u = i->userdata);
 
     pa_log_debug("State changed %d -> %d", i->thread_info.state, state);
+
+    if (state == PA_SINK_INPUT_CORKED && !u->fast_cork) {
+        cmtspeech_dl_phase_log(u);
+        cmtspeech_dl_phase_reset(u);
+        cmtspeech_dl_history_log(u);
+        if (u->dl_agc) {
+            cmtspeech_agc_log(u->dl_agc);
+            cmtspeech_agc_reset(u->dl_agc);
+        }
+    }
+}
+
+/* DL held in front of the sink input render queue: frames waiting in
+ * the DL asyncq, the dl_memblockq and the rate converter.
+ * Called from I/O thread context */
+static pa_usec_t cmtspeech_sink_input_dl_latency(struct userdata *u) {
+    pa_usec_t usec = 0;
+
+    if (u->cmt_connection.dl_frame_queue)
+        usec += cmtspeech_dl_queue_length(u->cmt_connection.dl_frame_queue) * u->frame_usec;
+
+    usec += pa_bytes_to_usec(pa_memblockq_get_length(u->dl_memblockq), &u->ss);
+
+    if (u->dl_resampler)
+        usec += cmtspeech_resampler_delay(u->dl_resampler);
+
+    return usec;
 }
 
 /* Called from I/O thread context */
@@ -321,6 +645,20 @@ static int cmtspeech_sink_input_process_msg(pa_msgobject *o, int code, void *use
             cmtspeech_sink_input_reset_dl_stream(u);
             pa_log_info("PA_SINK_INPUT_MESSAGE_FLUSH_DL handled");
             return 0;
+
+        case PA_SINK_INPUT_MESSAGE_REWRITE_DL: {
+            unsigned silent = cmtspeech_dl_history_silent(u);
+
+            if (silent > 0 && PA_SINK_INPUT_IS_LINKED(i->thread_info.state))
+                pa_sink_input_request_rewind(i, silent * u->dl_frame_size * (i->sample_spec.rate / u->ss.rate),
+                                             true, false, false);
+            return 0;
+        }
+
+        case PA_SINK_INPUT_MESSAGE_GET_LATENCY:
+            /* The generic handler adds the render queue and the sink */
+            *((pa_usec_t *) userdata) += cmtspeech_sink_input_dl_latency(u);
+            break;
     }
 
     return pa_sink_input_process_msg(o, code, userdata, offset, chunk);
@@ -370,8 +708,20 @@ static bool cmtspeech_sink_input_may_move_to_cb(pa_sink_input *i, pa_sink *dest)
     return true;
 }
 
+/* Called from main context */
+void cmtspeech_sink_input_free_resampler(struct userdata *u) {
+    pa_assert(u);
+
+    if (u->dl_resampler) {
+        cmtspeech_resampler_free(u->dl_resampler);
+        u->dl_resampler = NULL;
+    }
+}
+
 int cmtspeech_create_sink_input(struct userdata *u) {
     pa_sink_input_new_data data;
+    pa_sample_spec ss;
+    unsigned factor;
     char t[256];
 
     pa_assert(u);
@@ -391,6 +741,19 @@ int cmtspeech_create_sink_input(struct userdata *u) {
     if (cmtspeech_check_sink_api(u->sink))
         return 3;
 
+    cmtspeech_sink_input_free_resampler(u);
+
+    /* Run at the sink rate when we can convert it ourselves, so that the
+     * sink does not need a resampler for us */
+    ss = u->ss;
+    factor = u->internal_resampler ? cmtspeech_resampler_factor(u->sink->sample_spec.rate) : 0;
+    if (factor > 1) {
+        ss.rate = u->sink->sample_spec.rate;
+        /* One run per DL frame, as far back as the DL history goes */
+        u->dl_resampler = cmtspeech_resampler_new(factor, true, (unsigned) (u->dl_frame_size / sizeof(int16_t)),
+                                                  CMTSPEECH_DL_HISTORY_MAX);
+    }
+
     pa_sink_input_new_data_init(&data);
     data.driver = __FILE__;
     data.module = u->module;
@@ -401,15 +764,18 @@ int cmtspeech_create_sink_input(struct userdata *u) {
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_ROLE, t);
     snprintf(t, sizeof(t), "cmtspeech module");
     pa_proplist_sets(data.proplist, PA_PROP_APPLICATION_NAME, t);
-    pa_sink_input_new_data_set_sample_spec(&data, &u->ss);
+    pa_sink_input_new_data_set_sample_spec(&data, &ss);
     pa_sink_input_new_data_set_channel_map(&data, &u->map);
-    data.flags = PA_SINK_INPUT_DONT_MOVE|PA_SINK_INPUT_START_CORKED;
+    data.flags = PA_SINK_INPUT_DONT_MOVE;
+    if (!u->fast_cork)
+        data.flags |= PA_SINK_INPUT_START_CORKED;
 
     pa_sink_input_new(&u->sink_input, u->core, &data);
     pa_sink_input_new_data_done(&data);
 
     if (!u->sink_input) {
         pa_log_warn("Creating cmtspeech sink input failed");
+        cmtspeech_sink_input_free_resampler(u);
         return -1;
     }
 
@@ -429,7 +795,7 @@ int cmtspeech_create_sink_input(struct userdata *u) {
 
     pa_sink_input_put(u->sink_input);
 
-    pa_log_info("cmtspeech sink-input created");
+    pa_log_info("cmtspeech sink-input created at %u Hz", ss.rate);
 
     return 0;
 }
@@ -447,5 +813,7 @@ void cmtspeech_delete_sink_input(struct userdata *u) {
     pa_sink_input_unref(u->sink_input);
     u->sink_input = NULL;
 
+    cmtspeech_sink_input_free_resampler(u);
+
     pa_log_info("cmtspeech sink-input deleted");
 }
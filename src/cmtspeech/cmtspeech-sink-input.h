@@ -24,9 +24,11 @@
 
 enum {
     PA_SINK_INPUT_MESSAGE_FLUSH_DL = PA_SINK_INPUT_MESSAGE_MAX + 1,
+    PA_SINK_INPUT_MESSAGE_REWRITE_DL,
 };
 
 int cmtspeech_create_sink_input(struct userdata *u);
 void cmtspeech_delete_sink_input(struct userdata *u);
+void cmtspeech_sink_input_free_resampler(struct userdata *u);
 
 #endif //voice_hw_sink_input_h
@@ -25,29 +25,77 @@
 #endif
 
 #include <pulsecore/namereg.h>
+#include <pulse/rtclock.h>
 
 #include "module-meego-cmtspeech.h"
 #include <meego/module-voice-api.h>
 #include "memory.h"
 #include "cmtspeech-source-output.h"
 #include "cmtspeech-connection.h"
+#include "cmtspeech-ul-drift.h"
+#include "cmtspeech-resampler.h"
+#include "cmtspeech-ul-preroll.h"
 
 /* Called from thread context */
 static void cmtspeech_source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
     struct userdata *u;
     uint8_t *buf;
+    size_t offset;
+    pa_usec_t now;
+    bool hold = false;
 
     pa_assert(o);
     pa_assert_se(u = o->userdata);
 
-    if (chunk->length != u->ul_frame_size) {
+    if (!pa_atomic_load(&u->cmt_connection.ul_active)) {
+        if (u->ul_started && u->fast_cork) {
+            cmtspeech_ul_drift_log(u);
+            if (u->ul_preroll)
+                cmtspeech_ul_preroll_log(u->ul_preroll);
+        }
+        u->ul_started = false;
+        if (u->fast_cork) {
+            /* Keep the last frames for when UL starts */
+            if (!u->ul_preroll)
+                return;
+            hold = true;
+        }
+    } else if (!u->ul_started) {
+        uint32_t start = (uint32_t) pa_atomic_load(&u->cmt_connection.ul_start_time);
+
+        u->ul_started = true;
+        pa_log_info("UL started in source IO thread %0.1f ms after speech start (%s)",
+                    (double) ((uint32_t) pa_rtclock_now() - start) / PA_USEC_PER_MSEC,
+                    u->fast_cork ? "fast cork" : "corked");
+    }
+
+    /* The voice source pushes its own frames, which may hold several
+     * shorter modem frames */
+    if (chunk->length == 0 || chunk->length % u->ul_stream_frame_size) {
         pa_log_warn("Pushed UL audio frame has wrong size %zu", chunk->length);
         return;
     }
 
+    now = pa_rtclock_now();
+    if (!hold)
+        cmtspeech_ul_drift_update(u, now);
+
     buf = ((uint8_t *) pa_memblock_acquire(chunk->memblock)) + chunk->index;
 
-    (void)cmtspeech_send_ul_frame(u, buf, chunk->length);
+    for (offset = 0; offset < chunk->length; offset += u->ul_stream_frame_size) {
+        uint8_t *frame = buf + offset;
+
+        if (u->ul_resampler) {
+            cmtspeech_resampler_run(u->ul_resampler, u->ul_resample_buf, (const int16_t *) (buf + offset),
+                                    (unsigned) (u->ul_stream_frame_size / sizeof(int16_t)));
+            frame = (uint8_t *) u->ul_resample_buf;
+        }
+
+        if (hold)
+            cmtspeech_ul_preroll_hold(u->ul_preroll, frame, now);
+        else
+            (void)cmtspeech_ul_preroll_send(u, frame, now);
+    }
 
     pa_memblock_release(chunk->memblock);
 }
@@ -60,6 +108,7 @@ static void cmtspeech_source_output_detach_cb(pa_source_output *o) {
     pa_assert_se(u = o->userdata);
 
     u->source = NULL;
+    u->ul_drift.deadline_valid = false;
 
     pa_log_debug("CMT source output detach called");
 }
@@ -73,6 +122,12 @@ static void cmtspeech_source_output_attach_cb(pa_source_output *o) {
 
     pa_assert(u->source == o->source);
 
+    cmtspeech_ul_drift_reset(u);
+    if (u->ul_resampler)
+        cmtspeech_resampler_reset(u->ul_resampler);
+    if (u->ul_preroll)
+        cmtspeech_ul_preroll_reset(u->ul_preroll);
+
     pa_log_debug("CMT source output connected to %s", o->source->name);
 }
 
@@ -84,6 +139,39 @@ static void cmtspeech_source_output_state_change_cb(pa_source_output *o, pa_sour
     pa_assert_se(u = o->userdata);
 
     pa_log_debug("State changed %d -> %d", o->thread_info.state, state);
+
+    if (state == PA_SOURCE_OUTPUT_CORKED && o->thread_info.state == PA_SOURCE_OUTPUT_RUNNING) {
+        cmtspeech_ul_drift_log(u);
+        if (u->ul_preroll)
+            cmtspeech_ul_preroll_log(u->ul_preroll);
+    }
+}
+
+/* Called from I/O thread context */
+static int cmtspeech_source_output_process_msg(pa_msgobject *mo, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
+    struct userdata *u;
+    pa_source_output *o = PA_SOURCE_OUTPUT(mo);
+    pa_source_output_assert_ref(o);
+
+    pa_assert_se(u = o->userdata);
+
+    switch (code) {
+        case PA_SOURCE_OUTPUT_MESSAGE_UL_DEADLINE:
+            cmtspeech_ul_drift_set_deadline(u, (pa_usec_t) offset);
+            return 0;
+
+        case PA_SOURCE_OUTPUT_MESSAGE_GET_LATENCY:
+            /* UL still to reach the modem, the generic handler adds the
+             * source */
+            *((pa_usec_t *) userdata) += cmtspeech_ul_drift_latency(u);
+            if (u->ul_preroll)
+                *((pa_usec_t *) userdata) += cmtspeech_ul_preroll_latency(u->ul_preroll);
+            if (u->ul_resampler)
+                *((pa_usec_t *) userdata) += cmtspeech_resampler_delay(u->ul_resampler);
+            break;
+    }
+
+    return pa_source_output_process_msg(mo, code, userdata, offset, chunk);
 }
 
 /* Called from main context */
@@ -129,9 +217,24 @@ static bool cmtspeech_source_output_may_move_to_cb(pa_source_output *o, pa_sourc
   return true;
 }
 
+/* Called from main context */
+void cmtspeech_source_output_free_resampler(struct userdata *u) {
+    pa_assert(u);
+
+    if (u->ul_resampler) {
+        cmtspeech_resampler_free(u->ul_resampler);
+        u->ul_resampler = NULL;
+    }
+
+    pa_xfree(u->ul_resample_buf);
+    u->ul_resample_buf = NULL;
+}
+
 int cmtspeech_create_source_output(struct userdata *u)
 {
     pa_source_output_new_data data;
+    pa_sample_spec ss;
+    unsigned factor;
     char t[256];
 
     pa_assert(u);
@@ -151,6 +254,19 @@ int cmtspeech_create_source_output(struct userdata *u)
     if (cmtspeech_check_source_api(u->source))
         return 3;
 
+    cmtspeech_source_output_free_resampler(u);
+
+    /* Run at the source rate when we can convert it ourselves */
+    ss = u->ss;
+    factor = u->internal_resampler ? cmtspeech_resampler_factor(u->source->sample_spec.rate) : 0;
+    u->ul_stream_frame_size = u->ul_frame_size;
+    if (factor > 1) {
+        ss.rate = u->source->sample_spec.rate;
+        u->ul_stream_frame_size = u->ul_frame_size * factor;
+        u->ul_resampler = cmtspeech_resampler_new(factor, false, (unsigned) (u->ul_stream_frame_size / sizeof(int16_t)), 0);
+        u->ul_resample_buf = pa_xmalloc(u->ul_frame_size);
+    }
+
     pa_source_output_new_data_init(&data);
     data.driver = __FILE__;
     data.module = u->module;
@@ -161,18 +277,22 @@ int cmtspeech_create_source_output(struct userdata *u)
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_ROLE, t);
     snprintf(t, sizeof(t), "cmtspeech module");
     pa_proplist_sets(data.proplist, PA_PROP_APPLICATION_NAME, t);
-    pa_source_output_new_data_set_sample_spec(&data, &u->ss);
+    pa_source_output_new_data_set_sample_spec(&data, &ss);
     pa_source_output_new_data_set_channel_map(&data, &u->map);
-    data.flags = PA_SOURCE_OUTPUT_DONT_MOVE|PA_SOURCE_OUTPUT_START_CORKED;
+    data.flags = PA_SOURCE_OUTPUT_DONT_MOVE;
+    if (!u->fast_cork)
+        data.flags |= PA_SOURCE_OUTPUT_START_CORKED;
 
     pa_source_output_new(&u->source_output, u->core, &data);
     pa_source_output_new_data_done(&data);
 
     if (!u->source_output) {
         pa_log("Creating cmtspeech source output failed");
+        cmtspeech_source_output_free_resampler(u);
         return -1;
     }
 
+    u->source_output->parent.process_msg = cmtspeech_source_output_process_msg;
     u->source_output->push = cmtspeech_source_output_push_cb;
     u->source_output->kill = cmtspeech_source_output_kill_cb;
     u->source_output->attach = cmtspeech_source_output_attach_cb;
@@ -184,7 +304,7 @@ int cmtspeech_create_source_output(struct userdata *u)
 
     pa_source_output_put(u->source_output);
 
-    pa_log_info("cmtspeech source-output created");
+    pa_log_info("cmtspeech source-output created at %u Hz", ss.rate);
 
     return 0;
 }
@@ -202,5 +322,7 @@ void cmtspeech_delete_source_output(struct userdata *u) {
     pa_source_output_unref(u->source_output);
     u->source_output = NULL;
 
+    cmtspeech_source_output_free_resampler(u);
+
     pa_log_info("cmtspeech source-output deleted");
 }
@@ -28,7 +28,12 @@
 #include <pulsecore/source.h>
 #include <pulsecore/source-output.h>
 
+enum {
+    PA_SOURCE_OUTPUT_MESSAGE_UL_DEADLINE = PA_SOURCE_OUTPUT_MESSAGE_MAX + 1,
+};
+
 int cmtspeech_create_source_output(struct userdata *u);
 void cmtspeech_delete_source_output(struct userdata *u);
+void cmtspeech_source_output_free_resampler(struct userdata *u);
 
 #endif //voice_hw_source_output_h
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_stats_shm_h
+#define cmtspeech_stats_shm_h
+
+/* Layout of the statistics page shared with cmtspeech-stats. Only
+ * plain C types here, the reader does not link against PulseAudio.
+ *
+ * Counters only grow and are updated with atomic increments. Each gauge
+ * block has a single writer thread and a sequence count: it is odd
+ * while the block is being written, so a reader retries until it reads
+ * the same even count before and after copying the block. */
+
+#include <stdint.h>
+
+#define CMTSPEECH_STATS_MAGIC        (0x434d5453)       /* "CMTS" */
+#define CMTSPEECH_STATS_VERSION      (3)
+#define CMTSPEECH_STATS_SHM_DEFAULT  "/cmtspeech-stats"
+
+enum cmtspeech_stats_counter {
+    CMTSPEECH_STATS_DL_FRAMES,
+    CMTSPEECH_STATS_DL_QUEUE_OVERFLOWS,
+    CMTSPEECH_STATS_DL_UNDERRUNS,
+    CMTSPEECH_STATS_DL_DROPS,
+    CMTSPEECH_STATS_DL_SIDEINFO_MISMATCHES,
+    CMTSPEECH_STATS_UL_FRAMES,
+    CMTSPEECH_STATS_UL_ACQUIRE_FAILURES,
+    CMTSPEECH_STATS_UL_RELEASE_FAILURES,
+    CMTSPEECH_STATS_MODEM_RESETS,
+    CMTSPEECH_STATS_CALLS,
+    CMTSPEECH_STATS_DL_WRAPPER_COPIES,
+    CMTSPEECH_STATS_COUNTER_MAX
+};
+
+#define CMTSPEECH_STATS_COUNTER_NAMES {     \
+    "dl_frames",                            \
+    "dl_queue_overflows",                   \
+    "dl_underruns",                         \
+    "dl_drops",                             \
+    "dl_sideinfo_mismatches",               \
+    "ul_frames",                            \
+    "ul_acquire_failures",                  \
+    "ul_release_failures",                  \
+    "modem_resets",                         \
+    "calls",                                \
+    "dl_wrapper_copies",                    \
+}
+
+/* Room for new counters without changing the layout */
+#define CMTSPEECH_STATS_COUNTER_SLOTS (32)
+
+/* Call state bits */
+#define CMTSPEECH_STATS_CALL_UL         (1 << 0)
+#define CMTSPEECH_STATS_CALL_DL         (1 << 1)
+#define CMTSPEECH_STATS_CALL_EMERGENCY  (1 << 2)
+#define CMTSPEECH_STATS_PLAYBACK        (1 << 3)
+#define CMTSPEECH_STATS_RECORD          (1 << 4)
+#define CMTSPEECH_STATS_STREAMS         (1 << 5)
+#define CMTSPEECH_STATS_MODEM_OPEN      (1 << 6)
+
+/* Written by the sink IO-thread on every pop */
+struct cmtspeech_stats_dl {
+    uint32_t seq;
+    uint32_t queue_frames;              /* modem frames waiting for pop */
+    uint32_t buffer_bytes;              /* dl_memblockq length */
+    uint32_t underrun_run;              /* consecutive underruns */
+    int32_t phase_usec;                 /* smoothed DL arrival to pop */
+};
+
+/* Written by the cmtspeech thread on every wakeup */
+struct cmtspeech_stats_connection {
+    uint32_t seq;
+    uint32_t state;                     /* CMTSPEECH_STATS_* bits */
+    uint32_t wakeup_max_usec;
+    uint32_t wakeup_late;
+    uint32_t watchdog_level;
+    uint32_t watchdog_stalls;
+    int32_t drift_ppm_q8;               /* modem clock drift, ppm << 8 */
+    int32_t drift_err_q8;               /* its standard error, INT32_MAX when unknown */
+    int32_t ntf_ppm_q8;                 /* drift from timing notifications, INT32_MAX when unknown */
+};
+
+struct cmtspeech_stats_page {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                      /* sizeof(struct cmtspeech_stats_page) */
+    uint32_t pid;
+    uint32_t n_counters;
+    uint32_t counters[CMTSPEECH_STATS_COUNTER_SLOTS];
+    struct cmtspeech_stats_dl dl;
+    struct cmtspeech_stats_connection connection;
+};
+
+#endif /* cmtspeech_stats_shm_h */
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/memblockq.h>
+
+#include "cmtspeech-stats.h"
+#include "cmtspeech-drift.h"
+
+/* Live call path statistics in a POSIX shared memory page
+ *
+ * The page <name>-<pid> is created when the module loads and unlinked
+ * when it is unloaded. It is readable by the daemon user only. The
+ * realtime threads never make system calls or take locks for it, they
+ * only increment counters and rewrite their gauge block. */
+
+struct cmtspeech_stats {
+    char *name;
+    struct cmtspeech_stats_page *page;
+};
+
+/* Main thread */
+cmtspeech_stats *cmtspeech_stats_new(const char *prefix) {
+    cmtspeech_stats *s;
+    struct cmtspeech_stats_page *page;
+    char *name;
+    int fd;
+
+    pa_assert(prefix);
+
+    name = pa_sprintf_malloc("%s-%u", prefix, (unsigned) getpid());
+
+    /* A page of ours left behind by an earlier daemon with this pid */
+    shm_unlink(name);
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+        pa_log_warn("shm_open(%s) failed: %s, statistics disabled", name, pa_cstrerror(errno));
+        pa_xfree(name);
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(*page)) < 0) {
+        pa_log_warn("ftruncate() of %s failed: %s, statistics disabled", name, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (page == MAP_FAILED) {
+        pa_log_warn("mmap() of %s failed: %s, statistics disabled", name, pa_cstrerror(errno));
+        goto fail;
+    }
+    close(fd);
+
+    memset(page, 0, sizeof(*page));
+    page->version = CMTSPEECH_STATS_VERSION;
+    page->size = sizeof(*page);
+    page->pid = (uint32_t) getpid();
+    page->n_counters = CMTSPEECH_STATS_COUNTER_MAX;
+    /* Readers check the magic last */
+    __sync_synchronize();
+    page->magic = CMTSPEECH_STATS_MAGIC;
+
+    s = pa_xnew0(cmtspeech_stats, 1);
+    s->name = name;
+    s->page = page;
+
+    pa_log_info("Call path statistics in shared memory %s", name);
+
+    return s;
+
+fail:
+    close(fd);
+    shm_unlink(name);
+    pa_xfree(name);
+    return NULL;
+}
+
+/* Main thread */
+void cmtspeech_stats_free(cmtspeech_stats *s) {
+    pa_assert(s);
+
+    s->page->magic = 0;
+    munmap(s->page, sizeof(*s->page));
+    shm_unlink(s->name);
+    pa_xfree(s->name);
+    pa_xfree(s);
+}
+
+/* Any thread. s is NULL when statistics are disabled. */
+void cmtspeech_stats_inc(cmtspeech_stats *s, enum cmtspeech_stats_counter counter) {
+    if (s)
+        __sync_fetch_and_add(&s->page->counters[counter], 1);
+}
+
+/* Single writer side of the seqlock */
+static inline void seq_begin(uint32_t *seq) {
+    *(volatile uint32_t *) seq = *seq + 1;
+    __sync_synchronize();
+}
+
+static inline void seq_end(uint32_t *seq) {
+    __sync_synchronize();
+    *(volatile uint32_t *) seq = *seq + 1;
+}
+
+/* Sink IO-thread */
+void cmtspeech_stats_publish_dl(struct userdata *u, unsigned queue_frames) {
+    volatile struct cmtspeech_stats_dl *dl;
+
+    pa_assert(u);
+
+    if (!u->stats)
+        return;
+
+    dl = &u->stats->page->dl;
+
+    seq_begin((uint32_t *) &dl->seq);
+    dl->queue_frames = queue_frames;
+    dl->buffer_bytes = (uint32_t) pa_memblockq_get_length(u->dl_memblockq);
+    dl->underrun_run = u->dl_underruns;
+    dl->phase_usec = (int32_t) (u->dl_phase.avg >> 4);
+    seq_end((uint32_t *) &dl->seq);
+}
+
+/* cmtspeech thread */
+void cmtspeech_stats_publish_connection(struct userdata *u) {
+    struct cmtspeech_connection *c;
+    volatile struct cmtspeech_stats_connection *s;
+    uint32_t state = 0;
+
+    pa_assert(u);
+
+    if (!u->stats)
+        return;
+
+    c = &u->cmt_connection;
+    s = &u->stats->page->connection;
+
+    if (c->call_ul)
+        state |= CMTSPEECH_STATS_CALL_UL;
+    if (c->call_dl)
+        state |= CMTSPEECH_STATS_CALL_DL;
+    if (c->call_emergency)
+        state |= CMTSPEECH_STATS_CALL_EMERGENCY;
+    if (c->playback_running)
+        state |= CMTSPEECH_STATS_PLAYBACK;
+    if (c->record_running)
+        state |= CMTSPEECH_STATS_RECORD;
+    if (c->streams_created)
+        state |= CMTSPEECH_STATS_STREAMS;
+    if (c->cmtspeech)
+        state |= CMTSPEECH_STATS_MODEM_OPEN;
+
+    seq_begin((uint32_t *) &s->seq);
+    s->state = state;
+    s->wakeup_max_usec = (uint32_t) c->wakeup_stats.max;
+    s->wakeup_late = c->wakeup_stats.late;
+    s->watchdog_level = (uint32_t) c->watchdog.level;
+    s->watchdog_stalls = c->watchdog.stalls;
+    s->drift_ppm_q8 = pa_atomic_load(&c->drift.ppm);
+    s->drift_err_q8 = pa_atomic_load(&c->drift.err);
+    s->ntf_ppm_q8 = c->drift.ntf_known ? (int32_t) lrint(c->drift.ntf_ppm * CMTSPEECH_DRIFT_Q) : INT32_MAX;
+    seq_end((uint32_t *) &s->seq);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_stats_h
+#define cmtspeech_stats_h
+
+#include "module-meego-cmtspeech.h"
+#include "cmtspeech-stats-shm.h"
+
+typedef struct cmtspeech_stats cmtspeech_stats;
+
+cmtspeech_stats *cmtspeech_stats_new(const char *name);
+void cmtspeech_stats_free(cmtspeech_stats *s);
+
+void cmtspeech_stats_inc(cmtspeech_stats *s, enum cmtspeech_stats_counter counter);
+
+void cmtspeech_stats_publish_dl(struct userdata *u, unsigned queue_frames);
+void cmtspeech_stats_publish_connection(struct userdata *u);
+
+#endif /* cmtspeech_stats_h */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "cmtspeech-timers.h"
+
+/* Timer queue of the cmtspeech thread
+ *
+ * The cmtspeech thread has a single rtpoll timer. All timed work of the
+ * thread is kept here as named absolute deadlines, and the rtpoll timer
+ * is only touched when the earliest deadline changes. All functions are
+ * called from the cmtspeech thread. */
+
+void cmtspeech_timer_set(struct cmtspeech_timers *t, enum cmtspeech_timer_id id, pa_usec_t deadline) {
+    pa_assert(t);
+    pa_assert(id < CMTSPEECH_TIMER_MAX);
+    pa_assert(deadline > 0);
+
+    t->deadline[id] = deadline;
+}
+
+void cmtspeech_timer_clear(struct cmtspeech_timers *t, enum cmtspeech_timer_id id) {
+    pa_assert(t);
+    pa_assert(id < CMTSPEECH_TIMER_MAX);
+
+    t->deadline[id] = 0;
+}
+
+bool cmtspeech_timer_armed(struct cmtspeech_timers *t, enum cmtspeech_timer_id id) {
+    pa_assert(t);
+    pa_assert(id < CMTSPEECH_TIMER_MAX);
+
+    return t->deadline[id] > 0;
+}
+
+/* Call before pa_rtpoll_run() */
+void cmtspeech_timers_program(struct cmtspeech_timers *t, pa_rtpoll *rtpoll) {
+    pa_usec_t earliest = 0;
+    unsigned i;
+
+    pa_assert(t);
+    pa_assert(rtpoll);
+
+    for (i = 0; i < CMTSPEECH_TIMER_MAX; i++)
+        if (t->deadline[i] > 0 && (earliest == 0 || t->deadline[i] < earliest))
+            earliest = t->deadline[i];
+
+    if (earliest == t->programmed && !t->stale)
+        return;
+
+    if (earliest > 0)
+        pa_rtpoll_set_timer_absolute(rtpoll, earliest);
+    else
+        pa_rtpoll_set_timer_disabled(rtpoll);
+
+    t->programmed = earliest;
+    t->stale = false;
+}
+
+/* Call after pa_rtpoll_run(). Disarms and returns a bitmask of the
+ * deadlines that have passed. */
+unsigned cmtspeech_timers_expire(struct cmtspeech_timers *t, pa_rtpoll *rtpoll, pa_usec_t now) {
+    unsigned i, expired = 0;
+
+    pa_assert(t);
+    pa_assert(rtpoll);
+
+    if (!pa_rtpoll_timer_elapsed(rtpoll))
+        return 0;
+
+    /* rtpoll keeps an elapsed timer enabled, it has to be reprogrammed
+     * even if the earliest deadline stays the same */
+    t->stale = true;
+
+    for (i = 0; i < CMTSPEECH_TIMER_MAX; i++)
+        if (t->deadline[i] > 0 && t->deadline[i] <= now) {
+            t->deadline[i] = 0;
+            expired |= 1U << i;
+        }
+
+    return expired;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_timers_h
+#define cmtspeech_timers_h
+
+#include "module-meego-cmtspeech.h"
+
+#define CMTSPEECH_TIMER_BIT(id) (1U << (id))
+
+void cmtspeech_timer_set(struct cmtspeech_timers *t, enum cmtspeech_timer_id id, pa_usec_t deadline);
+void cmtspeech_timer_clear(struct cmtspeech_timers *t, enum cmtspeech_timer_id id);
+bool cmtspeech_timer_armed(struct cmtspeech_timers *t, enum cmtspeech_timer_id id);
+
+void cmtspeech_timers_program(struct cmtspeech_timers *t, pa_rtpoll *rtpoll);
+unsigned cmtspeech_timers_expire(struct cmtspeech_timers *t, pa_rtpoll *rtpoll, pa_usec_t now);
+
+#endif /* cmtspeech_timers_h */
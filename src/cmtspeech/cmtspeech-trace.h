@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_trace_h
+#define cmtspeech_trace_h
+
+/* Static tracepoints on the DL and UL paths
+ *
+ * With sys/sdt.h available these are USDT probes of provider
+ * "cmtspeech", e.g. usdt:module-meego-cmtspeech.so:cmtspeech:dl_pop in
+ * bpftrace. Every probe has a semaphore that the tracer sets while it is
+ * attached, so when nobody traces a probe costs a nop and a predicted
+ * branch, and its arguments are not evaluated. The first argument of
+ * every probe is a pa_rtclock_now() timestamp in usec. Without
+ * sys/sdt.h the probes compile to nothing. */
+
+#define CMTSPEECH_TRACEPOINTS(X)                                        \
+    X(dl_acquire)       /* ts, DL queue length, frame bytes, spc flags */ \
+    X(dl_queue_push)    /* ts, DL queue length, dropped frames */       \
+    X(dl_queue_pop)     /* ts, DL queue length, spc flags */            \
+    X(dl_memblockq_push)/* ts, memblockq length, bytes */               \
+    X(dl_memblockq_drop)/* ts, memblockq length, bytes */               \
+    X(dl_pop)           /* ts, memblockq length, DL frames returned */  \
+    X(dl_underrun)      /* ts, memblockq length, consecutive underruns */ \
+    X(dl_sideinfo)      /* ts, voice sideinfo flags, DL frames merged */ \
+    X(ul_send)          /* ts, result, bytes, UL frame count */         \
+    X(state)            /* ts, previous state, state, message type */
+
+#ifdef HAVE_SYS_SDT_H
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define CMTSPEECH_TRACE_SEMAPHORE(name) \
+    extern volatile unsigned short cmtspeech_##name##_semaphore;
+CMTSPEECH_TRACEPOINTS(CMTSPEECH_TRACE_SEMAPHORE)
+#undef CMTSPEECH_TRACE_SEMAPHORE
+
+#define CMTSPEECH_TRACE_ENABLED(name) PA_UNLIKELY(cmtspeech_##name##_semaphore)
+
+#define CMTSPEECH_TRACE3(name, a, b, c) do {                            \
+        if (CMTSPEECH_TRACE_ENABLED(name))                              \
+            DTRACE_PROBE3(cmtspeech, name, a, b, c);                    \
+    } while (0)
+
+#define CMTSPEECH_TRACE4(name, a, b, c, d) do {                         \
+        if (CMTSPEECH_TRACE_ENABLED(name))                              \
+            DTRACE_PROBE4(cmtspeech, name, a, b, c, d);                 \
+    } while (0)
+
+#else
+
+#define CMTSPEECH_TRACE_ENABLED(name) (0)
+#define CMTSPEECH_TRACE3(name, a, b, c) do { } while (0)
+#define CMTSPEECH_TRACE4(name, a, b, c, d) do { } while (0)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* cmtspeech_trace_h */
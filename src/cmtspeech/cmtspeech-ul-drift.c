@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <meego/module-voice-api.h>
+
+#include "cmtspeech-ul-drift.h"
+#include "cmtspeech-dsp.h"
+#include "cmtspeech-drift.h"
+
+/* UL drift compensation
+ *
+ * The voice source pushes UL frames on its own clock, while the modem
+ * consumes them on the frame grid announced in CMTSPEECH_TIMING_CONFIG_NTF.
+ * We measure the slack from each push to the next modem deadline and keep
+ * the total UL latency (slack + held back samples) constant by slipping
+ * single samples in the copy to the modem buffer. The slips only shift
+ * timing within the held back samples, +-half of ul_slip_range. They do
+ * not change when the voice source pushes, so a drift that keeps going
+ * runs out of the range: at 100 ppm the default +-1 ms lasts 10 s. The
+ * actual correction is the VOICE_SOURCE_SET_UL_DEADLINE realign the voice
+ * source is asked for beyond the slip range, which is a jump in the UL
+ * audio. A wider range makes realigns rarer for more UL latency. The copy
+ * also runs the optional UL conditioning, the held back samples are kept
+ * unconditioned. */
+
+#define CMTSPEECH_UL_SLIP_RANGE_DEFAULT     (CMTSPEECH_UL_SLIP_DEFAULT * PA_USEC_PER_SEC / CMTSPEECH_SAMPLERATE)
+#define CMTSPEECH_UL_SLIP_RANGE_MIN         (2 * PA_USEC_PER_SEC / CMTSPEECH_SAMPLERATE)
+#define CMTSPEECH_UL_SLIP_RANGE_MAX         (CMTSPEECH_UL_SLIP_MAX * PA_USEC_PER_SEC / CMTSPEECH_SAMPLERATE)
+#define CMTSPEECH_UL_DRIFT_REFERENCE_FRAMES (16)
+#define CMTSPEECH_UL_DRIFT_AVG_SHIFT        (4)
+
+static int64_t ul_drift_unwrap(int64_t diff, int64_t period) {
+    if (diff > period / 2)
+        return diff - period;
+    if (diff < -period / 2)
+        return diff + period;
+    return diff;
+}
+
+/* Returns time from now to the next modem UL deadline */
+static int64_t ul_drift_slack(struct cmtspeech_ul_drift *d, pa_usec_t now, pa_usec_t period) {
+    pa_usec_t r;
+
+    if (now <= d->deadline)
+        return (int64_t) ((d->deadline - now) % period);
+
+    r = (now - d->deadline) % period;
+    return (int64_t) (r ? period - r : 0);
+}
+
+/* Sets deadline to the first modem UL deadline at or after t. Returns
+ * false when no timing notification has been seen.
+ * Called from source IO-thread */
+bool cmtspeech_ul_drift_next_deadline(struct userdata *u, pa_usec_t t, pa_usec_t *deadline) {
+    pa_assert(u);
+    pa_assert(deadline);
+
+    if (!u->ul_drift.deadline_valid)
+        return false;
+
+    *deadline = t + (pa_usec_t) ul_drift_slack(&u->ul_drift, t, u->frame_usec);
+    return true;
+}
+
+/* Called from main context, before the source output exists and after
+ * frame_usec is set */
+int cmtspeech_ul_drift_init(struct userdata *u, pa_modargs *ma) {
+    uint32_t range = CMTSPEECH_UL_SLIP_RANGE_DEFAULT;
+
+    pa_assert(u);
+    pa_assert(ma);
+
+    if (pa_modargs_get_value_u32(ma, "ul_slip_range", &range) < 0 ||
+        range < CMTSPEECH_UL_SLIP_RANGE_MIN || range > CMTSPEECH_UL_SLIP_RANGE_MAX ||
+        range >= u->frame_usec) {
+        pa_log_error("Failed to parse ul_slip_range argument, must be %u - %u usec and below frame_usec",
+                     (unsigned) CMTSPEECH_UL_SLIP_RANGE_MIN, (unsigned) CMTSPEECH_UL_SLIP_RANGE_MAX);
+        return -1;
+    }
+
+    u->ul_drift.range = (unsigned) (range * CMTSPEECH_SAMPLERATE / PA_USEC_PER_SEC);
+    cmtspeech_ul_drift_reset(u);
+
+    return 0;
+}
+
+/* Called from source IO-thread */
+void cmtspeech_ul_drift_reset(struct userdata *u) {
+    struct cmtspeech_ul_drift *d;
+
+    pa_assert(u);
+    d = &u->ul_drift;
+
+    d->reference_count = 0;
+    d->reference_slack = 0;
+    d->slack_avg = 0;
+    d->slip = 0;
+    memset(d->carry, 0, sizeof(d->carry));
+    d->carry_len = d->range / 2;
+    d->slips_dropped = 0;
+    d->slips_inserted = 0;
+    d->realigns = 0;
+
+    if (u->ul_cond)
+        cmtspeech_ul_cond_reset(u->ul_cond);
+}
+
+/* Called from source IO-thread */
+void cmtspeech_ul_drift_set_deadline(struct userdata *u, pa_usec_t deadline) {
+    struct cmtspeech_ul_drift *d;
+
+    pa_assert(u);
+    d = &u->ul_drift;
+
+    d->deadline = deadline;
+    d->deadline_valid = true;
+    d->reference_count = 0;
+}
+
+/* Called from source IO-thread */
+void cmtspeech_ul_drift_update(struct userdata *u, pa_usec_t now) {
+    struct cmtspeech_ul_drift *d;
+    const int64_t period = (int64_t) u->frame_usec;
+    int64_t slack, drift, target;
+
+    pa_assert(u);
+    d = &u->ul_drift;
+
+    if (!d->deadline_valid)
+        return;
+
+    slack = ul_drift_slack(d, now, period);
+
+    if (d->reference_count < CMTSPEECH_UL_DRIFT_REFERENCE_FRAMES) {
+        if (d->reference_count == 0)
+            d->slack_avg = slack;
+        else
+            d->slack_avg += ul_drift_unwrap(slack - d->slack_avg, period) / (d->reference_count + 1);
+
+        if (++d->reference_count == CMTSPEECH_UL_DRIFT_REFERENCE_FRAMES) {
+            d->reference_slack = d->slack_avg;
+            pa_log_debug("UL slack to modem deadline %" PRIi64 " usec", d->reference_slack);
+        }
+        d->slip = 0;
+        return;
+    }
+
+    d->slack_avg += ul_drift_unwrap(slack - d->slack_avg, period) >> CMTSPEECH_UL_DRIFT_AVG_SHIFT;
+
+    /* Positive drift means frames arrive earlier, i.e. the source runs fast
+     * and we need to hold back fewer samples. */
+    drift = d->slack_avg - d->reference_slack;
+    target = (int64_t) (d->range / 2) - drift * (int64_t) u->ss.rate / (int64_t) PA_USEC_PER_SEC;
+
+    if (target < 0 || target > (int64_t) d->range) {
+        pa_source *s = u->source_output->source;
+
+        pa_log_info("UL drift %" PRIi64 " usec beyond the +-%u usec sample slip range, realigning voice source to modem deadline",
+                    drift, (unsigned) (d->range / 2 * PA_USEC_PER_SEC / u->ss.rate));
+        if (s && PA_SOURCE_IS_LINKED(s->thread_info.state))
+            pa_asyncmsgq_post(s->asyncmsgq, PA_MSGOBJECT(s),
+                              VOICE_SOURCE_SET_UL_DEADLINE, NULL, now + slack, NULL, NULL);
+        d->reference_count = 0;
+        d->realigns++;
+        target = PA_CLAMP(target, 0, (int64_t) d->range);
+    }
+
+    if (target < (int64_t) d->carry_len)
+        d->slip = -1;
+    else if (target > (int64_t) d->carry_len)
+        d->slip = 1;
+    else
+        d->slip = 0;
+}
+
+static void ul_drift_copy_samples(struct userdata *u, int16_t *dst, const int16_t *src, unsigned n) {
+    if (u->ul_cond)
+        cmtspeech_ul_cond_copy(u->ul_cond, dst, src, n);
+    else
+        memcpy(dst, src, n * sizeof(int16_t));
+}
+
+/* Copies an UL frame to modem buffer, applying at most one sample slip.
+ * A frame too short to slip in is copied without one.
+ * Called from source IO-thread */
+void cmtspeech_ul_drift_copy(struct userdata *u, uint8_t *dst, const uint8_t *src, size_t bytes) {
+    struct cmtspeech_ul_drift *d;
+    const int16_t *in = (const int16_t *) src;
+    int16_t *out = (int16_t *) dst;
+    const int16_t *tail;
+    unsigned n, l;
+    int slip;
+
+    pa_assert(u);
+    d = &u->ul_drift;
+
+    n = bytes / sizeof(int16_t);
+    l = d->carry_len;
+
+    /* Shorter than the held back samples, pass it through as is */
+    if (n < l) {
+        static unsigned count = 0;
+        if (count++ < 10)
+            pa_log_warn("UL frame of %u samples too short for drift compensation", n);
+        ul_drift_copy_samples(u, out, in, n);
+        if (u->ul_cond)
+            cmtspeech_ul_cond_frame_done(u->ul_cond);
+        return;
+    }
+
+    /* The slip stays pending for the next frame long enough for it */
+    slip = n > d->range + 1 ? d->slip : 0;
+
+    ul_drift_copy_samples(u, out, d->carry, l);
+    ul_drift_copy_samples(u, out + l, in, n - l);
+    tail = in + n - l;
+
+    if (slip < 0 && l > 0) {
+        /* Drop one sample by merging the first two held back samples */
+        if (l > 1) {
+            d->carry[0] = (int16_t) (((int32_t) tail[0] + tail[1]) / 2);
+            memcpy(d->carry + 1, tail + 2, (l - 2) * sizeof(int16_t));
+        }
+        d->carry_len = l - 1;
+        d->slips_dropped++;
+    } else if (slip > 0 && l < d->range) {
+        /* Insert one sample between the last sent and first held back sample */
+        d->carry[0] = l > 0 ? (int16_t) (((int32_t) in[n - l - 1] + tail[0]) / 2) : in[n - 1];
+        memcpy(d->carry + 1, tail, l * sizeof(int16_t));
+        d->carry_len = l + 1;
+        d->slips_inserted++;
+    } else
+        memcpy(d->carry, tail, l * sizeof(int16_t));
+
+    if (u->ul_cond)
+        cmtspeech_ul_cond_frame_done(u->ul_cond);
+
+    if (slip)
+        d->slip = 0;
+}
+
+/* Time from a sample entering the copy to the modem taking it: the held
+ * back samples and the measured slack to the modem deadline.
+ * Called from source IO-thread */
+pa_usec_t cmtspeech_ul_drift_latency(struct userdata *u) {
+    struct cmtspeech_ul_drift *d;
+    pa_usec_t usec;
+
+    pa_assert(u);
+    d = &u->ul_drift;
+
+    usec = (pa_usec_t) d->carry_len * PA_USEC_PER_SEC / u->ss.rate;
+
+    if (d->deadline_valid && d->reference_count > 0 && d->slack_avg > 0)
+        usec += (pa_usec_t) d->slack_avg;
+
+    return usec;
+}
+
+/* The slips follow the voice source clock against the modem, the
+ * modem clock against the host is estimated from DL arrivals.
+ * Called from source IO-thread */
+void cmtspeech_ul_drift_log(struct userdata *u) {
+    struct cmtspeech_ul_drift *d;
+    double ppm, err;
+
+    pa_assert(u);
+    d = &u->ul_drift;
+
+    if (cmtspeech_drift_get(&u->cmt_connection.drift, &ppm, &err))
+        pa_log_info("UL drift: %u samples dropped, %u inserted (timing within the slip range), "
+                    "%u realigns to modem deadline, modem clock %+0.1f ppm (+-%0.1f)",
+                    d->slips_dropped, d->slips_inserted, d->realigns, ppm, err);
+    else
+        pa_log_info("UL drift: %u samples dropped, %u inserted (timing within the slip range), "
+                    "%u realigns to modem deadline",
+                    d->slips_dropped, d->slips_inserted, d->realigns);
+}
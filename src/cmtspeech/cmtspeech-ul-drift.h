@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_ul_drift_h
+#define cmtspeech_ul_drift_h
+
+#include <pulsecore/modargs.h>
+
+#include "module-meego-cmtspeech.h"
+
+int cmtspeech_ul_drift_init(struct userdata *u, pa_modargs *ma);
+void cmtspeech_ul_drift_reset(struct userdata *u);
+void cmtspeech_ul_drift_set_deadline(struct userdata *u, pa_usec_t deadline);
+bool cmtspeech_ul_drift_next_deadline(struct userdata *u, pa_usec_t t, pa_usec_t *deadline);
+void cmtspeech_ul_drift_update(struct userdata *u, pa_usec_t now);
+void cmtspeech_ul_drift_copy(struct userdata *u, uint8_t *dst, const uint8_t *src, size_t bytes);
+pa_usec_t cmtspeech_ul_drift_latency(struct userdata *u);
+void cmtspeech_ul_drift_log(struct userdata *u);
+
+#endif /* cmtspeech_ul_drift_h */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+
+#include "cmtspeech-ul-preroll.h"
+#include "cmtspeech-connection.h"
+#include "cmtspeech-ul-drift.h"
+
+/* UL preroll
+ *
+ * UL frames that come before the modem takes UL are held in a small
+ * ring instead of being thrown away: in fast cork mode before ul_active
+ * is set, and in both modes while the modem is not active yet. When the
+ * modem takes UL the held frames are either sent ahead of the live
+ * frame or dropped on purpose. Frames older than the ring span are
+ * stale and never sent.
+ *
+ * The modem takes one UL frame per deadline, so every held frame sent
+ * ahead of live audio delays UL for the rest of the call. Only as many
+ * held frames are sent as there were modem UL deadlines between the UL
+ * start and the deadline of the live frame, the newest ones. Without a
+ * deadline from CMTSPEECH_TIMING_CONFIG_NTF none are sent. The preroll
+ * is off by default. */
+
+#define CMTSPEECH_UL_PREROLL_DEFAULT_FRAMES (0)
+#define CMTSPEECH_UL_PREROLL_MAX_FRAMES     (16)
+
+struct cmtspeech_ul_preroll {
+    size_t frame_size;
+    pa_usec_t frame_usec;
+    unsigned size;                      /* frames */
+    bool send;                          /* send held frames, drop otherwise */
+    uint8_t *data;
+    pa_usec_t *stamp;                   /* when each frame was held */
+    unsigned head;                      /* oldest frame */
+    unsigned len;
+    unsigned sent;
+    unsigned dropped;
+};
+
+/* Main thread */
+int cmtspeech_ul_preroll_new(pa_modargs *ma, size_t frame_size, pa_usec_t frame_usec, cmtspeech_ul_preroll **preroll) {
+    cmtspeech_ul_preroll *p;
+    uint32_t frames = CMTSPEECH_UL_PREROLL_DEFAULT_FRAMES;
+    const char *policy;
+
+    pa_assert(ma);
+    pa_assert(preroll);
+
+    *preroll = NULL;
+
+    if (pa_modargs_get_value_u32(ma, "ul_preroll_frames", &frames) < 0 ||
+        frames > CMTSPEECH_UL_PREROLL_MAX_FRAMES) {
+        pa_log_error("Failed to parse ul_preroll_frames argument, must be 0 - %d",
+                     CMTSPEECH_UL_PREROLL_MAX_FRAMES);
+        return -1;
+    }
+
+    policy = pa_modargs_get_value(ma, "ul_preroll_policy", "send");
+    if (!pa_streq(policy, "send") && !pa_streq(policy, "drop")) {
+        pa_log_error("Invalid ul_preroll_policy \"%s\"", policy);
+        return -1;
+    }
+
+    if (frames == 0)
+        return 0;
+
+    p = pa_xnew0(cmtspeech_ul_preroll, 1);
+    p->frame_size = frame_size;
+    p->frame_usec = frame_usec;
+    p->size = frames;
+    p->send = pa_streq(policy, "send");
+    p->data = pa_xmalloc(frames * frame_size);
+    p->stamp = pa_xnew0(pa_usec_t, frames);
+
+    pa_log_info("UL preroll of %u frames, held frames are %s", frames, p->send ? "sent" : "dropped");
+
+    *preroll = p;
+    return 0;
+}
+
+void cmtspeech_ul_preroll_free(cmtspeech_ul_preroll *p) {
+    pa_assert(p);
+
+    pa_xfree(p->data);
+    pa_xfree(p->stamp);
+    pa_xfree(p);
+}
+
+/* Source IO-thread */
+void cmtspeech_ul_preroll_reset(cmtspeech_ul_preroll *p) {
+    pa_assert(p);
+
+    p->head = 0;
+    p->len = 0;
+}
+
+/* Source IO-thread */
+void cmtspeech_ul_preroll_log(cmtspeech_ul_preroll *p) {
+    pa_assert(p);
+
+    if (p->sent || p->dropped)
+        pa_log_info("UL preroll: %u frames sent ahead of live audio, %u dropped", p->sent, p->dropped);
+
+    p->sent = 0;
+    p->dropped = 0;
+}
+
+/* Audio held in the ring, it waits for the modem to take UL.
+ * Source IO-thread */
+pa_usec_t cmtspeech_ul_preroll_latency(cmtspeech_ul_preroll *p) {
+    pa_assert(p);
+
+    return p->len * p->frame_usec;
+}
+
+static uint8_t *preroll_frame(cmtspeech_ul_preroll *p, unsigned i) {
+    return p->data + ((p->head + i) % p->size) * p->frame_size;
+}
+
+static void preroll_pop(cmtspeech_ul_preroll *p) {
+    p->head = (p->head + 1) % p->size;
+    p->len--;
+}
+
+/* Forget frames held before the span of the ring, the source has been
+ * quiet since */
+static void preroll_expire(cmtspeech_ul_preroll *p, pa_usec_t now) {
+    pa_usec_t span = (p->size + 1) * p->frame_usec;
+
+    while (p->len > 0 && p->stamp[p->head] + span < now)
+        preroll_pop(p);
+}
+
+static void preroll_drop_all(cmtspeech_ul_preroll *p) {
+    p->dropped += p->len;
+    cmtspeech_ul_preroll_reset(p);
+}
+
+/* Holds a modem rate frame, the oldest one gives way when full.
+ * Source IO-thread */
+void cmtspeech_ul_preroll_hold(cmtspeech_ul_preroll *p, const uint8_t *frame, pa_usec_t now) {
+    pa_assert(p);
+    pa_assert(frame);
+
+    if (p->len == p->size)
+        preroll_pop(p);
+
+    memcpy(preroll_frame(p, p->len), frame, p->frame_size);
+    p->stamp[(p->head + p->len) % p->size] = now;
+    p->len++;
+}
+
+/* Held frames that fit before the deadline of the live frame: the modem
+ * UL deadlines from the UL start up to it */
+static unsigned preroll_fit(struct userdata *u, pa_usec_t now) {
+    pa_usec_t start, first, live;
+
+    start = now - (pa_usec_t) ((uint32_t) now - (uint32_t) pa_atomic_load(&u->cmt_connection.ul_start_time));
+
+    if (!cmtspeech_ul_drift_next_deadline(u, start, &first) ||
+        !cmtspeech_ul_drift_next_deadline(u, now, &live))
+        return 0;
+
+    return (unsigned) ((live - first) / u->frame_usec);
+}
+
+/* Sends a modem rate frame, preceded by the held frames that fit when
+ * the policy is to send them. Returns like cmtspeech_send_ul_frame(),
+ * on -EAGAIN the frame is held.
+ * Source IO-thread */
+int cmtspeech_ul_preroll_send(struct userdata *u, uint8_t *frame, pa_usec_t now) {
+    cmtspeech_ul_preroll *p;
+    unsigned fit, n;
+    int res;
+
+    pa_assert(u);
+
+    if (!(p = u->ul_preroll))
+        return cmtspeech_send_ul_frame(u, frame, u->ul_frame_size);
+
+    preroll_expire(p, now);
+
+    fit = p->send ? PA_MIN(preroll_fit(u, now), p->len) : 0;
+
+    for (n = 0; n < fit; n++) {
+        res = cmtspeech_send_ul_frame(u, preroll_frame(p, p->len - fit + n), p->frame_size);
+        if (res == -EAGAIN) {
+            cmtspeech_ul_preroll_hold(p, frame, now);
+            return res;
+        }
+        /* Out of modem buffers, the live frame goes first */
+        if (res < 0)
+            break;
+        p->sent++;
+    }
+
+    /* The modem takes UL, the older held frames do not fit */
+    if (fit > 0) {
+        p->dropped += p->len - n;
+        cmtspeech_ul_preroll_reset(p);
+    }
+
+    res = cmtspeech_send_ul_frame(u, frame, u->ul_frame_size);
+    if (res == -EAGAIN) {
+        cmtspeech_ul_preroll_hold(p, frame, now);
+        return res;
+    }
+
+    /* The modem takes live audio, held frames are not sent after it */
+    if (p->len > 0)
+        preroll_drop_all(p);
+
+    return res;
+}
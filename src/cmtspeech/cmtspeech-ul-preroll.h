@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_ul_preroll_h
+#define cmtspeech_ul_preroll_h
+
+#include <pulsecore/modargs.h>
+
+#include "module-meego-cmtspeech.h"
+
+typedef struct cmtspeech_ul_preroll cmtspeech_ul_preroll;
+
+int cmtspeech_ul_preroll_new(pa_modargs *ma, size_t frame_size, pa_usec_t frame_usec, cmtspeech_ul_preroll **preroll);
+void cmtspeech_ul_preroll_free(cmtspeech_ul_preroll *p);
+void cmtspeech_ul_preroll_reset(cmtspeech_ul_preroll *p);
+void cmtspeech_ul_preroll_log(cmtspeech_ul_preroll *p);
+pa_usec_t cmtspeech_ul_preroll_latency(cmtspeech_ul_preroll *p);
+
+void cmtspeech_ul_preroll_hold(cmtspeech_ul_preroll *p, const uint8_t *frame, pa_usec_t now);
+int cmtspeech_ul_preroll_send(struct userdata *u, uint8_t *frame, pa_usec_t now);
+
+#endif /* cmtspeech_ul_preroll_h */
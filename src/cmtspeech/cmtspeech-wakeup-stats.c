@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <meego/module-voice-api.h>
+
+#include "cmtspeech-wakeup-stats.h"
+
+/* Wakeup latency self-test
+ *
+ * The modem delivers a DL frame every frame period, so the DL data
+ * wakeups of the cmtspeech thread should fall on a grid of frame
+ * periods anchored at the first DL frame. How far a wakeup lands after
+ * its grid slot is scheduling (or modem) lateness, which we collect
+ * into a histogram in the style of cyclictest. Measuring against the
+ * grid rather than the previous wakeup keeps a late wakeup from making
+ * the next one look early, and a run of late wakeups from looking on
+ * time.
+ *
+ * Late wakeups only delay arrivals, so a wakeup ahead of its slot
+ * means the grid origin was set by a late frame, and the grid moves
+ * back onto it. The modem clock drifts against ours, so once a window
+ * the grid also moves forward by the smallest lateness seen in it.
+ * Lateness beyond 3/4 of a period cannot be told from a missing frame
+ * and is counted as one. */
+
+static const pa_usec_t histogram_bounds[CMTSPEECH_WAKEUP_HISTOGRAM_SIZE - 1] = {
+    100, 250, 500, 1000, 2000, 5000, 10000
+};
+
+/* cmtspeech thread */
+void cmtspeech_wakeup_stats_reset(struct cmtspeech_wakeup_stats *w) {
+    pa_assert(w);
+
+    cmtspeech_wakeup_stats_resync(w);
+    w->max = 0;
+    w->count = 0;
+    w->late = 0;
+    memset(w->histogram, 0, sizeof(w->histogram));
+}
+
+/* The next DL frame starts a new grid.
+ * cmtspeech thread */
+void cmtspeech_wakeup_stats_resync(struct cmtspeech_wakeup_stats *w) {
+    pa_assert(w);
+
+    w->anchor = 0;
+    w->slot = 0;
+    w->window_min = (pa_usec_t) -1;
+    w->window_count = 0;
+}
+
+/* cmtspeech thread */
+void cmtspeech_wakeup_stats_dl_event(struct cmtspeech_wakeup_stats *w, pa_usec_t now) {
+    const int64_t period = (int64_t) w->period;
+    int64_t offset, missed;
+    pa_usec_t latency;
+    unsigned i;
+
+    pa_assert(w);
+    pa_assert(period > 0);
+
+    if (w->anchor == 0 || now < w->anchor) {
+        cmtspeech_wakeup_stats_resync(w);
+        w->anchor = now;
+        return;
+    }
+
+    /* Lateness against the slot after the last frame, or a later one
+     * if frames went missing */
+    offset = (int64_t) (now - w->anchor) - (int64_t) (w->slot + 1) * period;
+    if (offset < -period / 4) {
+        cmtspeech_wakeup_stats_resync(w);
+        w->anchor = now;
+        return;
+    }
+    missed = (offset + period / 4) / period;
+    if (missed > CMTSPEECH_WAKEUP_MAX_MISSED) {
+        cmtspeech_wakeup_stats_resync(w);
+        w->anchor = now;
+        return;
+    }
+    w->slot += (uint64_t) missed + 1;
+    offset -= missed * period;
+
+    if (offset < 0) {
+        w->anchor -= (pa_usec_t) -offset;
+        latency = 0;
+    } else
+        latency = (pa_usec_t) offset;
+
+    if (latency < w->window_min)
+        w->window_min = latency;
+    if (++w->window_count >= CMTSPEECH_WAKEUP_WINDOW) {
+        w->anchor += w->window_min;
+        w->window_min = (pa_usec_t) -1;
+        w->window_count = 0;
+    }
+
+    for (i = 0; i < PA_ELEMENTSOF(histogram_bounds); i++)
+        if (latency < histogram_bounds[i])
+            break;
+    w->histogram[i]++;
+    w->count++;
+
+    if (latency > w->max)
+        w->max = latency;
+
+    if (w->threshold && latency > w->threshold) {
+        if (w->late++ < 10)
+            pa_log_info("cmtspeech thread woke up %" PRIu64 " usec late for DL frame", latency);
+    }
+}
+
+/* cmtspeech thread */
+void cmtspeech_wakeup_stats_log(struct cmtspeech_wakeup_stats *w) {
+    pa_assert(w);
+
+    if (!w->count)
+        return;
+
+    pa_log_info("DL wakeup latency: %u frames, max %" PRIu64 " usec, %u over %" PRIu64 " usec",
+                w->count, w->max, w->late, w->threshold);
+    pa_log_info("DL wakeup latency histogram (usec): <100:%u <250:%u <500:%u <1000:%u <2000:%u <5000:%u <10000:%u >=10000:%u",
+                w->histogram[0], w->histogram[1], w->histogram[2], w->histogram[3],
+                w->histogram[4], w->histogram[5], w->histogram[6], w->histogram[7]);
+}
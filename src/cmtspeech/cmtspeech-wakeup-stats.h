@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_wakeup_stats_h
+#define cmtspeech_wakeup_stats_h
+
+#include "module-meego-cmtspeech.h"
+
+#define CMTSPEECH_WAKEUP_LATENCY_THRESHOLD ((pa_usec_t)(2 * PA_USEC_PER_MSEC))
+/* DL frames per window over which the grid follows the modem clock */
+#define CMTSPEECH_WAKEUP_WINDOW (50)
+/* More missing DL frames than this start a new grid */
+#define CMTSPEECH_WAKEUP_MAX_MISSED (8)
+
+void cmtspeech_wakeup_stats_reset(struct cmtspeech_wakeup_stats *w);
+void cmtspeech_wakeup_stats_resync(struct cmtspeech_wakeup_stats *w);
+void cmtspeech_wakeup_stats_dl_event(struct cmtspeech_wakeup_stats *w, pa_usec_t now);
+void cmtspeech_wakeup_stats_log(struct cmtspeech_wakeup_stats *w);
+
+#endif /* cmtspeech_wakeup_stats_h */
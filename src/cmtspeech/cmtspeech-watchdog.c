@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "cmtspeech-watchdog.h"
+
+/* DL/UL stall watchdog
+ *
+ * Runs from the cmtspeech thread timer queue while a call has speech
+ * active. DL progress is the arrival time of the last DL frame, UL
+ * progress is the number of UL frames handed to the modem. A direction
+ * that has made no progress for a full timeout is stalled, and each
+ * further timeout the stall lasts escalates the recovery by one step. */
+
+#define STALL_DL (1 << 0)
+#define STALL_UL (1 << 1)
+
+/* cmtspeech thread */
+void cmtspeech_watchdog_start(struct cmtspeech_watchdog *w, pa_usec_t now) {
+    pa_assert(w);
+
+    if (w->stall_start && w->level >= CMTSPEECH_WATCHDOG_REOPEN)
+        pa_log_notice("Watchdog: speech restored %0.1f ms after the stall started (modem reopened)",
+                      (double) (now - w->stall_start) / PA_USEC_PER_MSEC);
+
+    w->last_dl = now;
+    w->last_ul = now;
+    w->ul_running = false;
+    w->stall_start = 0;
+    w->stalled = 0;
+    w->level = 0;
+}
+
+/* cmtspeech thread */
+void cmtspeech_watchdog_stop(struct cmtspeech_watchdog *w) {
+    pa_assert(w);
+
+    if (w->stall_start && w->level < CMTSPEECH_WATCHDOG_REOPEN) {
+        pa_log_info("Watchdog: speech stopped during a stall");
+        w->stall_start = 0;
+        w->stalled = 0;
+        w->level = 0;
+    }
+
+    if (w->stalls)
+        pa_log_info("Watchdog: %u stalls so far", w->stalls);
+}
+
+/* cmtspeech thread. Returns the recovery step to take now and the time
+ * of the next check in *next. */
+enum cmtspeech_watchdog_action cmtspeech_watchdog_check(struct cmtspeech_watchdog *w, pa_usec_t now,
+                                                        unsigned ul_frames, bool ul_running,
+                                                        pa_usec_t *next) {
+    int stalled = 0;
+
+    pa_assert(w);
+    pa_assert(next);
+    pa_assert(w->timeout > 0);
+
+    if (ul_frames != w->ul_frames || (ul_running && !w->ul_running)) {
+        w->ul_frames = ul_frames;
+        w->last_ul = now;
+    }
+    w->ul_running = ul_running;
+
+    if (now >= w->last_dl + w->timeout)
+        stalled |= STALL_DL;
+    if (ul_running && now >= w->last_ul + w->timeout)
+        stalled |= STALL_UL;
+
+    if (!stalled) {
+        if (w->stall_start) {
+            pa_usec_t recovered = PA_MAX((w->stalled & STALL_DL) ? w->last_dl : 0,
+                                         (w->stalled & STALL_UL) ? w->last_ul : 0);
+
+            pa_log_notice("Watchdog: %s%s%s recovered %0.1f ms after the stall started (detected after %0.1f ms, %d recovery steps)",
+                          (w->stalled & STALL_DL) ? "DL" : "",
+                          (w->stalled & STALL_DL) && (w->stalled & STALL_UL) ? "/" : "",
+                          (w->stalled & STALL_UL) ? "UL" : "",
+                          (double) (recovered - w->stall_start) / PA_USEC_PER_MSEC,
+                          (double) (w->detected - w->stall_start) / PA_USEC_PER_MSEC,
+                          w->level);
+            w->stall_start = 0;
+            w->stalled = 0;
+            w->level = 0;
+        }
+
+        *next = w->last_dl + w->timeout;
+        if (ul_running)
+            *next = PA_MIN(*next, w->last_ul + w->timeout);
+        return CMTSPEECH_WATCHDOG_NONE;
+    }
+
+    if (!w->stall_start) {
+        w->stall_start = PA_MIN((stalled & STALL_DL) ? w->last_dl : now,
+                                (stalled & STALL_UL) ? w->last_ul : now);
+        w->detected = now;
+        w->stalls++;
+        pa_log_warn("Watchdog: %s%s%s stall detected after %0.1f ms",
+                    (stalled & STALL_DL) ? "DL" : "",
+                    (stalled & STALL_DL) && (stalled & STALL_UL) ? "/" : "",
+                    (stalled & STALL_UL) ? "UL" : "",
+                    (double) (now - w->stall_start) / PA_USEC_PER_MSEC);
+    }
+    w->stalled |= stalled;
+
+    if (w->level < CMTSPEECH_WATCHDOG_REOPEN)
+        w->level++;
+
+    *next = now + w->timeout;
+    return (enum cmtspeech_watchdog_action) w->level;
+}
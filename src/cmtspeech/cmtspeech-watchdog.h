@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+#ifndef cmtspeech_watchdog_h
+#define cmtspeech_watchdog_h
+
+#include "module-meego-cmtspeech.h"
+
+/* A timeout that rides out ordinary scheduling hiccups. The watchdog is
+ * off unless watchdog_timeout is given, since its last step ends the call. */
+#define CMTSPEECH_WATCHDOG_TIMEOUT ((pa_usec_t)(500 * PA_USEC_PER_MSEC))
+
+/* Recovery steps, taken one per timeout while the stall lasts */
+enum cmtspeech_watchdog_action {
+    CMTSPEECH_WATCHDOG_NONE = 0,
+    CMTSPEECH_WATCHDOG_FLUSH_DL,
+    CMTSPEECH_WATCHDOG_RESYNC,
+    CMTSPEECH_WATCHDOG_REOPEN,
+};
+
+void cmtspeech_watchdog_start(struct cmtspeech_watchdog *w, pa_usec_t now);
+void cmtspeech_watchdog_stop(struct cmtspeech_watchdog *w);
+
+enum cmtspeech_watchdog_action cmtspeech_watchdog_check(struct cmtspeech_watchdog *w, pa_usec_t now,
+                                                        unsigned ul_frames, bool ul_running,
+                                                        pa_usec_t *next);
+
+/* cmtspeech thread, for every DL frame */
+static inline void cmtspeech_watchdog_dl_frame(struct cmtspeech_watchdog *w, pa_usec_t now) {
+    w->last_dl = now;
+}
+
+#endif /* cmtspeech_watchdog_h */
@@ -31,10 +31,21 @@
 #include "cmtspeech-dbus.h"
 #include "cmtspeech-source-output.h"
 #include "cmtspeech-sink-input.h"
+#include "cmtspeech-wakeup-stats.h"
+#include "cmtspeech-sched.h"
+#include "cmtspeech-dl-queue.h"
+#include "cmtspeech-flight-recorder.h"
+#include "cmtspeech-watchdog.h"
+#include "cmtspeech-dsp.h"
+#include "cmtspeech-stats.h"
+#include "cmtspeech-drift.h"
+#include "cmtspeech-ul-drift.h"
+#include "cmtspeech-ul-preroll.h"
 
 #include <pulsecore/modargs.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/msgobject.h>
+#include <pulsecore/core-util.h>
 
 PA_MODULE_AUTHOR("Jyri Sarha");
 PA_MODULE_DESCRIPTION("Nokia cmtspeech module");
@@ -42,6 +53,32 @@ PA_MODULE_USAGE(
     "sink=<sink to connect to> "
     "source=<source to connect to> "
     "dbus_type=<defaults to session> "
+    "frame_usec=<speech frame duration, 20000, 10000 or 5000> "
+    "wakeup_latency_threshold=<DL wakeup lateness to flag in usec, 0 to disable> "
+    "cpu_affinity=<cmtspeech thread CPU list, e.g. 0,2-3> "
+    "sched_policy=<default|fifo|rr|deadline> "
+    "sched_priority=<SCHED_FIFO/SCHED_RR priority> "
+    "sched_runtime=<SCHED_DEADLINE runtime per frame in usec> "
+    "dl_queue_depth=<DL frames queued for the sink thread> "
+    "dl_queue_overflow=<drop-oldest|drop-newest> "
+    "flight_recorder=<dump file path prefix, empty to disable> "
+    "watchdog_timeout=<DL/UL stall timeout in usec, e.g. 500000. A stall flushes DL one timeout after the last DL/UL progress, "
+    "re-syncs DL and UL after two and reopens the modem instance, ending the call, after three. Defaults to 0, disabled> "
+    "dl_phase_hint=<send DL deadline hints to the voice sink if its API has them, DL phase is only measured otherwise, defaults to false> "
+    "fast_cork=<start and stop speech in the IO threads without corking, defaults to false> "
+    "dl_agc=<apply automatic gain control to DL, defaults to false> "
+    "dl_agc_target=<DL AGC target level in dBFS, defaults to -20> "
+    "dl_agc_max_gain=<DL AGC maximum gain in dB, 0 - 18, defaults to 12> "
+    "ul_conditioning=<apply DC removal, gain and clipping to UL, defaults to false> "
+    "ul_gain=<UL conditioning gain in dB, -20 - 18, defaults to 0> "
+    "ul_dc_removal=<remove DC from UL when conditioning, defaults to true> "
+    "ul_slip_range=<UL held back in usec to follow voice source drift by sample slips, 250 - 8000 and below frame_usec, "
+    "defaults to 2000. Half of it adds to UL latency. Drift beyond +-half of it realigns the voice source, an audible jump, "
+    "which at 100 ppm drift happens every 10 s with the default> "
+    "ul_preroll_frames=<UL frames held until the modem takes UL, 0 - 16, defaults to 0> "
+    "ul_preroll_policy=<send held UL frames that fit before the first modem deadline, or drop them, defaults to send> "
+    "stats=<shared memory name prefix for call path statistics, the daemon pid is appended, empty to disable, defaults to " CMTSPEECH_STATS_SHM_DEFAULT "> "
+    "internal_resampler=<run streams at 16, 24 or 48 kHz sink and source rate and convert in module, defaults to true> "
 );
 PA_MODULE_VERSION(PACKAGE_VERSION);
 
@@ -49,6 +86,29 @@ static const char* const valid_modargs[] = {
     "sink",
     "source",
     "dbus_type",
+    "frame_usec",
+    "wakeup_latency_threshold",
+    "cpu_affinity",
+    "sched_policy",
+    "sched_priority",
+    "sched_runtime",
+    "dl_queue_depth",
+    "dl_queue_overflow",
+    "flight_recorder",
+    "watchdog_timeout",
+    "dl_phase_hint",
+    "fast_cork",
+    "dl_agc",
+    "dl_agc_target",
+    "dl_agc_max_gain",
+    "ul_conditioning",
+    "ul_gain",
+    "ul_dc_removal",
+    "ul_slip_range",
+    "ul_preroll_frames",
+    "ul_preroll_policy",
+    "internal_resampler",
+    "stats",
     NULL,
 };
 
@@ -100,7 +160,15 @@ void cmtspeech_trigger_unload(struct userdata *u) {
 int pa__init(pa_module*m) {
     pa_modargs *ma = NULL;
     struct userdata *u;
-    const char *sink_name, *source_name, *dbus_type;
+    const char *sink_name, *source_name, *dbus_type, *dl_queue_overflow, *flight_recorder, *stats;
+    char *fr_default;
+    uint32_t dl_queue_depth = CMTSPEECH_DL_QUEUE_DEFAULT_DEPTH;
+    uint32_t wakeup_latency_threshold = CMTSPEECH_WAKEUP_LATENCY_THRESHOLD;
+    uint32_t watchdog_timeout = 0;
+    uint32_t frame_usec = CMTSPEECH_FRAME_USEC_DEFAULT;
+    bool dl_phase_hint = false;
+    bool fast_cork = false;
+    bool internal_resampler = true;
     pa_sink *sink = NULL;
     pa_source *source = NULL;
 
@@ -115,8 +183,59 @@ int pa__init(pa_module*m) {
     source_name = pa_modargs_get_value(ma, "source", NULL);
     dbus_type = pa_modargs_get_value(ma, "dbus_type", "session");
 
-    pa_log_debug("Got arguments: sink=\"%s\" source=\"%s\" dbus_type=\"%s\"",
-                 sink_name, source_name, dbus_type);
+    if (pa_modargs_get_value_u32(ma, "frame_usec", &frame_usec) < 0 ||
+        frame_usec < CMTSPEECH_FRAME_USEC_MIN || VOICE_SINK_FRAMESIZE % frame_usec ||
+        VOICE_SOURCE_FRAMESIZE % frame_usec) {
+        pa_log_error("Failed to parse frame_usec argument, must be 20000, 10000 or 5000");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "wakeup_latency_threshold", &wakeup_latency_threshold) < 0) {
+        pa_log_error("Failed to parse wakeup_latency_threshold argument");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "dl_queue_depth", &dl_queue_depth) < 0 ||
+        dl_queue_depth < 1 || dl_queue_depth > CMTSPEECH_DL_QUEUE_MAX_DEPTH) {
+        pa_log_error("Failed to parse dl_queue_depth argument, must be 1 - %d", CMTSPEECH_DL_QUEUE_MAX_DEPTH);
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_u32(ma, "watchdog_timeout", &watchdog_timeout) < 0 ||
+        (watchdog_timeout > 0 && watchdog_timeout < 2 * frame_usec)) {
+        pa_log_error("Failed to parse watchdog_timeout argument, must be 0 or at least %u", 2 * frame_usec);
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "dl_phase_hint", &dl_phase_hint) < 0) {
+        pa_log_error("Failed to parse dl_phase_hint argument");
+        goto fail;
+    }
+#ifndef HAVE_VOICE_SINK_SET_DL_DEADLINE
+    if (dl_phase_hint) {
+        pa_log_warn("dl_phase_hint ignored: voice sink API has no DL deadline, DL phase is only measured");
+        dl_phase_hint = false;
+    }
+#endif
+
+    if (pa_modargs_get_value_boolean(ma, "fast_cork", &fast_cork) < 0) {
+        pa_log_error("Failed to parse fast_cork argument");
+        goto fail;
+    }
+
+    if (pa_modargs_get_value_boolean(ma, "internal_resampler", &internal_resampler) < 0) {
+        pa_log_error("Failed to parse internal_resampler argument");
+        goto fail;
+    }
+
+    dl_queue_overflow = pa_modargs_get_value(ma, "dl_queue_overflow", "drop-oldest");
+    if (!pa_streq(dl_queue_overflow, "drop-oldest") && !pa_streq(dl_queue_overflow, "drop-newest")) {
+        pa_log_error("Invalid dl_queue_overflow \"%s\"", dl_queue_overflow);
+        goto fail;
+    }
+
+    pa_log_debug("Got arguments: sink=\"%s\" source=\"%s\" dbus_type=\"%s\" frame_usec=%u",
+                 sink_name, source_name, dbus_type, frame_usec);
 
     u = pa_xnew0(struct userdata, 1);
     m->userdata = u;
@@ -127,9 +246,12 @@ int pa__init(pa_module*m) {
     u->ss.rate = CMTSPEECH_SAMPLERATE;
     u->ss.channels = 1;
     pa_channel_map_init_mono(&u->map);
+    u->frame_usec = frame_usec;
     /* The result is rounded down incorrectly thus +1 */
-    u->dl_frame_size = pa_usec_to_bytes(VOICE_SINK_FRAMESIZE+1, &u->ss);
-    u->ul_frame_size = pa_usec_to_bytes(VOICE_SOURCE_FRAMESIZE+1, &u->ss);
+    u->dl_frame_size = pa_usec_to_bytes(frame_usec+1, &u->ss);
+    u->ul_frame_size = pa_usec_to_bytes(frame_usec+1, &u->ss);
+    u->sink_frame_size = pa_usec_to_bytes(VOICE_SINK_FRAMESIZE+1, &u->ss);
+    u->dl_sideinfo_frames = VOICE_SINK_FRAMESIZE / frame_usec;
 
     if (!(source = pa_namereg_get(m->core, source_name, PA_NAMEREG_SOURCE))) {
         pa_log_error("Source \"%s\" not found", source_name);
@@ -156,11 +278,47 @@ int pa__init(pa_module*m) {
     u->local_sideinfoq = pa_queue_new();
     u->voice_sideinfoq = NULL;
     u->continuous_dl_stream = false,
+    u->dl_maxlength = u->sink_frame_size + 3*u->dl_frame_size;
     u->dl_memblockq =
-	pa_memblockq_new("cmtspeech dl_memblockq", 0, 4*u->dl_frame_size, 0, &u->ss, 0, 0, 0, NULL);
+	pa_memblockq_new("cmtspeech dl_memblockq", 0, u->dl_maxlength, 0, &u->ss, 0, 0, 0, NULL);
 
     u->mainloop_handler = cmtspeech_mainloop_handler_new(u);
 
+    u->cmt_connection.wakeup_stats.threshold = wakeup_latency_threshold;
+    u->cmt_connection.wakeup_stats.period = frame_usec;
+    cmtspeech_drift_reset(&u->cmt_connection.drift);
+    u->cmt_connection.dl_queue_depth = dl_queue_depth;
+    u->cmt_connection.dl_queue_drop_oldest = pa_streq(dl_queue_overflow, "drop-oldest");
+    u->cmt_connection.watchdog.timeout = watchdog_timeout;
+    u->dl_phase.hint = dl_phase_hint;
+    u->fast_cork = fast_cork;
+    u->internal_resampler = internal_resampler;
+
+    if (!(u->sched = cmtspeech_sched_new(ma, frame_usec)))
+        goto fail;
+
+    if (cmtspeech_agc_new(ma, &u->dl_agc) < 0)
+        goto fail;
+
+    if (cmtspeech_ul_cond_new(ma, &u->ul_cond) < 0)
+        goto fail;
+
+    if (cmtspeech_ul_drift_init(u, ma) < 0)
+        goto fail;
+
+    if (cmtspeech_ul_preroll_new(ma, u->ul_frame_size, frame_usec, &u->ul_preroll) < 0)
+        goto fail;
+
+    fr_default = pa_runtime_path("cmtspeech-flight-recorder");
+    flight_recorder = pa_modargs_get_value(ma, "flight_recorder", fr_default);
+    if (flight_recorder && *flight_recorder)
+        u->flight_recorder = cmtspeech_flight_recorder_new(flight_recorder);
+    pa_xfree(fr_default);
+
+    stats = pa_modargs_get_value(ma, "stats", CMTSPEECH_STATS_SHM_DEFAULT);
+    if (stats && *stats)
+        u->stats = cmtspeech_stats_new(stats);
+
     if (cmtspeech_dbus_init(u, dbus_type))
         goto fail;
 
@@ -196,14 +354,46 @@ void pa__done(pa_module*m) {
     cmtspeech_connection_unload(u);
 
     cmtspeech_delete_source_output(u);
+    cmtspeech_source_output_free_resampler(u);
 
     cmtspeech_delete_sink_input(u);
+    cmtspeech_sink_input_free_resampler(u);
 
     if (u->mainloop_handler) {
         u->mainloop_handler->parent.free((pa_object *)u->mainloop_handler);
         u->mainloop_handler = NULL;
     }
 
+    if (u->sched) {
+        cmtspeech_sched_free(u->sched);
+        u->sched = NULL;
+    }
+
+    if (u->flight_recorder) {
+        cmtspeech_flight_recorder_free(u->flight_recorder);
+        u->flight_recorder = NULL;
+    }
+
+    if (u->stats) {
+        cmtspeech_stats_free(u->stats);
+        u->stats = NULL;
+    }
+
+    if (u->dl_agc) {
+        cmtspeech_agc_free(u->dl_agc);
+        u->dl_agc = NULL;
+    }
+
+    if (u->ul_cond) {
+        cmtspeech_ul_cond_free(u->ul_cond);
+        u->ul_cond = NULL;
+    }
+
+    if (u->ul_preroll) {
+        cmtspeech_ul_preroll_free(u->ul_preroll);
+        u->ul_preroll = NULL;
+    }
+
     if (u->local_sideinfoq) {
         pa_queue_free(u->local_sideinfoq, NULL);
         u->local_sideinfoq = NULL;
@@ -39,14 +39,43 @@
 #include <pulsecore/thread.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/asyncq.h>
+#include <pulsecore/flist.h>
 #include <pulsecore/dbus-shared.h>
 
 #include <cmtspeech.h>
 
 #define CMTSPEECH_SAMPLERATE   (8000)
 
+/* Speech frame durations, the voice sink and source run on 20ms frames */
+#define CMTSPEECH_FRAME_USEC_DEFAULT (20000)
+#define CMTSPEECH_FRAME_USEC_MIN     (5000)
+
+/* UL samples held back for sample slip, at most and by default. Half of
+ * them is the nominal hold back, see ul_slip_range. */
+#define CMTSPEECH_UL_SLIP_MAX       (64)
+#define CMTSPEECH_UL_SLIP_DEFAULT   (16)
+
+#define CMTSPEECH_WAKEUP_HISTOGRAM_SIZE (8)
+
+/* DL buffer depth histogram of a call, in DL frames */
+#define CMTSPEECH_CALL_DEPTH_BUCKETS (8)
+
+/* Served DL frames kept for sink rewinds */
+#define CMTSPEECH_DL_HISTORY_MAX (32)
+
+/* Timing notifications kept for the modem clock drift estimate */
+#define CMTSPEECH_DRIFT_NTF_MAX (8)
+
+/* Named deadlines of the cmtspeech thread timer queue */
+enum cmtspeech_timer_id {
+    CMTSPEECH_TIMER_CLEANUP,
+    CMTSPEECH_TIMER_RECONNECT,
+    CMTSPEECH_TIMER_WATCHDOG,
+    CMTSPEECH_TIMER_STATS_FLUSH,
+    CMTSPEECH_TIMER_MAX
+};
+
 #define ENTER() pa_log_debug("%d: %s() called", __LINE__, __FUNCTION__)
-#define ONDEBUG_TOKENS(a)
 
 #define PROPLIST_SINK "sink.hw0"
 
@@ -58,8 +87,10 @@ struct userdata {
 
     pa_channel_map map;
     pa_sample_spec ss;
+    pa_usec_t frame_usec;
     size_t dl_frame_size;
     size_t ul_frame_size;
+    size_t sink_frame_size;             /* bytes in one voice sink frame */
 
     char *sink_name;
     char *source_name;
@@ -74,9 +105,43 @@ struct userdata {
     pa_queue *voice_sideinfoq;
     bool continuous_dl_stream;
     pa_memblockq *dl_memblockq;
+    size_t dl_maxlength;                /* dl_memblockq maxlength outside rewinds */
+    unsigned dl_underruns;
+    bool dl_started;                    /* dl_active seen set */
+    unsigned dl_sideinfo_frames;        /* DL frames per voice sink frame */
+    unsigned dl_sideinfo_pos;
+    unsigned dl_sideinfo_flags;
+    struct cmtspeech_dl_phase {
+	bool hint;                      /* send DL deadline hints to the sink */
+	int64_t avg;                    /* usec << 4, frame arrival to sink pop */
+	unsigned count;
+	unsigned hints;
+    } dl_phase;
+    struct cmtspeech_dl_history {
+	unsigned entry[CMTSPEECH_DL_HISTORY_MAX];  /* sideinfo of served frames, ring */
+	unsigned pos;                   /* next entry */
+	unsigned len;                   /* entries since last discontinuity */
+	unsigned max;                   /* frames the sink may rewind */
+	unsigned replayed[CMTSPEECH_DL_HISTORY_MAX];  /* rewound sideinfo, oldest last */
+	unsigned replay;
+	size_t trim;                    /* stream bytes of the first replayed frame already played */
+	size_t pad;                     /* stream bytes of partly rewound silence */
+	unsigned rewinds;
+	unsigned rewritten;             /* silent frames replaced after underrun */
+    } dl_history;
+    struct cmtspeech_agc *dl_agc;       /* NULL when disabled */
+    struct cmtspeech_resampler *dl_resampler;   /* NULL when sink runs at modem rate */
 
     pa_msgobject *mainloop_handler;
 
+    bool fast_cork;                     /* streams stay uncorked, gated by dl/ul_active */
+    bool internal_resampler;            /* convert x2, x3 and x6 rates in module */
+
+    struct cmtspeech_sched *sched;
+
+    struct cmtspeech_flight_recorder *flight_recorder;
+    struct cmtspeech_stats *stats;
+
     struct cmtspeech_dbus_conn {
 	DBusBusType dbus_type;
 	pa_dbus_connection *dbus_conn;
@@ -95,7 +160,14 @@ struct userdata {
         pa_thread *thread;
 	pa_thread_mq thread_mq;
 
-	pa_asyncq *dl_frame_queue;
+	struct cmtspeech_dl_queue *dl_frame_queue;
+	unsigned dl_queue_depth;
+	bool dl_queue_drop_oldest;
+	struct cmtspeech_dl_wrapper *dl_wrappers;
+	unsigned dl_wrapper_count;
+	pa_flist *dl_wrapper_flist;
+	unsigned dl_wrapper_copies;     /* sink IO-thread */
+	pa_atomic_t generation;         /* incremented when cmtspeech is closed */
 
 	bool call_ul;                   /* set according to DBus signals */
 	bool call_dl;                   /* set according to DBus signals */
@@ -104,8 +176,104 @@ struct userdata {
 	bool record_running;            /* internal state */
 	bool playback_running;          /* internal state */
 	bool streams_created;           /* internal state */
+
+	struct cmtspeech_timers {
+	    pa_usec_t deadline[CMTSPEECH_TIMER_MAX];    /* 0 when not armed */
+	    pa_usec_t programmed;                       /* rtpoll timer, 0 when disabled */
+	    bool stale;                                 /* rtpoll timer elapsed */
+	} timers;                       /* cmtspeech thread only */
+
+	struct cmtspeech_watchdog {
+	    pa_usec_t timeout;                          /* 0 disables */
+	    pa_usec_t last_dl;                          /* last DL frame */
+	    pa_usec_t last_ul;                          /* last check with UL progress */
+	    unsigned ul_frames;                         /* ul_frames_sent at last_ul */
+	    bool ul_running;
+	    pa_usec_t stall_start;                      /* 0 when not stalled */
+	    pa_usec_t detected;
+	    int stalled;                                /* stalled directions */
+	    int level;                                  /* recovery steps taken */
+	    unsigned stalls;
+	} watchdog;                     /* cmtspeech thread only */
+	pa_atomic_t ul_frames_sent;     /* incremented from source IO-thread */
+	int64_t ul_deadline;            /* last UL deadline from the modem, 0 if none */
+
+	struct cmtspeech_drift {
+	    pa_usec_t ref;                              /* first DL arrival of the fit */
+	    pa_usec_t last;                             /* last DL arrival */
+	    int64_t frame;                              /* DL frame number of last */
+	    unsigned count;
+	    unsigned rejected;                          /* late arrivals left out */
+	    unsigned off_grid;                          /* consecutive arrivals left out */
+	    double mean_n, mean_t;                      /* weighted means */
+	    double cnn, cnt, ctt;                       /* weighted covariances */
+	    pa_usec_t ntf[CMTSPEECH_DRIFT_NTF_MAX];     /* UL deadlines from timing notifications */
+	    unsigned ntf_count;
+	    double ntf_ppm;
+	    bool ntf_known;                             /* ntf_ppm spans CMTSPEECH_DRIFT_NTF_SPAN */
+	    pa_atomic_t ppm;                            /* published, ppm << 8 */
+	    pa_atomic_t err;                            /* published, ppm << 8, INT_MAX when unknown */
+	} drift;                        /* cmtspeech thread, see cmtspeech_drift_get() */
+	int drift_posted;               /* ppm << 8 last given to the streams, INT_MAX if none */
+
+	pa_usec_t wakeup_time;          /* last pa_rtpoll_run() return */
+	pa_atomic_t dl_arrival;         /* lower 32 bits of last DL frame arrival usec */
+
+	pa_atomic_t dl_active;          /* sink IO-thread consumes DL */
+	pa_atomic_t dl_rewrite;         /* sink served silence it can rewind */
+	pa_atomic_t ul_active;          /* source IO-thread sends UL */
+	pa_atomic_t dl_start_time;      /* lower 32 bits of dl_active set usec */
+	pa_atomic_t ul_start_time;      /* lower 32 bits of ul_active set usec */
+	struct cmtspeech_wakeup_stats {
+	    pa_usec_t threshold;
+	    pa_usec_t period;
+	    pa_usec_t anchor;           /* DL frame grid origin, 0 until the first frame */
+	    uint64_t slot;              /* grid slot of the last DL frame */
+	    pa_usec_t window_min;       /* smallest lateness in the current window */
+	    unsigned window_count;
+	    pa_usec_t max;
+	    unsigned count;
+	    unsigned late;
+	    unsigned histogram[CMTSPEECH_WAKEUP_HISTOGRAM_SIZE];
+	} wakeup_stats;
     } cmt_connection;
 
+    /* Access only from source IO-thread */
+    bool ul_started;                    /* ul_active seen set */
+    struct cmtspeech_ul_drift {
+	pa_usec_t deadline;             /* modem UL deadline reference */
+	bool deadline_valid;
+	int reference_count;            /* slack samples in reference */
+	int64_t reference_slack;        /* usec */
+	int64_t slack_avg;              /* usec, smoothed */
+	unsigned range;                 /* samples held back at most */
+	unsigned carry_len;             /* samples */
+	int16_t carry[CMTSPEECH_UL_SLIP_MAX];
+	int slip;                       /* -1 drop, +1 insert, 0 none */
+	unsigned slips_dropped;
+	unsigned slips_inserted;
+	unsigned realigns;
+    } ul_drift;
+    struct cmtspeech_ul_cond *ul_cond;  /* NULL when disabled */
+    struct cmtspeech_ul_preroll *ul_preroll;    /* NULL when disabled */
+    struct cmtspeech_resampler *ul_resampler;   /* NULL when source runs at modem rate */
+    int16_t *ul_resample_buf;           /* one modem UL frame */
+    size_t ul_stream_frame_size;        /* ul_frame_size at source output rate */
+
+    /* Per-call metrics, updated from all threads */
+    struct cmtspeech_call_metrics {
+	pa_usec_t start;                /* cmtspeech thread, 0 when no call */
+	pa_atomic_t dl_frames;
+	pa_atomic_t dl_bad_frames;
+	pa_atomic_t dl_silent_frames;
+	pa_atomic_t dl_drops;
+	pa_atomic_t dl_queue_overflows;
+	pa_atomic_t ul_frames;
+	pa_atomic_t ul_failures;
+	pa_atomic_t modem_resets;
+	pa_atomic_t dl_depth[CMTSPEECH_CALL_DEPTH_BUCKETS];
+    } call_metrics;
+
     pa_atomic_t cmtspeech_server_status;
     pa_atomic_t cmtspeech_cleanup_state;
     pa_usec_t server_inactive_timeout;
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifndef cmtspeech_test_h
+#define cmtspeech_test_h
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Unit tests of the module's self-contained parts. A failed check
+ * prints the expression and exits with failure, so that each test
+ * program fails as a whole under "make check". */
+
+#define check(expr)                                                     \
+    do {                                                                \
+        if (!(expr)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #expr);                         \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while (0)
+
+#define check_near(a, b, tolerance)                                     \
+    do {                                                                \
+        double check_a_ = (a), check_b_ = (b);                          \
+        if (!(check_a_ >= check_b_ - (tolerance) &&                     \
+              check_a_ <= check_b_ + (tolerance))) {                    \
+            fprintf(stderr, "%s:%d: check failed: %s = %g, expected %s = %g +- %g\n", \
+                    __FILE__, __LINE__, #a, check_a_, #b, check_b_,     \
+                    (double) (tolerance));                              \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while (0)
+
+/* Deterministic pseudo random numbers, the same on every run */
+static inline unsigned test_random(unsigned *state) {
+    *state = *state * 1103515245U + 12345U;
+    return (*state >> 16) & 0x7fff;
+}
+
+#endif /* cmtspeech_test_h */
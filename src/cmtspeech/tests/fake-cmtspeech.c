@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <cmtspeech.h>
+
+#include "fake-cmtspeech.h"
+#include "cmtspeech-test.h"
+
+#define FAKE_EVENTS     (16)
+#define FAKE_DL_BUFFERS (16)
+
+static struct fake_cmtspeech {
+    pa_usec_t now;
+    size_t frame_bytes;
+    bool open;
+
+    int state;                          /* as last read by the module */
+    int queued_state;                   /* after the queued events */
+    cmtspeech_event_t events[FAKE_EVENTS];
+    unsigned event_read;
+    unsigned event_count;
+
+    cmtspeech_buffer_t dl[FAKE_DL_BUFFERS];
+    bool dl_busy[FAKE_DL_BUFFERS];      /* queued or held by the module */
+    unsigned dl_queue[FAKE_DL_BUFFERS]; /* ring of queued buffers */
+    unsigned dl_read;
+    unsigned dl_count;
+    unsigned dl_held;
+
+    cmtspeech_buffer_t ul;
+    bool ul_held;
+    unsigned ul_frames;
+    int16_t ul_last;
+} fake;
+
+static void *fake_context = &fake;
+#define FAKE_CONTEXT ((cmtspeech_t *) fake_context)
+
+pa_usec_t pa_rtclock_now(void) {
+    return fake.now;
+}
+
+void fake_clock_set(pa_usec_t now) {
+    check(now >= fake.now);
+    fake.now = now;
+}
+
+static void fake_buffer_init(cmtspeech_buffer_t *buf, size_t frame_bytes) {
+    memset(buf, 0, sizeof(*buf));
+    buf->size = (int) (CMTSPEECH_DATA_HEADER_LEN + frame_bytes);
+    buf->count = buf->size;
+    buf->pcount = (int) frame_bytes;
+    buf->data = pa_xmalloc0((size_t) buf->size);
+    buf->payload = buf->data + CMTSPEECH_DATA_HEADER_LEN;
+}
+
+void fake_cmtspeech_init(size_t frame_bytes) {
+    unsigned i;
+
+    memset(&fake, 0, sizeof(fake));
+    fake.frame_bytes = frame_bytes;
+    fake.state = CMTSPEECH_STATE_DISCONNECTED;
+    fake.queued_state = CMTSPEECH_STATE_DISCONNECTED;
+
+    for (i = 0; i < FAKE_DL_BUFFERS; i++)
+        fake_buffer_init(&fake.dl[i], frame_bytes);
+    fake_buffer_init(&fake.ul, frame_bytes);
+}
+
+void fake_cmtspeech_done(void) {
+    unsigned i;
+
+    for (i = 0; i < FAKE_DL_BUFFERS; i++)
+        pa_xfree(fake.dl[i].data);
+    pa_xfree(fake.ul.data);
+}
+
+static cmtspeech_event_t *fake_event_new(int state, int msg_type) {
+    cmtspeech_event_t *e;
+
+    check(fake.event_count < FAKE_EVENTS);
+    e = &fake.events[(fake.event_read + fake.event_count++) % FAKE_EVENTS];
+    memset(e, 0, sizeof(*e));
+    e->prev_state = fake.queued_state;
+    e->state = state;
+    e->msg_type = msg_type;
+    fake.queued_state = state;
+
+    return e;
+}
+
+void fake_cmtspeech_state(int state, int msg_type) {
+    fake_event_new(state, msg_type);
+}
+
+void fake_cmtspeech_timing(unsigned msec, unsigned usec) {
+    cmtspeech_event_t *e;
+
+    check(fake.queued_state == CMTSPEECH_STATE_ACTIVE_DLUL);
+    e = fake_event_new(CMTSPEECH_STATE_ACTIVE_DLUL, CMTSPEECH_TIMING_CONFIG_NTF);
+    e->msg.timing_config_ntf.msec = msec;
+    e->msg.timing_config_ntf.usec = usec;
+    e->msg.timing_config_ntf.tstamp.tv_sec = (time_t) (fake.now / PA_USEC_PER_SEC);
+    e->msg.timing_config_ntf.tstamp.tv_nsec = (long) (fake.now % PA_USEC_PER_SEC * PA_NSEC_PER_USEC);
+}
+
+int fake_cmtspeech_dl_frame(int spc_flags, int16_t value) {
+    int16_t *d;
+    unsigned i, n;
+
+    for (i = 0; i < FAKE_DL_BUFFERS; i++)
+        if (!fake.dl_busy[i])
+            break;
+    if (i == FAKE_DL_BUFFERS)
+        return -1;
+
+    fake.dl_busy[i] = true;
+    fake.dl[i].spc_flags = spc_flags;
+    d = (int16_t *) fake.dl[i].payload;
+    for (n = 0; n < fake.frame_bytes / sizeof(int16_t); n++)
+        d[n] = value;
+
+    fake.dl_queue[(fake.dl_read + fake.dl_count++) % FAKE_DL_BUFFERS] = i;
+    return 0;
+}
+
+bool fake_cmtspeech_pending(void) {
+    return fake.event_count > 0 || fake.dl_count > 0;
+}
+
+unsigned fake_cmtspeech_dl_held(void) {
+    return fake.dl_held;
+}
+
+unsigned fake_cmtspeech_ul_frames(void) {
+    return fake.ul_frames;
+}
+
+int16_t fake_cmtspeech_ul_last(void) {
+    return fake.ul_last;
+}
+
+/* The libcmtspeechdata API as used by the module */
+
+void cmtspeech_init(void) {
+}
+
+void cmtspeech_trace_toggle(int priority, bool enabled) {
+}
+
+int cmtspeech_set_trace_handler(void (*func)(int priority, const char *message, va_list args)) {
+    return 0;
+}
+
+cmtspeech_t *cmtspeech_open(void) {
+    check(!fake.open);
+    fake.open = true;
+    return FAKE_CONTEXT;
+}
+
+int cmtspeech_close(cmtspeech_t *context) {
+    check(context == FAKE_CONTEXT && fake.open);
+    fake.open = false;
+    return 0;
+}
+
+int cmtspeech_descriptor(cmtspeech_t *context) {
+    check(context == FAKE_CONTEXT);
+    return -1;
+}
+
+int cmtspeech_check_pending(cmtspeech_t *context, int *flags) {
+    check(context == FAKE_CONTEXT);
+
+    *flags = 0;
+    if (fake.event_count)
+        *flags |= CMTSPEECH_EVENT_CONTROL;
+    if (fake.dl_count)
+        *flags |= CMTSPEECH_EVENT_DL_DATA;
+
+    return *flags ? 1 : 0;
+}
+
+int cmtspeech_read_event(cmtspeech_t *context, cmtspeech_event_t *event) {
+    check(context == FAKE_CONTEXT);
+
+    if (!fake.event_count)
+        return -1;
+
+    *event = fake.events[fake.event_read];
+    fake.event_read = (fake.event_read + 1) % FAKE_EVENTS;
+    fake.event_count--;
+    fake.state = event->state;
+
+    return 0;
+}
+
+int cmtspeech_protocol_state(cmtspeech_t *context) {
+    check(context == FAKE_CONTEXT);
+    return fake.state;
+}
+
+bool cmtspeech_is_active(cmtspeech_t *context) {
+    check(context == FAKE_CONTEXT);
+    return fake.state == CMTSPEECH_STATE_ACTIVE_DL || fake.state == CMTSPEECH_STATE_ACTIVE_DLUL;
+}
+
+int cmtspeech_state_change_call_status(cmtspeech_t *context, bool state) {
+    check(context == FAKE_CONTEXT);
+    return 0;
+}
+
+int cmtspeech_state_change_call_connect(cmtspeech_t *context, bool state) {
+    check(context == FAKE_CONTEXT);
+    return 0;
+}
+
+int cmtspeech_state_change_error(cmtspeech_t *context) {
+    check(context == FAKE_CONTEXT);
+    return 0;
+}
+
+int cmtspeech_dl_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf) {
+    unsigned i;
+
+    check(context == FAKE_CONTEXT);
+
+    if (!fake.dl_count)
+        return -EINVAL;
+
+    i = fake.dl_queue[fake.dl_read];
+    fake.dl_read = (fake.dl_read + 1) % FAKE_DL_BUFFERS;
+    fake.dl_count--;
+    fake.dl_held++;
+    *buf = &fake.dl[i];
+
+    return 0;
+}
+
+int cmtspeech_dl_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf) {
+    unsigned i;
+
+    check(context == FAKE_CONTEXT);
+    check(buf >= fake.dl && buf < fake.dl + FAKE_DL_BUFFERS);
+
+    i = (unsigned) (buf - fake.dl);
+    check(fake.dl_busy[i] && fake.dl_held > 0);
+    fake.dl_busy[i] = false;
+    fake.dl_held--;
+
+    return 0;
+}
+
+int cmtspeech_ul_buffer_acquire(cmtspeech_t *context, cmtspeech_buffer_t **buf) {
+    check(context == FAKE_CONTEXT);
+    check(!fake.ul_held);
+
+    if (fake.state != CMTSPEECH_STATE_ACTIVE_DLUL)
+        return -EINVAL;
+
+    fake.ul_held = true;
+    *buf = &fake.ul;
+
+    return 0;
+}
+
+int cmtspeech_ul_buffer_release(cmtspeech_t *context, cmtspeech_buffer_t *buf) {
+    check(context == FAKE_CONTEXT);
+    check(buf == &fake.ul && fake.ul_held);
+
+    fake.ul_held = false;
+    fake.ul_frames++;
+    fake.ul_last = ((int16_t *) fake.ul.payload)[fake.frame_bytes / sizeof(int16_t) - 1];
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifndef fake_cmtspeech_h
+#define fake_cmtspeech_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pulse/sample.h>
+
+/* A libcmtspeechdata replacement for driving the module against a
+ * scripted modem. Control events and DL frames are queued by the test
+ * and handed out through the library API as the cmtspeech thread asks
+ * for them, UL frames released by the module are counted. The fake also
+ * owns the clock: pa_rtclock_now() returns the time set by the test. */
+
+void fake_clock_set(pa_usec_t now);
+
+/* frame_bytes is the speech payload of one DL and UL frame. The clock
+ * starts over from 0. */
+void fake_cmtspeech_init(size_t frame_bytes);
+void fake_cmtspeech_done(void);
+
+/* Queues a protocol state change from the last queued state */
+void fake_cmtspeech_state(int state, int msg_type);
+
+/* Queues a timing notification with the next UL deadline at
+ * the current time plus msec and usec */
+void fake_cmtspeech_timing(unsigned msec, unsigned usec);
+
+/* Queues a DL frame filled with value. Returns -1 when all modem
+ * buffers are held by the module. */
+int fake_cmtspeech_dl_frame(int spc_flags, int16_t value);
+
+/* An event or DL frame is waiting for cmtspeech_check_pending() */
+bool fake_cmtspeech_pending(void);
+
+/* DL buffers acquired by the module and not released yet */
+unsigned fake_cmtspeech_dl_held(void);
+
+/* UL frames released to the modem, and the last sample of the last one */
+unsigned fake_cmtspeech_ul_frames(void);
+int16_t fake_cmtspeech_ul_last(void);
+
+#endif /* fake_cmtspeech_h */
@@ -0,0 +1,592 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <poll.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/version.h>
+
+/* The cmtspeech thread event handling and the sink input and source
+ * output callbacks are static, so the test is built from their
+ * sources. libcmtspeechdata and the clock are replaced by the fake. */
+#include "cmtspeech-sink-input.c"
+#include "cmtspeech-source-output.c"
+#include "cmtspeech-connection.c"
+
+#include "fake-cmtspeech.h"
+#include "cmtspeech-test.h"
+
+#define PERIOD      (20 * PA_USEC_PER_MSEC)
+#define START       (10 * PA_USEC_PER_SEC)
+
+/* Within the period the modem sends DL first, then the voice sink
+ * pops DL and the voice source pushes UL, which the modem takes at
+ * its UL deadline */
+#define DL_PHASE            (5 * PA_USEC_PER_MSEC)
+#define POP_PHASE           (12 * PA_USEC_PER_MSEC)
+#define PUSH_PHASE          (15 * PA_USEC_PER_MSEC)
+#define UL_DEADLINE_PHASE   (18 * PA_USEC_PER_MSEC)
+
+enum trace_op {
+    TRACE_CALL_CONNECT,
+    TRACE_SPEECH_START,         /* DL frames start */
+    TRACE_UL_START,             /* with the UL timing */
+    TRACE_DL_LOSE,              /* the next arg DL frames never arrive */
+    TRACE_DL_HOLD,              /* the next arg DL frames arrive with the one after them */
+    TRACE_SPEECH_STOP,
+    TRACE_CALL_DISCONNECT,
+    TRACE_END
+};
+
+struct trace_step {
+    unsigned ms;                /* from START */
+    enum trace_op op;
+    unsigned arg;
+};
+
+static struct userdata u;
+
+static struct call {
+    pa_mainloop *mainloop;
+    pa_sink *sink;
+    pa_source *source;
+    pa_sink_input *sink_input;
+    pa_source_output *source_output;
+    pa_queue *voice_sideinfoq;
+
+    /* modem */
+    bool speech;
+    unsigned dl_lose;
+    unsigned dl_hold;
+    unsigned dl_held;
+    int16_t dl_seq;
+
+    /* main thread messages */
+    int msgs[16];
+    unsigned msg_count;
+    unsigned ul_deadlines;      /* to the voice source */
+
+    /* voice sink */
+    unsigned pops;
+    unsigned served;
+    unsigned silent;
+    int16_t last_served;
+    pa_usec_t dl_latency;       /* before the last pop */
+    pa_usec_t dl_latency_max;
+
+    /* voice source */
+    unsigned pushes;
+    int16_t ul_seq;
+    int16_t ul_sent;            /* the last one pushed with UL active */
+    pa_usec_t ul_latency;       /* after the last push */
+} call;
+
+/* Main thread: streams are created and attached as the module asks */
+static int test_mainloop_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    check(call.msg_count < PA_ELEMENTSOF(call.msgs));
+    call.msgs[call.msg_count++] = code;
+
+    switch (code) {
+        case CMTSPEECH_MAINLOOP_HANDLER_CREATE_STREAMS:
+            u.sink = call.sink;
+            u.source = call.source;
+            u.sink_input = call.sink_input;
+            u.source_output = call.source_output;
+            call.sink_input->attach(call.sink_input);
+            call.source_output->attach(call.source_output);
+            break;
+        case CMTSPEECH_MAINLOOP_HANDLER_DELETE_STREAMS:
+            call.sink_input->detach(call.sink_input);
+            call.source_output->detach(call.source_output);
+            u.sink_input = NULL;
+            u.source_output = NULL;
+            break;
+    }
+
+    return 0;
+}
+
+/* From module-meego-cmtspeech.c, the test streams are not moved or
+ * killed */
+int cmtspeech_check_sink_api(pa_sink *s) {
+    return 0;
+}
+
+int cmtspeech_check_source_api(pa_source *s) {
+    return 0;
+}
+
+void cmtspeech_trigger_unload(struct userdata *ud) {
+    pa_assert_not_reached();
+}
+
+static int test_sink_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    if (code == VOICE_SINK_GET_SIDE_INFO_QUEUE_PTR)
+        *((pa_queue **) data) = call.voice_sideinfoq;
+    return 0;
+}
+
+static int test_source_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    if (code == VOICE_SOURCE_SET_UL_DEADLINE)
+        call.ul_deadlines++;
+    return 0;
+}
+
+static void setup(void) {
+    struct cmtspeech_connection *c = &u.cmt_connection;
+    unsigned i;
+
+    memset(&u, 0, sizeof(u));
+    memset(&call, 0, sizeof(call));
+
+    call.mainloop = pa_mainloop_new();
+    u.core = pa_xnew0(pa_core, 1);
+#if PA_CHECK_VERSION(9, 0, 0)
+    u.core->mempool = pa_mempool_new(PA_MEM_TYPE_PRIVATE, 0, true);
+#else
+    u.core->mempool = pa_mempool_new(false, 0);
+#endif
+    pa_silence_cache_init(&u.core->silence_cache);
+
+    /* As in pa__init() with fast_cork */
+    u.ss.format = PA_SAMPLE_S16NE;
+    u.ss.rate = CMTSPEECH_SAMPLERATE;
+    u.ss.channels = 1;
+    pa_channel_map_init_mono(&u.map);
+    u.frame_usec = PERIOD;
+    u.dl_frame_size = pa_usec_to_bytes(PERIOD + 1, &u.ss);
+    u.ul_frame_size = pa_usec_to_bytes(PERIOD + 1, &u.ss);
+    u.ul_stream_frame_size = u.ul_frame_size;
+    u.sink_frame_size = pa_usec_to_bytes(VOICE_SINK_FRAMESIZE + 1, &u.ss);
+    u.dl_sideinfo_frames = VOICE_SINK_FRAMESIZE / PERIOD;
+    u.local_sideinfoq = pa_queue_new();
+    u.dl_maxlength = u.sink_frame_size + 3 * u.dl_frame_size;
+    u.dl_memblockq = pa_memblockq_new("test dl_memblockq", 0, u.dl_maxlength, 0, &u.ss, 0, 0, 0, NULL);
+    u.fast_cork = true;
+    u.ul_drift.range = CMTSPEECH_UL_SLIP_DEFAULT;
+
+    u.mainloop_handler = pa_msgobject_new(pa_msgobject);
+    u.mainloop_handler->process_msg = test_mainloop_msg;
+
+    c->wakeup_stats.threshold = CMTSPEECH_WAKEUP_LATENCY_THRESHOLD;
+    c->wakeup_stats.period = PERIOD;
+    cmtspeech_drift_reset(&c->drift);
+    c->dl_queue_depth = CMTSPEECH_DL_QUEUE_DEFAULT_DEPTH;
+    c->dl_queue_drop_oldest = true;
+
+    /* cmtspeech_connection_init() without the thread, the test runs the
+     * cmtspeech thread steps itself */
+    userdata = &u;
+    c->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&c->thread_mq, pa_mainloop_get_api(call.mainloop), c->rtpoll);
+    pa_thread_mq_install(&c->thread_mq);
+    c->dl_frame_queue = cmtspeech_dl_queue_new(c->dl_queue_depth, c->dl_queue_drop_oldest);
+    c->dl_wrapper_count = c->dl_queue_depth + (unsigned) (u.dl_maxlength / u.dl_frame_size) + 1;
+    c->dl_wrappers = pa_xnew0(cmtspeech_dl_wrapper, c->dl_wrapper_count);
+    c->dl_wrapper_flist = pa_flist_new(c->dl_wrapper_count);
+    for (i = 0; i < c->dl_wrapper_count; i++) {
+        c->dl_wrappers[i].u = &u;
+        check(pa_flist_push(c->dl_wrapper_flist, &c->dl_wrappers[i]) == 0);
+    }
+    c->cmtspeech_mutex = pa_mutex_new(false, true);
+
+    fake_cmtspeech_init(u.dl_frame_size);
+    fake_clock_set(START);
+    c->cmtspeech = cmtspeech_open();
+    c->cmt_poll_item = pa_rtpoll_item_new(c->rtpoll, PA_RTPOLL_NEVER, 1);
+
+    /* The voice sink and source with the module streams on them */
+    call.voice_sideinfoq = pa_queue_new();
+
+    call.sink = pa_msgobject_new(pa_sink);
+    call.sink->parent.process_msg = test_sink_msg;
+    call.sink->name = (char *) "voice-sink";
+    call.sink->sample_spec = u.ss;
+
+    call.source = pa_msgobject_new(pa_source);
+    call.source->parent.process_msg = test_source_msg;
+    call.source->name = (char *) "voice-source";
+    call.source->sample_spec = u.ss;
+    call.source->asyncmsgq = pa_asyncmsgq_new(0);
+    call.source->state = PA_SOURCE_RUNNING;
+    call.source->thread_info.state = PA_SOURCE_RUNNING;
+
+    call.sink_input = pa_msgobject_new(pa_sink_input);
+    call.sink_input->parent.process_msg = cmtspeech_sink_input_process_msg;
+    call.sink_input->pop = cmtspeech_sink_input_pop_cb;
+    call.sink_input->attach = cmtspeech_sink_input_attach_cb;
+    call.sink_input->detach = cmtspeech_sink_input_detach_cb;
+    call.sink_input->userdata = &u;
+    call.sink_input->sink = call.sink;
+    call.sink_input->sample_spec = u.ss;
+    call.sink_input->state = PA_SINK_INPUT_RUNNING;
+    call.sink_input->thread_info.state = PA_SINK_INPUT_RUNNING;
+
+    call.source_output = pa_msgobject_new(pa_source_output);
+    call.source_output->parent.process_msg = cmtspeech_source_output_process_msg;
+    call.source_output->push = cmtspeech_source_output_push_cb;
+    call.source_output->attach = cmtspeech_source_output_attach_cb;
+    call.source_output->detach = cmtspeech_source_output_detach_cb;
+    call.source_output->userdata = &u;
+    call.source_output->source = call.source;
+    call.source_output->sample_spec = u.ss;
+    call.source_output->state = PA_SOURCE_OUTPUT_RUNNING;
+    call.source_output->thread_info.state = PA_SOURCE_OUTPUT_RUNNING;
+}
+
+static void teardown(void) {
+    struct cmtspeech_connection *c = &u.cmt_connection;
+
+    /* Every modem buffer has been given back */
+    cmtspeech_sink_input_reset_dl_stream(&u);
+    check(fake_cmtspeech_dl_held() == 0);
+
+    pa_object_unref(PA_OBJECT(call.source_output));
+    pa_object_unref(PA_OBJECT(call.sink_input));
+    pa_asyncmsgq_unref(call.source->asyncmsgq);
+    pa_object_unref(PA_OBJECT(call.source));
+    pa_object_unref(PA_OBJECT(call.sink));
+    pa_queue_free(call.voice_sideinfoq, NULL);
+
+    check(cmtspeech_close(c->cmtspeech) == 0);
+    c->cmtspeech = NULL;
+    fake_cmtspeech_done();
+
+    pa_rtpoll_item_free(c->cmt_poll_item);
+    pa_rtpoll_free(c->rtpoll);
+    pa_thread_mq_done(&c->thread_mq);
+    cmtspeech_dl_queue_free(c->dl_frame_queue);
+    pa_flist_free(c->dl_wrapper_flist, NULL);
+    pa_xfree(c->dl_wrappers);
+    pa_mutex_free(c->cmtspeech_mutex);
+    userdata = NULL;
+
+    pa_object_unref(PA_OBJECT(u.mainloop_handler));
+    pa_memblockq_free(u.dl_memblockq);
+    pa_queue_free(u.local_sideinfoq, NULL);
+    pa_silence_cache_done(&u.core->silence_cache);
+#if PA_CHECK_VERSION(9, 0, 0)
+    pa_mempool_unref(u.core->mempool);
+#else
+    pa_mempool_free(u.core->mempool);
+#endif
+    pa_xfree(u.core);
+    pa_mainloop_free(call.mainloop);
+}
+
+/* One cmtspeech thread wakeup for what the modem has sent, then the
+ * messages it posted are handled in the main and source IO threads */
+static void cmtspeech_thread_wakeup(void) {
+    struct cmtspeech_connection *c = &u.cmt_connection;
+    struct pollfd *pollfd = pa_rtpoll_item_get_pollfd(c->cmt_poll_item, NULL);
+
+    if (!fake_cmtspeech_pending())
+        return;
+
+    c->wakeup_time = pa_rtclock_now();
+    while (fake_cmtspeech_pending()) {
+        pollfd->revents = POLLIN;
+        check(mainloop_cmtspeech(&u) == 1);
+    }
+
+    while (pa_asyncmsgq_process_one(c->thread_mq.outq) > 0)
+        ;
+    while (pa_asyncmsgq_process_one(call.source->asyncmsgq) > 0)
+        ;
+}
+
+static void modem_dl_frame(void) {
+    check(fake_cmtspeech_dl_frame(CMTSPEECH_SPC_FLAGS_SPEECH, ++call.dl_seq) == 0);
+}
+
+static void modem_dl_period(void) {
+    if (call.dl_lose) {
+        call.dl_lose--;
+        call.dl_seq++;
+        return;
+    }
+
+    if (call.dl_hold) {
+        call.dl_hold--;
+        call.dl_held++;
+        return;
+    }
+
+    for (; call.dl_held > 0; call.dl_held--)
+        modem_dl_frame();
+    modem_dl_frame();
+}
+
+/* Voice sink IO thread: one 20 ms frame, DL frames in order, one side
+ * info entry for it */
+static void voice_sink_pop(void) {
+    pa_memchunk chunk;
+    const int16_t *d;
+    unsigned flags;
+    bool silent;
+
+    if (!u.sink_input)
+        return;
+
+    call.dl_latency = cmtspeech_sink_input_dl_latency(&u);
+
+    /* DL not active, the sink plays its own silence */
+    if (call.sink_input->pop(call.sink_input, u.sink_frame_size, &chunk) < 0)
+        return;
+
+    check(chunk.length == u.sink_frame_size);
+    d = (const int16_t *) ((const uint8_t *) pa_memblock_acquire(chunk.memblock) + chunk.index);
+    silent = d[0] == 0;
+    if (!silent) {
+        check(d[0] > call.last_served);
+        check(d[chunk.length / sizeof(int16_t) - 1] == d[0]);
+        call.last_served = d[0];
+    }
+    pa_memblock_release(chunk.memblock);
+    pa_memblock_unref(chunk.memblock);
+
+    call.pops++;
+    if (silent)
+        call.silent++;
+    else {
+        call.served++;
+        if (call.dl_latency > call.dl_latency_max)
+            call.dl_latency_max = call.dl_latency;
+    }
+
+    check(!pa_queue_isempty(call.voice_sideinfoq));
+    flags = PA_PTR_TO_UINT(pa_queue_pop(call.voice_sideinfoq));
+    check(pa_queue_isempty(call.voice_sideinfoq));
+    if (silent)
+        check(flags & VOICE_SIDEINFO_FLAG_BAD);
+    else
+        check(flags & VOICE_SIDEINFO_FLAG_SPEECH);
+}
+
+/* Voice source IO thread: one 20 ms frame */
+static void voice_source_push(void) {
+    pa_memchunk chunk;
+    int16_t *d;
+    unsigned n;
+
+    if (!u.source_output)
+        return;
+
+    chunk.memblock = pa_memblock_new(u.core->mempool, u.ul_stream_frame_size);
+    chunk.index = 0;
+    chunk.length = u.ul_stream_frame_size;
+    d = pa_memblock_acquire(chunk.memblock);
+    call.ul_seq++;
+    for (n = 0; n < chunk.length / sizeof(int16_t); n++)
+        d[n] = call.ul_seq;
+    pa_memblock_release(chunk.memblock);
+
+    call.source_output->push(call.source_output, &chunk);
+    pa_memblock_unref(chunk.memblock);
+
+    if (pa_atomic_load(&u.cmt_connection.ul_active)) {
+        call.pushes++;
+        call.ul_sent = call.ul_seq;
+        call.ul_latency = cmtspeech_ul_drift_latency(&u);
+    }
+}
+
+static void trace_apply(const struct trace_step *s) {
+    pa_usec_t deadline;
+
+    switch (s->op) {
+        case TRACE_CALL_CONNECT:
+            fake_cmtspeech_state(CMTSPEECH_STATE_CONNECTED, 0);
+            break;
+        case TRACE_SPEECH_START:
+            fake_cmtspeech_state(CMTSPEECH_STATE_ACTIVE_DL, CMTSPEECH_SPEECH_CONFIG_REQ);
+            call.speech = true;
+            break;
+        case TRACE_UL_START:
+            fake_cmtspeech_state(CMTSPEECH_STATE_ACTIVE_DLUL, CMTSPEECH_TIMING_CONFIG_NTF);
+            deadline = (UL_DEADLINE_PHASE + PERIOD - pa_rtclock_now() % PERIOD) % PERIOD;
+            fake_cmtspeech_timing((unsigned) (deadline / PA_USEC_PER_MSEC),
+                                  (unsigned) (deadline % PA_USEC_PER_MSEC));
+            break;
+        case TRACE_DL_LOSE:
+            call.dl_lose = s->arg;
+            break;
+        case TRACE_DL_HOLD:
+            call.dl_hold = s->arg;
+            break;
+        case TRACE_SPEECH_STOP:
+            fake_cmtspeech_state(CMTSPEECH_STATE_CONNECTED, CMTSPEECH_SPEECH_CONFIG_REQ);
+            call.speech = false;
+            break;
+        case TRACE_CALL_DISCONNECT:
+            fake_cmtspeech_state(CMTSPEECH_STATE_DISCONNECTED, 0);
+            break;
+        case TRACE_END:
+            pa_assert_not_reached();
+    }
+}
+
+/* Runs the trace in 1 ms steps until its end */
+static void run(const struct trace_step *trace) {
+    unsigned ms;
+
+    for (ms = 0;; ms++) {
+        pa_usec_t now = START + ms * PA_USEC_PER_MSEC;
+
+        fake_clock_set(now);
+
+        for (; trace->ms == ms; trace++) {
+            if (trace->op == TRACE_END)
+                return;
+            trace_apply(trace);
+        }
+
+        if (call.speech && now % PERIOD == DL_PHASE)
+            modem_dl_period();
+
+        cmtspeech_thread_wakeup();
+
+        if (now % PERIOD == POP_PHASE)
+            voice_sink_pop();
+        if (now % PERIOD == PUSH_PHASE)
+            voice_source_push();
+    }
+}
+
+/* A call without modem hiccups: streams follow the modem state, every DL
+ * frame is played one frame after it arrived and every UL frame reaches
+ * the modem */
+static void test_steady_call(void) {
+    static const struct trace_step trace[] = {
+        {    0, TRACE_CALL_CONNECT, 0 },
+        {  100, TRACE_SPEECH_START, 0 },
+        {  200, TRACE_UL_START, 0 },
+        { 2100, TRACE_SPEECH_STOP, 0 },
+        { 2200, TRACE_CALL_DISCONNECT, 0 },
+        { 2300, TRACE_END, 0 }
+    };
+    static const int msgs[] = {
+        CMTSPEECH_MAINLOOP_HANDLER_CREATE_STREAMS,
+        CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_CONNECT,
+        CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_CONNECT,
+        CMTSPEECH_MAINLOOP_HANDLER_CMT_DL_DISCONNECT,
+        CMTSPEECH_MAINLOOP_HANDLER_CMT_UL_DISCONNECT,
+        CMTSPEECH_MAINLOOP_HANDLER_CALL_REPORT,
+        CMTSPEECH_MAINLOOP_HANDLER_DELETE_STREAMS
+    };
+    unsigned i;
+
+    setup();
+    run(trace);
+
+    check(call.msg_count == PA_ELEMENTSOF(msgs));
+    for (i = 0; i < PA_ELEMENTSOF(msgs); i++)
+        check(call.msgs[i] == msgs[i]);
+    check(!pa_atomic_load(&u.cmt_connection.dl_active));
+    check(!pa_atomic_load(&u.cmt_connection.ul_active));
+
+    /* 2 s of speech, all of it played */
+    check(call.dl_seq == 100);
+    check(call.served == 100);
+    check(call.silent == 0);
+    check(pa_atomic_load(&u.call_metrics.dl_silent_frames) == 0);
+    check(pa_atomic_load(&u.call_metrics.dl_drops) == 0);
+    check(call.dl_latency_max == PERIOD);
+
+    /* The timing notification reached the voice source and the source
+     * output, the UL waits 1 ms of held back samples and the 3 ms to the
+     * deadline */
+    check(call.pushes == 95);
+    check(fake_cmtspeech_ul_frames() == call.pushes);
+    check(fake_cmtspeech_ul_last() == call.ul_sent);
+    check(call.ul_latency == 4 * PA_USEC_PER_MSEC);
+    check(call.ul_deadlines == 1);
+    check(u.ul_drift.realigns == 0);
+
+    teardown();
+}
+
+/* Lost DL frames are each played as one silent frame, after which the
+ * DL latency is back where it was */
+static void test_dl_loss(void) {
+    static const struct trace_step trace[] = {
+        {    0, TRACE_CALL_CONNECT, 0 },
+        {  100, TRACE_SPEECH_START, 0 },
+        {  200, TRACE_UL_START, 0 },
+        { 1000, TRACE_DL_LOSE, 3 },
+        { 2100, TRACE_END, 0 }
+    };
+
+    setup();
+    run(trace);
+
+    check(call.dl_seq == 100);
+    check(call.served == 97);
+    check(call.silent == 3);
+    check(pa_atomic_load(&u.call_metrics.dl_silent_frames) == 3);
+    check(pa_atomic_load(&u.call_metrics.dl_drops) == 0);
+    check(call.dl_latency == PERIOD);
+    check(call.dl_latency_max == PERIOD);
+
+    teardown();
+}
+
+/* DL frames held back by the modem arrive in a burst after silent
+ * frames were played for them. The excess beyond the request and the
+ * two frames of slack is dropped, so the DL latency stays bounded. */
+static void test_dl_burst(void) {
+    static const struct trace_step trace[] = {
+        {    0, TRACE_CALL_CONNECT, 0 },
+        {  100, TRACE_SPEECH_START, 0 },
+        {  200, TRACE_UL_START, 0 },
+        { 1000, TRACE_DL_HOLD, 3 },
+        { 2100, TRACE_END, 0 }
+    };
+
+    setup();
+    run(trace);
+
+    check(call.dl_seq == 100);
+    check(call.silent == 3);
+    check(pa_atomic_load(&u.call_metrics.dl_silent_frames) == 3);
+    check(pa_atomic_load(&u.call_metrics.dl_drops) == 1);
+    check(call.dl_latency_max == 4 * PERIOD);
+
+    /* The slack stays in the buffer, two frames more latency than
+     * before the burst */
+    check(call.dl_latency == 3 * PERIOD);
+    check(call.served == 100 - 1 - 2);
+
+    teardown();
+}
+
+int main(int argc, char *argv[]) {
+    test_steady_call();
+    test_dl_loss();
+    test_dl_burst();
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/thread.h>
+
+#include "cmtspeech-dl-queue.h"
+#include "cmtspeech-test.h"
+
+#define STRESS_FRAMES (200000)
+
+static int frame[STRESS_FRAMES];
+
+static void test_fifo(void) {
+    cmtspeech_dl_queue *q = cmtspeech_dl_queue_new(4, true);
+    void *dropped;
+    int i;
+
+    check(cmtspeech_dl_queue_pop(q) == NULL);
+
+    for (i = 0; i < 3; i++) {
+        check(cmtspeech_dl_queue_push(q, &frame[i], &dropped) == 0);
+        check(dropped == NULL);
+    }
+    check(cmtspeech_dl_queue_length(q) == 3);
+
+    for (i = 0; i < 3; i++)
+        check(cmtspeech_dl_queue_pop(q) == &frame[i]);
+    check(cmtspeech_dl_queue_pop(q) == NULL);
+    check(cmtspeech_dl_queue_length(q) == 0);
+    check(cmtspeech_dl_queue_overflows(q) == 0);
+
+    cmtspeech_dl_queue_free(q);
+}
+
+static void test_drop_oldest(void) {
+    cmtspeech_dl_queue *q = cmtspeech_dl_queue_new(2, true);
+    void *dropped;
+
+    check(cmtspeech_dl_queue_push(q, &frame[0], &dropped) == 0);
+    check(cmtspeech_dl_queue_push(q, &frame[1], &dropped) == 0);
+    check(cmtspeech_dl_queue_push(q, &frame[2], &dropped) == 0);
+    check(dropped == &frame[0]);
+    check(cmtspeech_dl_queue_length(q) == 2);
+    check(cmtspeech_dl_queue_overflows(q) == 1);
+
+    check(cmtspeech_dl_queue_pop(q) == &frame[1]);
+    check(cmtspeech_dl_queue_pop(q) == &frame[2]);
+
+    cmtspeech_dl_queue_free(q);
+}
+
+static void test_drop_newest(void) {
+    cmtspeech_dl_queue *q = cmtspeech_dl_queue_new(2, false);
+    void *dropped;
+
+    check(cmtspeech_dl_queue_push(q, &frame[0], &dropped) == 0);
+    check(cmtspeech_dl_queue_push(q, &frame[1], &dropped) == 0);
+    check(cmtspeech_dl_queue_push(q, &frame[2], &dropped) < 0);
+    check(dropped == NULL);
+    check(cmtspeech_dl_queue_overflows(q) == 1);
+
+    check(cmtspeech_dl_queue_pop(q) == &frame[0]);
+    check(cmtspeech_dl_queue_pop(q) == &frame[1]);
+    check(cmtspeech_dl_queue_pop(q) == NULL);
+
+    cmtspeech_dl_queue_free(q);
+}
+
+/* One producer reclaiming the oldest entries against a consumer on
+ * another thread: every frame is either popped or dropped, exactly
+ * once, and pops keep the push order. */
+
+struct stress {
+    cmtspeech_dl_queue *q;
+    pa_atomic_t done;
+    unsigned char seen[STRESS_FRAMES];
+    unsigned popped;
+};
+
+static void stress_consumer(void *userdata) {
+    struct stress *s = userdata;
+    long i, last = 0;
+    int *p;
+
+    for (;;) {
+        bool done = pa_atomic_load(&s->done);
+
+        while ((p = cmtspeech_dl_queue_pop(s->q))) {
+            i = p - frame;
+            check(s->popped == 0 || i > last);
+            last = i;
+            s->seen[i]++;
+            s->popped++;
+        }
+
+        if (done)
+            break;
+    }
+}
+
+static void test_stress(void) {
+    struct stress *s = pa_xnew0(struct stress, 1);
+    pa_thread *consumer;
+    unsigned dropped_count = 0;
+    void *dropped;
+    int i;
+
+    s->q = cmtspeech_dl_queue_new(4, true);
+    consumer = pa_thread_new("dl-queue-consumer", stress_consumer, s);
+
+    for (i = 0; i < STRESS_FRAMES; i++) {
+        check(cmtspeech_dl_queue_push(s->q, &frame[i], &dropped) == 0);
+        if (dropped) {
+            s->seen[(int *) dropped - frame]++;
+            dropped_count++;
+        }
+    }
+    pa_atomic_store(&s->done, 1);
+    pa_thread_free(consumer);
+
+    check(s->popped + dropped_count == STRESS_FRAMES);
+    check(cmtspeech_dl_queue_overflows(s->q) == dropped_count);
+    for (i = 0; i < STRESS_FRAMES; i++)
+        check(s->seen[i] == 1);
+
+    cmtspeech_dl_queue_free(s->q);
+    pa_xfree(s);
+}
+
+int main(int argc, char *argv[]) {
+    test_fifo();
+    test_drop_oldest();
+    test_drop_newest();
+    test_stress();
+
+    return 0;
+}
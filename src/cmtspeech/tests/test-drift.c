@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "cmtspeech-drift.h"
+#include "cmtspeech-test.h"
+
+#define PERIOD (20 * PA_USEC_PER_MSEC)
+#define START  (PA_USEC_PER_SEC)
+
+/* Feeds DL arrivals of a modem clock off by ppm. Wakeups are up to 1 ms
+ * late, every 50th by 8 ms more, and every 7th frame is missing. */
+static void feed(struct cmtspeech_drift *d, double ppm, unsigned frames, unsigned *seed) {
+    unsigned i;
+
+    for (i = 0; i < frames; i++) {
+        double t = START + (double) i * PERIOD * (1.0 + ppm * 1e-6);
+        unsigned late = test_random(seed) % 1000;
+
+        if (test_random(seed) % 7 == 3)
+            continue;
+        if (test_random(seed) % 50 == 0)
+            late += 8000;
+
+        cmtspeech_drift_dl_frame(d, (pa_usec_t) t + late, PERIOD);
+    }
+}
+
+static void test_converges(double ppm) {
+    struct cmtspeech_drift d;
+    unsigned seed = 1;
+    double est, err;
+
+    memset(&d, 0, sizeof(d));
+    cmtspeech_drift_reset(&d);
+
+    /* Nothing is published before enough frames */
+    feed(&d, ppm, 100, &seed);
+    check(!cmtspeech_drift_get(&d, &est, &err));
+
+    cmtspeech_drift_reset(&d);
+    feed(&d, ppm, 30000, &seed);
+    check(cmtspeech_drift_get(&d, &est, &err));
+    check_near(est, ppm, 2.0);
+    check(err > 0.0 && err < 5.0);
+
+    /* Late wakeups are left out, not counted as frames */
+    check(d.rejected > 0);
+    check(d.rejected < 30000 / 20);
+}
+
+/* Arrivals that move to another phase of the frame grid for good start
+ * a new fit instead of being left out forever */
+static void test_off_grid_restart(void) {
+    struct cmtspeech_drift d;
+    unsigned i;
+    double est;
+
+    memset(&d, 0, sizeof(d));
+    cmtspeech_drift_reset(&d);
+
+    for (i = 0; i < 500; i++)
+        cmtspeech_drift_dl_frame(&d, START + i * PERIOD, PERIOD);
+    check(cmtspeech_drift_get(&d, &est, NULL));
+    check_near(est, 0.0, 0.5);
+
+    for (i = 500; i < 520; i++)
+        cmtspeech_drift_dl_frame(&d, START + i * PERIOD + PERIOD / 2, PERIOD);
+    check(d.count < 20);
+    check(!cmtspeech_drift_get(&d, NULL, NULL));
+}
+
+/* A pause longer than the gap also starts over */
+static void test_gap_restart(void) {
+    struct cmtspeech_drift d;
+    unsigned i;
+
+    memset(&d, 0, sizeof(d));
+    cmtspeech_drift_reset(&d);
+
+    for (i = 0; i < 300; i++)
+        cmtspeech_drift_dl_frame(&d, START + i * PERIOD, PERIOD);
+    check(cmtspeech_drift_get(&d, NULL, NULL));
+
+    cmtspeech_drift_dl_frame(&d, START + 300 * PERIOD + 11 * PA_USEC_PER_SEC, PERIOD);
+    check(d.count == 1);
+    check(!cmtspeech_drift_get(&d, NULL, NULL));
+}
+
+/* UL deadlines from timing notifications give the drift on their own */
+static void test_timing(void) {
+    struct cmtspeech_drift d;
+    unsigned k;
+
+    memset(&d, 0, sizeof(d));
+    cmtspeech_drift_reset(&d);
+
+    cmtspeech_drift_timing(&d, START, PERIOD);
+    check(!d.ntf_known);
+    for (k = 1; k < 4; k++)
+        cmtspeech_drift_timing(&d, (pa_usec_t) (START + k * 5e6 * (1.0 + 50e-6)), PERIOD);
+    check(d.ntf_known);
+    check(d.ntf_count == 4);
+    check_near(d.ntf_ppm, 50.0, 1.0);
+}
+
+int main(int argc, char *argv[]) {
+    test_converges(0.0);
+    test_converges(50.0);
+    test_converges(-120.0);
+    test_off_grid_restart();
+    test_gap_restart();
+    test_timing();
+
+    return 0;
+}
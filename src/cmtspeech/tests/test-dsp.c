@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/volume.h>
+
+#include "cmtspeech-dsp.h"
+#include "cmtspeech-test.h"
+
+/* The AGC and UL conditioning are checked sample for sample against a
+ * plain scalar model of the same fixed point arithmetic, which holds the
+ * NEON, SSE2 and plain C kernels to the same output. The program is
+ * built once with the platform kernels and once with
+ * CMTSPEECH_DSP_GENERIC. */
+
+#define FRAME       (160)
+#define MAX_FRAME   (400)
+
+static const char* const valid_modargs[] = {
+    "dl_agc",
+    "dl_agc_target",
+    "dl_agc_max_gain",
+    "ul_conditioning",
+    "ul_gain",
+    "ul_dc_removal",
+    NULL
+};
+
+static int32_t ref_db_to_q12(int32_t db) {
+    return (int32_t) (pa_sw_volume_to_linear(pa_sw_volume_from_dB((double) db)) * 4096 + 0.5);
+}
+
+static int16_t ref_clamp16(int64_t x) {
+    return (int16_t) (x < INT16_MIN ? INT16_MIN : x > INT16_MAX ? INT16_MAX : x);
+}
+
+struct ref_agc {
+    int32_t gain, target, max_gain;
+};
+
+static void ref_agc_init(struct ref_agc *r, int32_t target_db, int32_t max_gain_db) {
+    r->gain = 4096;
+    r->max_gain = PA_MIN(ref_db_to_q12(max_gain_db), INT16_MAX);
+    r->target = (int32_t) (ref_db_to_q12(target_db) * (int64_t) INT16_MAX / 4096);
+}
+
+static void ref_agc_process(struct ref_agc *r, int16_t *x, unsigned n, bool bad_frame) {
+    uint64_t sum = 0;
+    uint32_t rms;
+    int32_t gain = r->gain, g, step;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        sum += (uint64_t) ((int64_t) x[i] * x[i]);
+    rms = (uint32_t) sqrt((double) (sum / n));
+    while ((uint64_t) rms * rms > sum / n)
+        rms--;
+    while ((uint64_t) (rms + 1) * (rms + 1) <= sum / n)
+        rms++;
+
+    if (!bad_frame && rms >= 58) {
+        int32_t desired = (int32_t) PA_MIN(((int64_t) r->target << 12) / rms, (int64_t) r->max_gain);
+
+        desired = PA_MAX(desired, 4096 / 8);
+        gain += (desired - gain) >> (desired < gain ? 1 : 5);
+    }
+
+    step = (gain - r->gain) / (int32_t) PA_MAX(n / 8, 1U);
+    for (i = 0, g = r->gain; i < n; i++) {
+        int64_t y = ((int64_t) x[i] * g) >> 12;
+        int64_t a = y < 0 ? -y : y;
+
+        if (a > 23197)
+            a = 23197 + ((a - 23197) >> 2);
+        x[i] = ref_clamp16(y < 0 ? -a : a);
+        if ((i + 1) % 8 == 0)
+            g += step;
+    }
+
+    r->gain = gain;
+}
+
+static void noise(int16_t *x, unsigned n, int amplitude, unsigned *seed) {
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        x[i] = ref_clamp16((int) (test_random(seed) % (2 * amplitude + 1)) - amplitude);
+}
+
+static void sine(int16_t *x, unsigned n, double amplitude, double hz, unsigned *phase) {
+    unsigned i;
+
+    for (i = 0; i < n; i++, (*phase)++)
+        x[i] = ref_clamp16(lrint(amplitude * sin(2.0 * M_PI * hz * *phase / CMTSPEECH_SAMPLERATE)));
+}
+
+static double rms_db(const int16_t *x, unsigned n) {
+    double sum = 0.0;
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        sum += (double) x[i] * x[i];
+
+    return 10.0 * log10(sum / n / ((double) INT16_MAX * INT16_MAX));
+}
+
+static cmtspeech_agc *agc_new(const char *args) {
+    pa_modargs *ma = pa_modargs_new(args, valid_modargs);
+    cmtspeech_agc *agc;
+
+    check(ma);
+    check(cmtspeech_agc_new(ma, &agc) == 0);
+    pa_modargs_free(ma);
+
+    return agc;
+}
+
+static cmtspeech_ul_cond *ul_cond_new(const char *args) {
+    pa_modargs *ma = pa_modargs_new(args, valid_modargs);
+    cmtspeech_ul_cond *cond;
+
+    check(ma);
+    check(cmtspeech_ul_cond_new(ma, &cond) == 0);
+    pa_modargs_free(ma);
+
+    return cond;
+}
+
+/* Odd frame lengths exercise the scalar tails, full scale and quiet
+ * frames in turn drive the gain and the limiter to their ends */
+static void test_agc_kernels(void) {
+    static const unsigned lengths[] = { 160, 320, 163, 7, 8, 400, 17 };
+    static const int levels[] = { 32768, 200, 40, 12000, 32768, 1000, 30 };
+    cmtspeech_agc *agc = agc_new("dl_agc=1 dl_agc_max_gain=18");
+    struct ref_agc ref;
+    int16_t x[MAX_FRAME], y[MAX_FRAME];
+    unsigned seed = 1, f, i;
+
+    ref_agc_init(&ref, CMTSPEECH_AGC_TARGET_DB, 18);
+
+    for (f = 0; f < 700; f++) {
+        unsigned n = lengths[f % PA_ELEMENTSOF(lengths)];
+        bool bad = f % 13 == 0;
+
+        noise(x, n, levels[(f / 3) % PA_ELEMENTSOF(levels)], &seed);
+        memcpy(y, x, n * sizeof(int16_t));
+
+        cmtspeech_agc_process(agc, x, n, bad);
+        ref_agc_process(&ref, y, n, bad);
+        for (i = 0; i < n; i++)
+            check(x[i] == y[i]);
+    }
+
+    cmtspeech_agc_free(agc);
+}
+
+static void test_agc_levels(void) {
+    cmtspeech_agc *agc;
+    int16_t x[FRAME];
+    unsigned phase = 0, f;
+
+    /* Loud speech is brought down to the target */
+    agc = agc_new("dl_agc=1");
+    for (f = 0; f < 300; f++) {
+        sine(x, FRAME, 16384, 440, &phase);
+        cmtspeech_agc_process(agc, x, FRAME, false);
+    }
+    check_near(rms_db(x, FRAME), CMTSPEECH_AGC_TARGET_DB, 1.0);
+
+    /* Quiet speech is raised no more than the maximum gain */
+    cmtspeech_agc_reset(agc);
+    for (f = 0; f < 300; f++) {
+        sine(x, FRAME, 328, 440, &phase);
+        cmtspeech_agc_process(agc, x, FRAME, false);
+    }
+    check_near(rms_db(x, FRAME), 20.0 * log10(328.0 / INT16_MAX) - 3.01 + CMTSPEECH_AGC_MAX_GAIN_DB, 0.5);
+    cmtspeech_agc_free(agc);
+
+    /* Bad frames and the noise floor leave the gain alone */
+    agc = agc_new("dl_agc=1");
+    for (f = 0; f < 100; f++) {
+        sine(x, FRAME, 16384, 440, &phase);
+        cmtspeech_agc_process(agc, x, FRAME, true);
+        check_near(rms_db(x, FRAME), 20.0 * log10(16384.0 / INT16_MAX) - 3.01, 0.1);
+        sine(x, FRAME, 40, 440, &phase);
+        cmtspeech_agc_process(agc, x, FRAME, false);
+        check_near(rms_db(x, FRAME), 20.0 * log10(40.0 / INT16_MAX) - 3.01, 0.3);
+    }
+    cmtspeech_agc_free(agc);
+
+    /* Disabled unless asked for */
+    check(agc_new("") == NULL);
+}
+
+/* dst = clamp((src - dc) * gain), dc from the means of earlier frames */
+static void test_ul_cond(void) {
+    static const unsigned lengths[] = { 160, 163, 7, 320 };
+    cmtspeech_ul_cond *cond = ul_cond_new("ul_conditioning=1 ul_gain=6");
+    const int32_t gain = ref_db_to_q12(6);
+    int16_t src[MAX_FRAME], dst[MAX_FRAME];
+    int32_t dc = 0;
+    unsigned seed = 1, f, i;
+
+    for (f = 0; f < 400; f++) {
+        unsigned n = lengths[f % PA_ELEMENTSOF(lengths)];
+        int offset = f < 200 ? 3000 : -32768;
+        int64_t sum = 0;
+
+        noise(src, n, f % 7 == 0 ? 32767 : 2000, &seed);
+        for (i = 0; i < n; i++)
+            src[i] = ref_clamp16(src[i] + offset);
+
+        /* In two parts as from ul drift compensation */
+        cmtspeech_ul_cond_copy(cond, dst, src, n / 2);
+        cmtspeech_ul_cond_copy(cond, dst + n / 2, src + n / 2, n - n / 2);
+        cmtspeech_ul_cond_frame_done(cond);
+
+        for (i = 0; i < n; i++) {
+            check(dst[i] == ref_clamp16((ref_clamp16(src[i] - (dc >> 8)) * gain) >> 12));
+            sum += src[i];
+        }
+        dc += ((int32_t) ((sum << 8) / n) - dc) >> 5;
+    }
+    cmtspeech_ul_cond_free(cond);
+
+    /* The DC is gone after a while, the rest has the gain */
+    cond = ul_cond_new("ul_conditioning=1 ul_gain=6");
+    for (f = 0; f < 500; f++) {
+        unsigned phase = 0;
+
+        sine(src, FRAME, 1000, 400, &phase);
+        for (i = 0; i < FRAME; i++)
+            src[i] += 2000;
+        cmtspeech_ul_cond_copy(cond, dst, src, FRAME);
+        cmtspeech_ul_cond_frame_done(cond);
+    }
+    for (i = 0, dc = 0; i < FRAME; i++)
+        dc += dst[i];
+    check_near((double) dc / FRAME, 0.0, 20.0);
+    check_near(rms_db(dst, FRAME), 20.0 * log10(1000.0 / INT16_MAX) - 3.01 + 6.0, 0.2);
+    cmtspeech_ul_cond_free(cond);
+
+    check(ul_cond_new("") == NULL);
+}
+
+int main(int argc, char *argv[]) {
+    test_agc_kernels();
+    test_agc_levels();
+    test_ul_cond();
+
+    return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include "module-meego-cmtspeech.h"
+#include "cmtspeech-resampler.h"
+#include "cmtspeech-test.h"
+
+/* The converters are linear and periodic: the output for any input is
+ * the sum of the responses to its samples. The responses are measured
+ * with impulses of one coefficient unit, which gives back the Q14
+ * coefficients exactly, and a plain C convolution with them must then
+ * match the NEON, SSE2 or plain C dot products sample for sample. The
+ * program is built once with the platform kernels and once with
+ * CMTSPEECH_DSP_GENERIC. */
+
+#define FRAME       (160)           /* modem rate samples */
+#define UNIT        (1 << 14)
+#define MAX_FACTOR  (6)
+#define TAIL        (64)            /* outputs, longer than any filter */
+
+struct response {
+    unsigned in_step;               /* inputs per output step */
+    unsigned out_step;              /* outputs per input step */
+    int32_t h[MAX_FACTOR][TAIL * MAX_FACTOR];
+    unsigned len;
+};
+
+static void measure(cmtspeech_resampler *r, unsigned factor, bool up, struct response *resp) {
+    unsigned n = up ? TAIL : TAIL * factor, k, i;
+    int16_t *in = pa_xnew0(int16_t, n), *out = pa_xnew0(int16_t, n * factor);
+
+    resp->in_step = up ? 1 : factor;
+    resp->out_step = up ? factor : 1;
+    resp->len = up ? n * factor : n / factor;
+
+    for (k = 0; k < resp->in_step; k++) {
+        cmtspeech_resampler_reset(r);
+        memset(in, 0, n * sizeof(int16_t));
+        in[k] = UNIT;
+        check(cmtspeech_resampler_run(r, out, in, n) == resp->len);
+        for (i = 0; i < resp->len; i++)
+            resp->h[k][i] = out[i];
+    }
+
+    pa_xfree(in);
+    pa_xfree(out);
+}
+
+static void reference(const struct response *resp, const int16_t *in, unsigned n, int16_t *out, unsigned out_len) {
+    unsigned o, s;
+
+    for (o = 0; o < out_len; o++) {
+        int64_t sum = 0;
+
+        for (s = 0; s < n; s++) {
+            unsigned shift = (s / resp->in_step) * resp->out_step;
+
+            if (o >= shift && o - shift < resp->len)
+                sum += (int64_t) in[s] * resp->h[s % resp->in_step][o - shift];
+        }
+
+        sum = (sum + UNIT / 2) >> 14;
+        out[o] = (int16_t) PA_CLAMP(sum, INT16_MIN, INT16_MAX);
+    }
+}
+
+static void test_kernels(unsigned factor, bool up) {
+    const unsigned max_input = up ? FRAME : FRAME * factor;
+    cmtspeech_resampler *r = cmtspeech_resampler_new(factor, up, max_input, 0);
+    struct response *resp = pa_xnew0(struct response, 1);
+    const unsigned n = 3 * max_input;
+    const unsigned out_len = up ? n * factor : n / factor;
+    int16_t *in = pa_xnew(int16_t, n), *out = pa_xnew(int16_t, out_len), *ref = pa_xnew(int16_t, out_len);
+    unsigned seed = factor, i, done;
+
+    measure(r, factor, up, resp);
+
+    /* Loud enough to saturate at times */
+    for (i = 0; i < n; i++)
+        in[i] = (int16_t) ((int) test_random(&seed) * 2 - 32768);
+
+    /* In several runs, the history carries over */
+    cmtspeech_resampler_reset(r);
+    for (done = 0, i = 0; done < n; done += max_input)
+        i += cmtspeech_resampler_run(r, out + i, in + done, max_input);
+    check(i == out_len);
+
+    reference(resp, in, n, ref, out_len);
+    for (i = 0; i < out_len; i++)
+        check(out[i] == ref[i]);
+
+    pa_xfree(in);
+    pa_xfree(out);
+    pa_xfree(ref);
+    pa_xfree(resp);
+    cmtspeech_resampler_free(r);
+}
+
+static double tone_gain_db(unsigned factor, bool up, double hz) {
+    const unsigned max_input = up ? FRAME : FRAME * factor;
+    const double in_rate = CMTSPEECH_SAMPLERATE * (up ? 1 : factor);
+    cmtspeech_resampler *r = cmtspeech_resampler_new(factor, up, max_input, 0);
+    const unsigned out_len = up ? max_input * factor : max_input / factor;
+    int16_t *in = pa_xnew(int16_t, max_input), *out = pa_xnew(int16_t, out_len);
+    double in_sum = 0.0, out_sum = 0.0;
+    unsigned f, i, phase = 0;
+
+    for (f = 0; f < 10; f++) {
+        for (i = 0; i < max_input; i++, phase++) {
+            in[i] = (int16_t) lrint(10000.0 * sin(2.0 * M_PI * hz * phase / in_rate));
+            if (f > 0)
+                in_sum += (double) in[i] * in[i];
+        }
+        check(cmtspeech_resampler_run(r, out, in, max_input) == out_len);
+        for (i = 0; f > 0 && i < out_len; i++)
+            out_sum += (double) out[i] * out[i];
+    }
+
+    pa_xfree(in);
+    pa_xfree(out);
+    cmtspeech_resampler_free(r);
+
+    /* Per sample power, the rates differ */
+    return 10.0 * log10((out_sum / (9.0 * out_len)) / (in_sum / (9.0 * max_input)));
+}
+
+static void test_response(unsigned factor) {
+    /* Speech band passes */
+    check_near(tone_gain_db(factor, true, 300), 0.0, 0.5);
+    check_near(tone_gain_db(factor, true, 1000), 0.0, 0.5);
+    check_near(tone_gain_db(factor, false, 300), 0.0, 0.5);
+    check_near(tone_gain_db(factor, false, 1000), 0.0, 0.5);
+
+    /* What would alias into the modem band is stopped */
+    if (factor > 2)
+        check(tone_gain_db(factor, false, 6000) < -40.0);
+    check(tone_gain_db(factor, false, CMTSPEECH_SAMPLERATE - 1000) < -40.0);
+}
+
+static void test_delay(unsigned factor) {
+    cmtspeech_resampler *r = cmtspeech_resampler_new(factor, true, FRAME, 0);
+    struct response *resp = pa_xnew0(struct response, 1);
+    unsigned i, peak = 0;
+    double usec;
+
+    measure(r, factor, true, resp);
+    for (i = 0; i < resp->len; i++)
+        if (resp->h[0][i] > resp->h[0][peak])
+            peak = i;
+
+    /* The reported delay is the peak of the impulse response */
+    usec = (double) peak * PA_USEC_PER_SEC / (CMTSPEECH_SAMPLERATE * factor);
+    check_near((double) cmtspeech_resampler_delay(r), usec, 0.5 * PA_USEC_PER_SEC / (CMTSPEECH_SAMPLERATE * factor) + 1);
+
+    pa_xfree(resp);
+    cmtspeech_resampler_free(r);
+}
+
+/* A rewound run is converted again as it was the first time, also
+ * across silence, and rewinding further than the snapshots go starts
+ * from silence */
+static void test_rewind(unsigned factor) {
+    const unsigned runs = 4, out_len = FRAME * factor;
+    cmtspeech_resampler *r = cmtspeech_resampler_new(factor, true, FRAME, runs);
+    int16_t *in = pa_xnew(int16_t, 3 * FRAME), *out = pa_xnew(int16_t, 3 * out_len), *again = pa_xnew(int16_t, out_len);
+    unsigned seed = factor, i;
+
+    for (i = 0; i < 3 * FRAME; i++)
+        in[i] = (int16_t) ((int) test_random(&seed) - 32768);
+
+    for (i = 0; i < 3; i++)
+        check(cmtspeech_resampler_run(r, out + i * out_len, in + i * FRAME, FRAME) == out_len);
+
+    check(cmtspeech_resampler_rewind(r, 2));
+    check(cmtspeech_resampler_run(r, again, in + FRAME, FRAME) == out_len);
+    check(memcmp(again, out + out_len, out_len * sizeof(int16_t)) == 0);
+
+    /* The frame after the first one again, once silence was served */
+    cmtspeech_resampler_silence(r, 2);
+    check(cmtspeech_resampler_rewind(r, 3));
+    check(cmtspeech_resampler_run(r, again, in + FRAME, FRAME) == out_len);
+    check(memcmp(again, out + out_len, out_len * sizeof(int16_t)) == 0);
+
+    /* Only the first frame and the one just converted are kept now */
+    check(!cmtspeech_resampler_rewind(r, 3));
+    check(cmtspeech_resampler_run(r, again, in + FRAME, FRAME) == out_len);
+    cmtspeech_resampler_reset(r);
+    check(cmtspeech_resampler_run(r, out, in + FRAME, FRAME) == out_len);
+    check(memcmp(again, out, out_len * sizeof(int16_t)) == 0);
+
+    pa_xfree(in);
+    pa_xfree(out);
+    pa_xfree(again);
+    cmtspeech_resampler_free(r);
+}
+
+int main(int argc, char *argv[]) {
+    static const unsigned factors[] = { 2, 3, 6 };
+    unsigned i;
+
+    check(cmtspeech_resampler_factor(CMTSPEECH_SAMPLERATE) == 1);
+    check(cmtspeech_resampler_factor(48000) == 6);
+    check(cmtspeech_resampler_factor(44100) == 0);
+
+    for (i = 0; i < PA_ELEMENTSOF(factors); i++) {
+        test_kernels(factors[i], true);
+        test_kernels(factors[i], false);
+        test_response(factors[i]);
+        test_delay(factors[i]);
+        test_rewind(factors[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "cmtspeech-timers.h"
+#include "cmtspeech-test.h"
+
+/* The rtpoll timer calls are recorded instead of running a real rtpoll,
+ * these override the pulsecore ones */
+
+struct pa_rtpoll {
+    pa_usec_t timer;                /* 0 when disabled */
+    unsigned programmed;
+    bool elapsed;
+};
+
+void pa_rtpoll_set_timer_absolute(pa_rtpoll *p, pa_usec_t usec) {
+    p->timer = usec;
+    p->programmed++;
+}
+
+void pa_rtpoll_set_timer_disabled(pa_rtpoll *p) {
+    p->timer = 0;
+    p->programmed++;
+}
+
+bool pa_rtpoll_timer_elapsed(pa_rtpoll *p) {
+    return p->elapsed;
+}
+
+static struct cmtspeech_timers t;
+static pa_rtpoll rtpoll;
+
+/* Runs the rtpoll up to now */
+static unsigned run(pa_usec_t now) {
+    cmtspeech_timers_program(&t, &rtpoll);
+    rtpoll.elapsed = rtpoll.timer > 0 && rtpoll.timer <= now;
+    return cmtspeech_timers_expire(&t, &rtpoll, now);
+}
+
+static void test_earliest(void) {
+    memset(&t, 0, sizeof(t));
+    memset(&rtpoll, 0, sizeof(rtpoll));
+
+    /* Nothing armed, nothing to program */
+    cmtspeech_timers_program(&t, &rtpoll);
+    check(rtpoll.programmed == 0);
+
+    cmtspeech_timer_set(&t, CMTSPEECH_TIMER_WATCHDOG, 3000);
+    cmtspeech_timer_set(&t, CMTSPEECH_TIMER_CLEANUP, 1000);
+    cmtspeech_timer_set(&t, CMTSPEECH_TIMER_STATS_FLUSH, 2000);
+    check(cmtspeech_timer_armed(&t, CMTSPEECH_TIMER_CLEANUP));
+    check(!cmtspeech_timer_armed(&t, CMTSPEECH_TIMER_RECONNECT));
+
+    check(run(500) == 0);
+    check(rtpoll.timer == 1000);
+    check(rtpoll.programmed == 1);
+
+    /* The rtpoll timer is left alone while the earliest stays */
+    check(run(600) == 0);
+    check(rtpoll.programmed == 1);
+
+    /* Expired deadlines are disarmed, the next one is programmed */
+    check(run(2500) == (CMTSPEECH_TIMER_BIT(CMTSPEECH_TIMER_CLEANUP) |
+                        CMTSPEECH_TIMER_BIT(CMTSPEECH_TIMER_STATS_FLUSH)));
+    check(!cmtspeech_timer_armed(&t, CMTSPEECH_TIMER_CLEANUP));
+    check(!cmtspeech_timer_armed(&t, CMTSPEECH_TIMER_STATS_FLUSH));
+    check(cmtspeech_timer_armed(&t, CMTSPEECH_TIMER_WATCHDOG));
+
+    check(run(2600) == 0);
+    check(rtpoll.timer == 3000);
+
+    /* Cleared deadlines are not programmed, with none left the timer
+     * is disabled */
+    cmtspeech_timer_set(&t, CMTSPEECH_TIMER_RECONNECT, 2700);
+    cmtspeech_timer_clear(&t, CMTSPEECH_TIMER_RECONNECT);
+    cmtspeech_timer_clear(&t, CMTSPEECH_TIMER_WATCHDOG);
+    check(run(4000) == 0);
+    check(rtpoll.timer == 0);
+}
+
+/* An elapsed rtpoll timer is reprogrammed even to the same deadline,
+ * rtpoll would otherwise spin on it */
+static void test_stale(void) {
+    unsigned programmed;
+
+    memset(&t, 0, sizeof(t));
+    memset(&rtpoll, 0, sizeof(rtpoll));
+
+    cmtspeech_timer_set(&t, CMTSPEECH_TIMER_WATCHDOG, 1000);
+    check(run(1000) == CMTSPEECH_TIMER_BIT(CMTSPEECH_TIMER_WATCHDOG));
+
+    cmtspeech_timer_set(&t, CMTSPEECH_TIMER_WATCHDOG, 1000);
+    programmed = rtpoll.programmed;
+    cmtspeech_timers_program(&t, &rtpoll);
+    check(rtpoll.programmed == programmed + 1);
+    check(rtpoll.timer == 1000);
+
+    /* An elapsed timer with no deadline passed returns nothing */
+    cmtspeech_timer_set(&t, CMTSPEECH_TIMER_WATCHDOG, 5000);
+    rtpoll.elapsed = true;
+    check(cmtspeech_timers_expire(&t, &rtpoll, 1500) == 0);
+    check(cmtspeech_timer_armed(&t, CMTSPEECH_TIMER_WATCHDOG));
+}
+
+int main(int argc, char *argv[]) {
+    test_earliest();
+    test_stale();
+
+    return 0;
+}
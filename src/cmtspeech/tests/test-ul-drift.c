@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "cmtspeech-ul-drift.h"
+#include "cmtspeech-test.h"
+
+#define RATE        (8000)
+#define PERIOD      (20 * PA_USEC_PER_MSEC)
+#define FRAME       (160)
+#define RANGE       CMTSPEECH_UL_SLIP_DEFAULT
+#define NOMINAL     (RANGE / 2)
+
+static struct userdata u;
+static pa_source_output source_output;
+
+static void setup(void) {
+    memset(&u, 0, sizeof(u));
+    memset(&source_output, 0, sizeof(source_output));
+    u.ss.rate = RATE;
+    u.frame_usec = PERIOD;
+    u.source_output = &source_output;
+    u.ul_drift.range = RANGE;
+    cmtspeech_ul_drift_reset(&u);
+}
+
+static void ramp(int16_t *x, unsigned n, int start) {
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        x[i] = (int16_t) (start + (int) i);
+}
+
+/* Without slips the copy is a plain delay of the held back samples */
+static void test_delay(void) {
+    int16_t in[FRAME], out[FRAME];
+    unsigned f, i;
+
+    setup();
+    check(cmtspeech_ul_drift_latency(&u) == NOMINAL * PA_USEC_PER_SEC / RATE);
+
+    for (f = 0; f < 3; f++) {
+        ramp(in, FRAME, 1 + (int) (f * FRAME));
+        cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, sizeof(in));
+        for (i = 0; i < FRAME; i++)
+            check(out[i] == (f == 0 && i < NOMINAL ? 0 : (int16_t) (1 + f * FRAME + i - NOMINAL)));
+    }
+}
+
+/* A slip changes the delay by exactly one sample, the inserted sample is
+ * the mean of its neighbours and a dropped one merges two samples */
+static void test_slips(void) {
+    int16_t in[FRAME], out[FRAME];
+    unsigned i;
+
+    setup();
+    ramp(in, FRAME, 1000);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, sizeof(in));
+
+    u.ul_drift.slip = 1;
+    ramp(in, FRAME, 1000 + FRAME);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, sizeof(in));
+    check(u.ul_drift.carry_len == NOMINAL + 1);
+    check(u.ul_drift.slips_inserted == 1);
+    check(u.ul_drift.slip == 0);
+
+    ramp(in, FRAME, 1000 + 2 * FRAME);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, sizeof(in));
+    /* The ramp sample last sent before the insert was 2 * FRAME -
+     * NOMINAL - 1, the inserted mean of it and the next one rounds down
+     * to the same value and the rest follows one sample later */
+    check(out[0] == (int16_t) (1000 + 2 * FRAME - NOMINAL - 1));
+    for (i = 1; i < FRAME; i++)
+        check(out[i] == out[i - 1] + 1);
+    check(out[FRAME - 1] == (int16_t) (1000 + 3 * FRAME - NOMINAL - 2));
+    check(cmtspeech_ul_drift_latency(&u) == (NOMINAL + 1) * PA_USEC_PER_SEC / RATE);
+
+    u.ul_drift.slip = -1;
+    ramp(in, FRAME, 1000 + 3 * FRAME);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, sizeof(in));
+    check(u.ul_drift.carry_len == NOMINAL);
+    check(u.ul_drift.slips_dropped == 1);
+
+    ramp(in, FRAME, 1000 + 4 * FRAME);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, sizeof(in));
+    /* The first two held back samples merged into their mean, rounded
+     * down, the stream then continues with the original delay */
+    check(out[0] == (int16_t) (1000 + 4 * FRAME - NOMINAL - 1));
+    check(out[1] == (int16_t) (1000 + 4 * FRAME - NOMINAL + 1));
+    for (i = 2; i < FRAME; i++)
+        check(out[i] == out[i - 1] + 1);
+}
+
+/* Frames too short to slip in do not abort and keep the slip pending */
+static void test_short_frames(void) {
+    int16_t in[FRAME], out[FRAME];
+    unsigned i;
+
+    setup();
+
+    ramp(in, NOMINAL - 1, 1);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, (NOMINAL - 1) * sizeof(int16_t));
+    for (i = 0; i < NOMINAL - 1; i++)
+        check(out[i] == in[i]);
+    check(u.ul_drift.carry_len == NOMINAL);
+
+    u.ul_drift.slip = 1;
+    ramp(in, RANGE, 1);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, RANGE * sizeof(int16_t));
+    check(u.ul_drift.carry_len == NOMINAL);
+    check(u.ul_drift.slip == 1);
+
+    ramp(in, FRAME, 1);
+    cmtspeech_ul_drift_copy(&u, (uint8_t *) out, (const uint8_t *) in, sizeof(in));
+    check(u.ul_drift.carry_len == NOMINAL + 1);
+    check(u.ul_drift.slip == 0);
+}
+
+/* Pushes at a fixed phase before the modem deadline, after the
+ * reference has been taken */
+static void push_at(pa_usec_t deadline, unsigned frames, pa_usec_t phase, unsigned *k) {
+    unsigned i;
+
+    for (i = 0; i < frames; i++, (*k)++)
+        cmtspeech_ul_drift_update(&u, deadline + *k * PERIOD + phase);
+}
+
+static void test_update(void) {
+    const pa_usec_t deadline = PA_USEC_PER_SEC;
+    pa_usec_t next;
+    unsigned k = 1;
+
+    setup();
+
+    cmtspeech_ul_drift_update(&u, deadline);
+    check(!cmtspeech_ul_drift_next_deadline(&u, deadline, &next));
+    check(u.ul_drift.slip == 0);
+
+    cmtspeech_ul_drift_set_deadline(&u, deadline);
+    check(cmtspeech_ul_drift_next_deadline(&u, deadline + 3 * PERIOD + 1, &next));
+    check(next == deadline + 4 * PERIOD);
+
+    /* Steady pushes 15 ms before the deadline need no slips */
+    push_at(deadline, 64, 5000, &k);
+    check(u.ul_drift.reference_slack == 15000);
+    check(u.ul_drift.slip == 0);
+
+    /* Pushes moving 250 usec earlier hold back 2 samples less */
+    push_at(deadline, 64, 4750, &k);
+    check(u.ul_drift.slip == -1);
+
+    /* Pushes moving 250 usec later hold back 2 samples more */
+    push_at(deadline, 128, 5250, &k);
+    check(u.ul_drift.slip == 1);
+
+    /* Beyond the slip range the voice source is realigned */
+    check(u.ul_drift.realigns == 0);
+    push_at(deadline, 64, 8000, &k);
+    check(u.ul_drift.realigns > 0);
+}
+
+int main(int argc, char *argv[]) {
+    test_delay();
+    test_slips();
+    test_short_frames();
+    test_update();
+
+    return 0;
+}
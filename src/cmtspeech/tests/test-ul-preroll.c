@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+
+#include "cmtspeech-connection.h"
+#include "cmtspeech-ul-drift.h"
+#include "cmtspeech-ul-preroll.h"
+#include "cmtspeech-test.h"
+
+#define PERIOD      (20 * PA_USEC_PER_MSEC)
+#define FRAME_SIZE  (320)
+#define DEADLINE    (10 * PA_USEC_PER_SEC)
+
+static const char* const valid_modargs[] = {
+    "ul_preroll_frames",
+    "ul_preroll_policy",
+    NULL
+};
+
+static struct userdata u;
+
+/* The modem side: frames are told apart by their first byte */
+static uint8_t sent[64];
+static unsigned sent_count;
+static int send_result;
+
+int cmtspeech_send_ul_frame(struct userdata *userdata, uint8_t *buf, size_t bytes) {
+    check(userdata == &u);
+    check(bytes == FRAME_SIZE);
+
+    if (send_result < 0)
+        return send_result;
+
+    check(sent_count < sizeof(sent));
+    sent[sent_count++] = buf[0];
+    return 0;
+}
+
+static int preroll_new(const char *args, cmtspeech_ul_preroll **preroll) {
+    pa_modargs *ma = pa_modargs_new(args, valid_modargs);
+    int r;
+
+    check(ma);
+    r = cmtspeech_ul_preroll_new(ma, FRAME_SIZE, PERIOD, preroll);
+    pa_modargs_free(ma);
+
+    return r;
+}
+
+/* UL starts at start, with modem UL deadlines from DEADLINE on */
+static void setup(const char *args, pa_usec_t start) {
+    memset(&u, 0, sizeof(u));
+    u.ss.rate = CMTSPEECH_SAMPLERATE;
+    u.frame_usec = PERIOD;
+    u.ul_frame_size = FRAME_SIZE;
+    u.ul_drift.range = CMTSPEECH_UL_SLIP_DEFAULT;
+    cmtspeech_ul_drift_reset(&u);
+    cmtspeech_ul_drift_set_deadline(&u, DEADLINE);
+    pa_atomic_store(&u.cmt_connection.ul_start_time, (int) (uint32_t) start);
+
+    check(preroll_new(args, &u.ul_preroll) == 0);
+    check(u.ul_preroll);
+
+    sent_count = 0;
+    send_result = 0;
+}
+
+static void teardown(void) {
+    cmtspeech_ul_preroll_log(u.ul_preroll);
+    cmtspeech_ul_preroll_free(u.ul_preroll);
+}
+
+static void hold(uint8_t id, pa_usec_t now) {
+    uint8_t frame[FRAME_SIZE];
+
+    memset(frame, id, sizeof(frame));
+    cmtspeech_ul_preroll_hold(u.ul_preroll, frame, now);
+}
+
+static int send_live(uint8_t id, pa_usec_t now) {
+    uint8_t frame[FRAME_SIZE];
+
+    memset(frame, id, sizeof(frame));
+    return cmtspeech_ul_preroll_send(&u, frame, now);
+}
+
+static void test_modargs(void) {
+    cmtspeech_ul_preroll *p;
+
+    /* Off by default */
+    check(preroll_new("", &p) == 0);
+    check(p == NULL);
+
+    check(preroll_new("ul_preroll_frames=17", &p) < 0);
+    check(preroll_new("ul_preroll_frames=4 ul_preroll_policy=later", &p) < 0);
+}
+
+/* Only the newest held frames that fit between the UL start and the
+ * deadline of the live frame go ahead of it */
+static void test_send_fit(void) {
+    const pa_usec_t start = DEADLINE - 1000;
+    uint8_t id;
+
+    setup("ul_preroll_frames=4", start);
+    check(cmtspeech_ul_preroll_latency(u.ul_preroll) == 0);
+
+    for (id = 1; id <= 4; id++)
+        hold(id, start - (5 - id) * 1000);
+    check(cmtspeech_ul_preroll_latency(u.ul_preroll) == 4 * PERIOD);
+
+    check(send_live(5, DEADLINE + 2 * PERIOD - 1000) == 0);
+    check(sent_count == 3);
+    check(sent[0] == 3 && sent[1] == 4 && sent[2] == 5);
+    check(cmtspeech_ul_preroll_latency(u.ul_preroll) == 0);
+
+    /* The rest was dropped, later frames go out alone */
+    check(send_live(6, DEADLINE + 3 * PERIOD - 1000) == 0);
+    check(sent_count == 4 && sent[3] == 6);
+
+    teardown();
+}
+
+/* The ring keeps the newest frames */
+static void test_hold_overflow(void) {
+    const pa_usec_t start = DEADLINE - 1000;
+    uint8_t id;
+
+    setup("ul_preroll_frames=2", start);
+
+    for (id = 1; id <= 4; id++)
+        hold(id, start - (5 - id) * 1000);
+    check(cmtspeech_ul_preroll_latency(u.ul_preroll) == 2 * PERIOD);
+
+    check(send_live(5, DEADLINE + 2 * PERIOD - 1000) == 0);
+    check(sent_count == 3);
+    check(sent[0] == 3 && sent[1] == 4 && sent[2] == 5);
+
+    teardown();
+}
+
+/* Without a modem deadline nothing is known to fit */
+static void test_no_deadline(void) {
+    setup("ul_preroll_frames=4", DEADLINE);
+    u.ul_drift.deadline_valid = false;
+
+    hold(1, DEADLINE - PERIOD);
+    check(send_live(2, DEADLINE + 4 * PERIOD) == 0);
+    check(sent_count == 1 && sent[0] == 2);
+
+    teardown();
+}
+
+static void test_drop_policy(void) {
+    const pa_usec_t start = DEADLINE - 1000;
+
+    setup("ul_preroll_frames=4 ul_preroll_policy=drop", start);
+
+    hold(1, start - 2 * PERIOD);
+    hold(2, start - PERIOD);
+    check(send_live(3, DEADLINE + 4 * PERIOD) == 0);
+    check(sent_count == 1 && sent[0] == 3);
+
+    teardown();
+}
+
+/* Frames held longer than the ring spans are stale */
+static void test_expire(void) {
+    const pa_usec_t start = DEADLINE - 1000;
+
+    setup("ul_preroll_frames=2", start);
+
+    hold(1, start - 10 * PERIOD);
+    check(send_live(2, DEADLINE + 4 * PERIOD - 1000) == 0);
+    check(sent_count == 1 && sent[0] == 2);
+
+    teardown();
+}
+
+/* A live frame the modem is not ready for is held */
+static void test_again(void) {
+    const pa_usec_t start = DEADLINE - 1000;
+
+    setup("ul_preroll_frames=4", start);
+
+    send_result = -EAGAIN;
+    check(send_live(1, start - PERIOD) == -EAGAIN);
+    check(sent_count == 0);
+
+    send_result = 0;
+    check(send_live(2, DEADLINE + PERIOD - 1000) == 0);
+    check(sent_count == 2);
+    check(sent[0] == 1 && sent[1] == 2);
+
+    teardown();
+}
+
+int main(int argc, char *argv[]) {
+    test_modargs();
+    test_send_fit();
+    test_hold_overflow();
+    test_no_deadline();
+    test_drop_policy();
+    test_expire();
+    test_again();
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "cmtspeech-wakeup-stats.h"
+#include "cmtspeech-test.h"
+
+#define PERIOD      (20 * PA_USEC_PER_MSEC)
+#define START       (PA_USEC_PER_SEC)
+
+static struct cmtspeech_wakeup_stats w;
+
+static void setup(void) {
+    memset(&w, 0, sizeof(w));
+    w.period = PERIOD;
+    w.threshold = CMTSPEECH_WAKEUP_LATENCY_THRESHOLD;
+    cmtspeech_wakeup_stats_reset(&w);
+}
+
+/* Wakeups on the grid are never late */
+static void test_on_time(void) {
+    unsigned k;
+
+    setup();
+
+    for (k = 0; k < 200; k++)
+        cmtspeech_wakeup_stats_dl_event(&w, START + k * PERIOD);
+    check(w.count == 199);
+    check(w.max == 0);
+    check(w.histogram[0] == 199);
+}
+
+/* A run of late wakeups stays late, and the wakeup after a late one
+ * does not look early */
+static void test_late_run(void) {
+    unsigned k;
+
+    setup();
+
+    for (k = 0; k < 10; k++)
+        cmtspeech_wakeup_stats_dl_event(&w, START + k * PERIOD);
+    for (; k < 15; k++)
+        cmtspeech_wakeup_stats_dl_event(&w, START + k * PERIOD + 3000);
+    for (; k < 20; k++)
+        cmtspeech_wakeup_stats_dl_event(&w, START + k * PERIOD);
+
+    check(w.max == 3000);
+    check(w.late == 5);
+    check(w.histogram[5] == 5);
+    check(w.histogram[0] == 14);
+}
+
+/* A late first frame sets the grid back onto the on-time ones */
+static void test_late_anchor(void) {
+    unsigned k;
+
+    setup();
+
+    cmtspeech_wakeup_stats_dl_event(&w, START + 3000);
+    for (k = 1; k < 20; k++)
+        cmtspeech_wakeup_stats_dl_event(&w, START + k * PERIOD);
+    check(w.max == 0);
+    check(w.anchor == START);
+}
+
+/* Missing frames keep the grid, a long gap or a resync starts a new one */
+static void test_missing(void) {
+    setup();
+
+    cmtspeech_wakeup_stats_dl_event(&w, START);
+    cmtspeech_wakeup_stats_dl_event(&w, START + PERIOD);
+    cmtspeech_wakeup_stats_dl_event(&w, START + 4 * PERIOD + 500);
+    check(w.slot == 4);
+    check(w.max == 500);
+
+    cmtspeech_wakeup_stats_dl_event(&w, START + 30 * PERIOD + 7000);
+    check(w.anchor == START + 30 * PERIOD + 7000);
+    check(w.count == 2);
+
+    cmtspeech_wakeup_stats_resync(&w);
+    cmtspeech_wakeup_stats_dl_event(&w, START + 40 * PERIOD);
+    check(w.anchor == START + 40 * PERIOD);
+    check(w.slot == 0);
+}
+
+/* A slow modem clock moves arrivals later, which the grid follows
+ * a window at a time, staying at most two windows of drift behind */
+static void test_drift(void) {
+    const pa_usec_t slow = PERIOD + 2;
+    unsigned k;
+
+    setup();
+
+    for (k = 0; k < 100 * CMTSPEECH_WAKEUP_WINDOW; k++)
+        cmtspeech_wakeup_stats_dl_event(&w, START + k * slow);
+    check(w.max <= 2 * CMTSPEECH_WAKEUP_WINDOW * (slow - PERIOD));
+    check(w.late == 0);
+}
+
+int main(int argc, char *argv[]) {
+    test_on_time();
+    test_late_run();
+    test_late_anchor();
+    test_missing();
+    test_drift();
+
+    return 0;
+}
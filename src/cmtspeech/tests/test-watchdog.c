@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * These PulseAudio Modules are free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "cmtspeech-watchdog.h"
+#include "cmtspeech-test.h"
+
+#define TIMEOUT     CMTSPEECH_WATCHDOG_TIMEOUT
+#define PERIOD      (20 * PA_USEC_PER_MSEC)
+#define START       (PA_USEC_PER_SEC)
+
+static struct cmtspeech_watchdog w;
+
+static void setup(void) {
+    memset(&w, 0, sizeof(w));
+    w.timeout = TIMEOUT;
+    cmtspeech_watchdog_start(&w, START);
+}
+
+/* Speech flowing both ways never trips the watchdog, and the next check
+ * follows the last progress */
+static void test_progress(void) {
+    pa_usec_t now, next;
+    unsigned ul = 0;
+
+    setup();
+
+    for (now = START; now < START + 10 * TIMEOUT; now += PERIOD) {
+        cmtspeech_watchdog_dl_frame(&w, now);
+        check(cmtspeech_watchdog_check(&w, now, ul++, true, &next) == CMTSPEECH_WATCHDOG_NONE);
+        check(next == now + TIMEOUT);
+    }
+    check(w.stalls == 0);
+}
+
+/* A stall escalates one step per timeout up to reopening the modem,
+ * then stays there */
+static void test_escalation(void) {
+    pa_usec_t now = START, next;
+
+    setup();
+
+    check(cmtspeech_watchdog_check(&w, now + TIMEOUT - 1, 0, false, &next) == CMTSPEECH_WATCHDOG_NONE);
+    check(next == START + TIMEOUT);
+
+    now = next;
+    check(cmtspeech_watchdog_check(&w, now, 0, false, &next) == CMTSPEECH_WATCHDOG_FLUSH_DL);
+    check(w.stall_start == START);
+    check(w.stalls == 1);
+    check(next == now + TIMEOUT);
+
+    now = next;
+    check(cmtspeech_watchdog_check(&w, now, 0, false, &next) == CMTSPEECH_WATCHDOG_RESYNC);
+    now = next;
+    check(cmtspeech_watchdog_check(&w, now, 0, false, &next) == CMTSPEECH_WATCHDOG_REOPEN);
+    now = next;
+    check(cmtspeech_watchdog_check(&w, now, 0, false, &next) == CMTSPEECH_WATCHDOG_REOPEN);
+    check(w.stalls == 1);
+
+    /* Speech back after the reopen starts afresh */
+    cmtspeech_watchdog_start(&w, now);
+    check(w.stall_start == 0 && w.level == 0);
+    check(w.stalls == 1);
+}
+
+/* DL back in time ends the stall before the modem is reopened */
+static void test_recovery(void) {
+    pa_usec_t now, next;
+
+    setup();
+
+    now = START + TIMEOUT;
+    check(cmtspeech_watchdog_check(&w, now, 0, false, &next) == CMTSPEECH_WATCHDOG_FLUSH_DL);
+
+    cmtspeech_watchdog_dl_frame(&w, now + PERIOD);
+    check(cmtspeech_watchdog_check(&w, now + 2 * PERIOD, 0, false, &next) == CMTSPEECH_WATCHDOG_NONE);
+    check(w.stall_start == 0 && w.stalled == 0 && w.level == 0);
+    check(next == now + PERIOD + TIMEOUT);
+
+    /* A new stall starts from the first step again */
+    now += PERIOD + TIMEOUT;
+    check(cmtspeech_watchdog_check(&w, now, 0, false, &next) == CMTSPEECH_WATCHDOG_FLUSH_DL);
+    check(w.stalls == 2);
+}
+
+/* UL only counts while it runs, and a stalled UL trips it alone */
+static void test_ul(void) {
+    pa_usec_t now, next;
+
+    setup();
+
+    /* UL not running, DL flowing */
+    for (now = START; now <= START + 2 * TIMEOUT; now += PERIOD) {
+        cmtspeech_watchdog_dl_frame(&w, now);
+        check(cmtspeech_watchdog_check(&w, now, 0, false, &next) == CMTSPEECH_WATCHDOG_NONE);
+    }
+
+    /* UL starting counts as progress, then no frames are sent */
+    check(cmtspeech_watchdog_check(&w, now, 0, true, &next) == CMTSPEECH_WATCHDOG_NONE);
+    check(next == now + TIMEOUT - PERIOD);
+    now += TIMEOUT;
+    cmtspeech_watchdog_dl_frame(&w, now);
+    check(cmtspeech_watchdog_check(&w, now, 0, true, &next) == CMTSPEECH_WATCHDOG_FLUSH_DL);
+    check(w.stalled == (1 << 1));
+
+    /* Speech stopping ends a stall short of a reopen */
+    cmtspeech_watchdog_stop(&w);
+    check(w.stall_start == 0 && w.level == 0);
+}
+
+int main(int argc, char *argv[]) {
+    test_progress();
+    test_escalation();
+    test_recovery();
+    test_ul();
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2010 Nokia Corporation.
+ *
+ * Contact: Maemo MMF Audio <mmf-audio@projects.maemo.org>
+ *          or Jyri Sarha <jyri.sarha@nokia.com>
+ *
+ * This program is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301
+ * USA.
+ */
+
+/* Samples the cmtspeech module call path statistics page.
+ *
+ * Usage: cmtspeech-stats [-n shm-name | -p pid] [-i interval-ms] [-c count]
+ *
+ * Prints the counters with their change since the previous sample and
+ * the current gauges. The page of a daemon is <name>-<pid>, without -n
+ * or -p the only such page of the default name is used. The page is
+ * readable by the daemon user only. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmtspeech-stats-shm.h"
+
+static const char *counter_names[] = CMTSPEECH_STATS_COUNTER_NAMES;
+
+/* Copies a gauge block written under its sequence count */
+static void read_block(void *dst, const volatile void *src, size_t size) {
+    const volatile uint32_t *seq = src;
+    uint32_t s1, s2;
+
+    do {
+        while ((s1 = *seq) & 1)
+            usleep(10);
+        __sync_synchronize();
+        memcpy(dst, (const void *) src, size);
+        __sync_synchronize();
+        s2 = *seq;
+    } while (s1 != s2);
+}
+
+static void print_state(uint32_t state) {
+    static const char *bits[] = { "call-ul", "call-dl", "emergency", "playback", "record", "streams", "modem-open" };
+    unsigned i;
+
+    printf("state:");
+    for (i = 0; i < sizeof(bits) / sizeof(bits[0]); i++)
+        if (state & (1U << i))
+            printf(" %s", bits[i]);
+    printf("\n");
+}
+
+/* Finds the only statistics page of the default name in /dev/shm */
+static int find_page(char *name, size_t size) {
+    const char *prefix = CMTSPEECH_STATS_SHM_DEFAULT "-";
+    struct dirent *de;
+    unsigned found = 0;
+    DIR *d;
+
+    if (!(d = opendir("/dev/shm"))) {
+        fprintf(stderr, "/dev/shm: %s\n", strerror(errno));
+        return -1;
+    }
+
+    while ((de = readdir(d)))
+        if (strncmp(de->d_name, prefix + 1, strlen(prefix) - 1) == 0 && found++ == 0)
+            snprintf(name, size, "/%s", de->d_name);
+
+    closedir(d);
+
+    if (found == 1)
+        return 0;
+
+    fprintf(stderr, found ? "Several statistics pages found, use -p pid\n" : "No statistics page found\n");
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    char buf[256];
+    const char *name = NULL;
+    unsigned interval = 1000, count = 0, n, i;
+    const volatile struct cmtspeech_stats_page *page;
+    uint32_t prev[CMTSPEECH_STATS_COUNTER_SLOTS];
+    struct stat st;
+    int fd, c;
+
+    while ((c = getopt(argc, argv, "n:p:i:c:h")) != -1) {
+        switch (c) {
+            case 'n': name = optarg; break;
+            case 'p':
+                snprintf(buf, sizeof(buf), "%s-%lu", CMTSPEECH_STATS_SHM_DEFAULT, strtoul(optarg, NULL, 0));
+                name = buf;
+                break;
+            case 'i': interval = (unsigned) strtoul(optarg, NULL, 0); break;
+            case 'c': count = (unsigned) strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n shm-name | -p pid] [-i interval-ms] [-c count]\n", argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!name) {
+        if (find_page(buf, sizeof(buf)) < 0)
+            return 1;
+        name = buf;
+    }
+
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+        fprintf(stderr, "shm_open(%s): %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(*page)) {
+        fprintf(stderr, "%s: too small for version %d statistics\n", name, CMTSPEECH_STATS_VERSION);
+        close(fd);
+        return 1;
+    }
+
+    page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        fprintf(stderr, "mmap(%s): %s\n", name, strerror(errno));
+        return 1;
+    }
+
+    if (page->magic != CMTSPEECH_STATS_MAGIC || page->version != CMTSPEECH_STATS_VERSION ||
+        page->size != sizeof(*page)) {
+        fprintf(stderr, "%s: unsupported statistics page (magic %08x version %u size %u)\n",
+                name, page->magic, page->version, page->size);
+        return 1;
+    }
+
+    n = page->n_counters;
+    if (n > CMTSPEECH_STATS_COUNTER_MAX)
+        n = CMTSPEECH_STATS_COUNTER_MAX;
+
+    memset(prev, 0, sizeof(prev));
+
+    for (i = 0; !count || i < count; i++) {
+        struct cmtspeech_stats_dl dl;
+        struct cmtspeech_stats_connection conn;
+        unsigned k;
+
+        if (i > 0)
+            usleep(interval * 1000);
+
+        if (page->magic != CMTSPEECH_STATS_MAGIC) {
+            fprintf(stderr, "%s: module unloaded\n", name);
+            return 1;
+        }
+
+        read_block(&dl, &page->dl, sizeof(dl));
+        read_block(&conn, &page->connection, sizeof(conn));
+
+        printf("--- pid %u sample %u\n", page->pid, i);
+        for (k = 0; k < n; k++) {
+            uint32_t v = page->counters[k];
+
+            printf("%-24s %10u %+8d\n", counter_names[k], v, i ? (int32_t) (v - prev[k]) : 0);
+            prev[k] = v;
+        }
+        print_state(conn.state);
+        printf("dl: queue %u frames, buffer %u bytes, underrun run %u, phase %d usec\n",
+               dl.queue_frames, dl.buffer_bytes, dl.underrun_run, dl.phase_usec);
+        printf("wakeup: max %u usec, %u late; watchdog: level %u, %u stalls\n",
+               conn.wakeup_max_usec, conn.wakeup_late, conn.watchdog_level, conn.watchdog_stalls);
+        if (conn.drift_err_q8 != INT32_MAX)
+            printf("modem drift: %+0.1f ppm +-%0.1f\n",
+                   conn.drift_ppm_q8 / 256.0, conn.drift_err_q8 / 256.0);
+        else
+            printf("modem drift: unknown\n");
+        if (conn.ntf_ppm_q8 != INT32_MAX)
+            printf("modem drift from timing notifications: %+0.1f ppm\n", conn.ntf_ppm_q8 / 256.0);
+        fflush(stdout);
+    }
+
+    return 0;
+}